@@ -5,8 +5,15 @@
 #include <stdlib.h>
 #include <cstring>
 #include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <string>
+#include <vector>
+#include <map>
+#include <sstream>
 #include "jobdesc.h"
+#include "latency.h"
 
 using namespace std;
 
@@ -15,45 +22,89 @@ using namespace std;
 // If this is set to 1 the 'yaml-cpp' lib will be used, if is set to 2 the
 // custom YAML parse implementation will be used.
 int parseMode;
+// Number of jobs that can run at the same time.
+int slots;
+// File, directory or stream ("-") with the job descriptions.
+char *source;
+// In profiling mode each job runs 'warmup' times without being measured and
+// then 'repeat' times measured. Raw samples go to 'samplesFile' if given.
+int repeat, warmup;
+char *samplesFile;
 
 /**
-    Checks if the number of console arguments are correct. In case they are
-    wrong a message is printed.
+    Prints how jobRun should be called.
+ */
+void printUsage() {
+  puts("Usage: ./jobRun <yml-file|directory|-> [-customparse] [-j <slots>]");
+  puts("                [--repeat <n> [--warmup <k>] [--samples <file>]]");
+}
+
+/**
+    Checks if the console arguments are correct, setting the parse mode, the
+    number of slots and the source of the jobs. In case they are wrong a
+    message is printed.
     @param argc Number of arguments of the program.
     @param argv Command line arguments
     @return true if are correct, false otherwise.
  */
 bool checkArgs(int argc, char** argv) {
-  // If we have 3 arguments we may be receiving a flag
-  if (argc == 3) {
+  // By default, a library for parsing the YAML file will be used and jobs run
+  // one after the other.
+  parseMode = LIB_PARSE;
+  slots = 1;
+  source = NULL;
+  repeat = warmup = 0;
+  samplesFile = NULL;
+  for (int i = 1; i < argc; ++i) {
     // If the custom parse flag is set so we use the custom parsing method.
-    if (strcmp(argv[2], "-customparse") == 0) {
-      parseMode = CUSTOM_PARSE;
-      return true;
+    if (strcmp(argv[i], "-customparse") == 0) parseMode = CUSTOM_PARSE;
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      slots = atoi(argv[++i]);
+      if (slots <= 0) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+      if (repeat <= 0) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      warmup = atoi(argv[++i]);
+      if (warmup < 0) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+      samplesFile = argv[++i];
     }
+    else if (source == NULL) source = argv[i];
     else {
-      puts("Usage: ./jobRun <yml-file> [-customparse]");
+      printUsage();
       return false;
     }
   }
-  else if (argc != 2) {
-    puts("Usage: ./jobRun <yml-file>");
+  // Warmup and samples only make sense when profiling.
+  if (source == NULL || (repeat == 0 && (warmup > 0 || samplesFile != NULL))) {
+    printUsage();
     return false;
   }
-  // By default, a library for parsing the YAML file will be used.
-  parseMode = LIB_PARSE;
   return true;
 }
 
 /**
-    Loads a job description from a YAML file specified in parameters.
-    @param destination Reference to job_desc structure to be filled.
-    @param fileName Name of the YAML file.
-    @return true if the given job_desc was filled successfully, false
+    Loads the job descriptions from the source specified in parameters.
+    @param jobs Reference to vector of job_desc to be filled.
+    @param source Name of the YAML file or directory, or "-".
+    @return true if the given vector was filled successfully, false
             otherwhise.
  */
-bool loadFile(job_desc &destination, char* fileName) {
-  if (!destination.loadFromYAML(destination, fileName, parseMode)) {
+bool loadJobs(vector <job_desc> &jobs, const char* source) {
+  if (!loadJobsFromYAML(jobs, source, parseMode)) {
     puts("Could not load specified YAML file");
     return false;
   }
@@ -61,42 +112,14 @@ bool loadFile(job_desc &destination, char* fileName) {
 }
 
 /**
-    Creates a copy of the respective file descriptors for input, output
-    and error streams. If those are specified as standard nothing is done.
-    @param job Reference to job_desc containing the input, output and error
-               file names.
-    @param inFile Pointer to input file.
-    @param outFile Pointer to output file.
-    @param errFile Pointer to error file.
-    @return true if the descriptors were succesfully copied, false
-            otherwhise.
+    Utility to convert an integer into a string.
+    @param x Integer value to convert into string.
+    @return String representation of x.
  */
-bool setupStreamFiles(job_desc &job, FILE *inFile, FILE *outFile,
-                      FILE *errFile) {
-  if (job.input != STD_IN) {
-    if ((inFile = fopen(job.input.c_str(), READ_MODE.c_str())) == NULL) {
-      return false;
-    }
-    // dup2(oldfd, newfd) makes newfd be the copy of oldfd, closing newfd first
-    // if necessary.
-    if (dup2(fileno(inFile), STDIN_FILENO) == ERROR_OCURRED) return false;
-    close(fileno(inFile));
-  }
-  if (job.output != STD_OUT) {
-    if ((outFile = fopen(job.output.c_str(), WRITE_MODE.c_str())) == NULL) {
-      return false;
-    }
-    if (dup2(fileno(outFile), STDOUT_FILENO) == ERROR_OCURRED) return false;
-    close(fileno(outFile));
-  }
-  if (job.error != STD_ERR) {
-    if ((errFile = fopen(job.error.c_str(), WRITE_MODE.c_str())) == NULL) {
-      return false;
-    }
-    if (dup2(fileno(errFile), STDERR_FILENO) == ERROR_OCURRED) return false;
-    close(fileno(errFile));
-  }
-  return true;
+string toStr(int x) {
+  stringstream converter;
+  converter << x;
+  return converter.str();
 }
 
 /**
@@ -107,72 +130,346 @@ bool setupStreamFiles(job_desc &job, FILE *inFile, FILE *outFile,
     @param code Response code given by the status or signal.
     @param description Message to be displayed when it is a failure response.
  */
-void printResult(bool success, string jobName, int code, char * description) {
+void printResult(bool success, string jobName, int code,
+                 const char *description) {
   printf("\n## %s finished ", jobName.c_str());
   if (success) printf("successfully ##\n");
   else printf("unsuccessfully (Err: %d - %s) ##\n", code, description);
 }
 
-int main (int argc, char **argv) {
-  // Contains all data read and parse from YAML file.
-  job_desc job;
-  if (!checkArgs(argc, argv)) return 0;
-  if (!loadFile(job, argv[1])) return 0;
-  // Process id to do fork.
-  pid_t pid;
-  // Pointers to job input, output and error files.
-  FILE *inFile, *outFile, *errFile;
-  // Status returned by the child process, contains either success or failure
-  // code.
-  int status;
-  // Array that contains: [job name, args..., NULL].
-  char *jobArgs [job.args.size() + 2];
-  jobArgs[0] = (char *) job.exec.c_str();
-  for (int i = 1; i <= job.args.size(); ++i) {
-    jobArgs[i] = (char *) job.args[i - 1].c_str();
-  }
-  // "The list of arguments must be terminated by a NULL pointer, and, since
-  // these are variadic functions, this pointer must be cast (char *) NULL."
-  jobArgs[job.args.size() + 1] = NULL;
+/**
+    This structure stores the result of a job run in a slot of the pool.
+ */
+struct job_result {
+  int jobIndex, code;
+  bool success;
+  double startTime, wallTime;
+};
+
+/**
+    Utility to read a monotonic clock.
+    @return Seconds elapsed since an arbitrary point in the past.
+ */
+double monotonicSeconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+    Starts a child that redirects its streams and executes the given job.
+    @param job Reference to the job to execute.
+    @return The process id of the child. On error, -1 is returned and errno is
+            set appropriately.
+ */
+pid_t launchJob(job_desc &job) {
   printf("## Running %s ##\n", job.name.c_str());
-  switch (pid = fork()) {
-    // An error occurred while trying to fork.
-    case ERROR_OCURRED:
-      printResult(false, job.name, errno, strerror(errno));
-      break;
-    // Child block is pid = 0.
-    case 0:
-      // If could not setup the stream files exit with the error number.
-      if (!setupStreamFiles(job, inFile, outFile, errFile)) exit(errno);
-      // execvp replaces the current child process image with a new one.
-      // It returns (-1) only if an error has ocurred, setting the errno
-      // with the respective error.
-      else if (execvp(jobArgs[0], jobArgs) == ERROR_OCURRED) exit(errno);
-      else exit(EXIT_SUCCESS);
+  // A single job is a pipeline of one stage with the job streams.
+  pipeline_io io;
+  io.input = job.input;
+  io.output = job.output;
+  pipeline_handle handle;
+  if (!startPipeline(vector <job_desc>(1, job), io, handle)) {
+    return ERROR_OCURRED;
+  }
+  return handle.pids[0];
+}
+
+/**
+    Analyzes the status returned by waitpid for a job, printing its result and
+    storing it.
+    @param job Reference to the finished job.
+    @param status Status returned by waitpid.
+    @param result Reference to the job_result to be filled.
+ */
+void analyzeStatus(job_desc &job, int status, job_result &result) {
+  job_status decoded = decodeStatus(status);
+  printResult(decoded.success, job.name, decoded.code,
+              decoded.description.c_str());
+  result.success = decoded.success;
+  result.code = decoded.code;
+}
+
+/**
+    Prints the result of every job and the aggregate throughput of the run.
+    @param jobs Reference to the executed jobs.
+    @param results Reference to the results, in job order.
+    @param elapsed Wall time of the whole run in seconds.
+ */
+void printSummary(vector <job_desc> &jobs, vector <job_result> &results,
+                  double elapsed) {
+  int succeeded = 0;
+  printf("\n## Summary ##\n");
+  for (int i = 0; i < results.size(); ++i) {
+    job_result &result = results[i];
+    if (result.success) ++succeeded;
+    printf("%-30s %-14s %8.3fs\n", jobs[i].name.c_str(),
+           result.success ? "ok" : ("failed (" + toStr(result.code) +
+                                   ")").c_str(), result.wallTime);
+  }
+  printf("## %d jobs: %d succeeded, %d failed in %.3fs (%.1f jobs/s) ##\n",
+         (int) jobs.size(), succeeded, (int) jobs.size() - succeeded, elapsed,
+         elapsed > 0 ? jobs.size() / elapsed : 0.0);
+}
+
+/**
+    This structure stores the latencies of a single profiled run in
+    nanoseconds. 'execToFirstOutput' is -1 when the job wrote nothing.
+ */
+struct run_sample {
+  long long forkToExec, execToFirstOutput, execToExit;
+};
+
+/**
+    Utility to read a monotonic clock with nanosecond resolution.
+    @return Nanoseconds elapsed since an arbitrary point in the past.
+ */
+long long monotonicNanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+    Runs a job once measuring its launch latencies. The exec is detected
+    through a close-on-exec pipe that reaches end of file when the exec
+    succeeds, and the standard output of the job is read through another pipe
+    to time its first byte, then forwarded to 'outputFd'.
+    @param job Reference to the job to run.
+    @param outputFd Descriptor where the output is forwarded, -1 to discard.
+    @param sample Reference to the run_sample to fill.
+    @param status Reference where the status returned by waitpid is stored.
+    @return On success, returns true. On error, returns false and errno is set
+            appropriately.
+ */
+bool profileRun(job_desc &job, int outputFd,
+                run_sample &sample, int &status) {
+  int execPipe[2], outPipe[2];
+  if (pipe2(execPipe, O_CLOEXEC) == ERROR_OCURRED) return false;
+  if (pipe2(outPipe, O_CLOEXEC) == ERROR_OCURRED) {
+    close(execPipe[0]);
+    close(execPipe[1]);
+    return false;
+  }
+  // The output is always captured, 'outputFd' already points to the file.
+  job_desc capturedJob = job;
+  capturedJob.output = STD_OUT;
+  long long forkTime = monotonicNanoseconds();
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (redirectStreams(capturedJob) &&
+        dup2(outPipe[1], STDOUT_FILENO) != ERROR_OCURRED) {
+      execJob(capturedJob);
+    }
+    // Tell the parent why the job could not be executed.
+    int error = errno;
+    write(execPipe[1], &error, sizeof(error));
+    exit(error);
+  }
+  int forkError = errno;
+  close(execPipe[1]);
+  close(outPipe[1]);
+  if (pid == ERROR_OCURRED) {
+    close(execPipe[0]);
+    close(outPipe[0]);
+    errno = forkError;
+    return false;
+  }
+
+  long long execTime = -1, firstOutputTime = -1;
+  int execError = 0;
+  struct pollfd fds[2];
+  fds[0].fd = execPipe[0];
+  fds[1].fd = outPipe[0];
+  fds[0].events = fds[1].events = POLLIN;
+  char buffer[BUFSIZ];
+  // A negative descriptor is ignored by poll, so each one is negated once it
+  // reaches end of file.
+  while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+    if (poll(fds, 2, -1) == ERROR_OCURRED) {
+      if (errno == EINTR) continue;
       break;
-    // Parent block is pid = childpid.
-    default:
-      // Waitpid is used to wait for state changes in a child of the calling
-      // process and obtain information about the child whose state has changed.
-      if (waitpid(pid, &status, 0) == pid) {
-        // Returns true if the child terminated normally.
-        if (WIFEXITED(status)) {
-          // Returns the exit status of the child.
-          int code = WEXITSTATUS(status);
-          if (code != EXIT_SUCCESS) {
-            printResult(false, job.name, code, strerror(code));
-          }
-          else printResult(true, job.name, 0, NULL);
-        }
-        // Returns true if the child process was terminated by a signal.
-        else if (WIFSIGNALED(status)) {
-          // Returns the number of the signal that caused the child process to
-          // terminate.
-          int signal_code = WTERMSIG(status);
-          printResult(false, job.name, signal_code, strsignal(signal_code));
-        }
+    }
+    if (fds[0].fd >= 0 && fds[0].revents) {
+      if (read(fds[0].fd, &execError, sizeof(execError)) <= 0) {
+        execTime = monotonicNanoseconds();
+        execError = 0;
       }
-      break;
+      close(fds[0].fd);
+      fds[0].fd = -1;
+    }
+    if (fds[1].fd >= 0 && fds[1].revents) {
+      ssize_t bytes = read(fds[1].fd, buffer, sizeof(buffer));
+      if (bytes > 0) {
+        if (firstOutputTime == -1) firstOutputTime = monotonicNanoseconds();
+        if (outputFd != -1) write(outputFd, buffer, bytes);
+      }
+      else {
+        close(fds[1].fd);
+        fds[1].fd = -1;
+      }
+    }
+  }
+  if (fds[0].fd >= 0) close(fds[0].fd);
+  if (fds[1].fd >= 0) close(fds[1].fd);
+  waitpid(pid, &status, 0);
+  long long exitTime = monotonicNanoseconds();
+  if (execTime == -1) {
+    errno = execError;
+    return false;
+  }
+  sample.forkToExec = execTime - forkTime;
+  sample.execToFirstOutput = firstOutputTime == -1 ? -1 :
+                             firstOutputTime - execTime;
+  sample.execToExit = exitTime - execTime;
+  return true;
+}
+
+/**
+    Prints the percentiles of a latency histogram in microseconds.
+    @param label Name of the measured latency.
+    @param histogram Reference to the histogram.
+ */
+void printLatencyRow(const char *label, latency_histogram &histogram) {
+  if (histogram.total == 0) {
+    printf("%-22s %10s %10s %10s %10s\n", label, "-", "-", "-", "-");
+    return;
+  }
+  printf("%-22s %10.1f %10.1f %10.1f %10.1f\n", label,
+         latencyPercentile(histogram, 50) / 1e3,
+         latencyPercentile(histogram, 90) / 1e3,
+         latencyPercentile(histogram, 99) / 1e3, histogram.maxValue / 1e3);
+}
+
+/**
+    Runs a job 'warmup' times and then 'repeat' times recording its launch
+    latencies, and prints their percentiles. The output of the job goes to its
+    Output file or is discarded when it is the standard output.
+    @param job Reference to the job to profile.
+    @param samples File where raw samples are written, NULL to skip them.
+ */
+void profileJob(job_desc &job, FILE *samples) {
+  int outputFd = -1;
+  if (job.output != STD_OUT) {
+    outputFd = open(job.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+                    O_CLOEXEC, 0644);
+    if (outputFd == ERROR_OCURRED) {
+      printResult(false, job.name, errno, strerror(errno));
+      return;
+    }
+  }
+  latency_histogram forkToExec, execToFirstOutput, execToExit;
+  int failedRuns = 0;
+  printf("## Profiling %s: %d runs after %d warmup runs ##\n",
+         job.name.c_str(), repeat, warmup);
+  for (int run = 0; run < warmup + repeat; ++run) {
+    run_sample sample;
+    int status;
+    if (!profileRun(job, outputFd, sample, status)) {
+      printResult(false, job.name, errno, strerror(errno));
+      if (outputFd != -1) close(outputFd);
+      return;
+    }
+    if (run < warmup) continue;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      ++failedRuns;
+    }
+    recordLatency(forkToExec, sample.forkToExec);
+    if (sample.execToFirstOutput != -1) {
+      recordLatency(execToFirstOutput, sample.execToFirstOutput);
+    }
+    recordLatency(execToExit, sample.execToExit);
+    if (samples != NULL) {
+      fprintf(samples, "%s,%d,%lld,%lld,%lld\n", job.name.c_str(),
+              run - warmup, sample.forkToExec, sample.execToFirstOutput,
+              sample.execToExit);
+    }
+  }
+  if (outputFd != -1) close(outputFd);
+  printf("%-22s %10s %10s %10s %10s\n", "latency (us)", "p50", "p90", "p99",
+         "max");
+  printLatencyRow("fork-to-exec", forkToExec);
+  printLatencyRow("exec-to-first-output", execToFirstOutput);
+  printLatencyRow("exec-to-exit", execToExit);
+  printf("## %s profiled: %d of %d runs failed ##\n", job.name.c_str(),
+         failedRuns, repeat);
+}
+
+int main (int argc, char **argv) {
+  // Contains all data read and parse from YAML files.
+  vector <job_desc> jobs;
+  if (!checkArgs(argc, argv)) return 0;
+  if (!loadJobs(jobs, source)) return 0;
+  // Programs are found once, before any job starts, and every run executes
+  // them by descriptor. A job whose program cannot be run fails unforked.
+  exec_cache programs;
+  vector <int> execErrors(jobs.size(), 0);
+  for (int i = 0; i < jobs.size(); ++i) {
+    if (resolveExec(programs, jobs[i])) continue;
+    execErrors[i] = errno;
+    printf("## %s cannot run %s: %s ##\n", jobs[i].name.c_str(),
+           jobs[i].exec.c_str(), strerror(errno));
+  }
+  // In profiling mode jobs run one at a time, so that they do not disturb
+  // each other measures.
+  if (repeat > 0) {
+    FILE *samples = NULL;
+    if (samplesFile != NULL) {
+      if ((samples = fopen(samplesFile, WRITE_MODE.c_str())) == NULL) {
+        printf("Could not open samples file %s\n", samplesFile);
+        return 0;
+      }
+      fprintf(samples, "job,run,fork_to_exec_ns,exec_to_first_output_ns,"
+                       "exec_to_exit_ns\n");
+    }
+    for (int i = 0; i < jobs.size(); ++i) {
+      if (execErrors[i] == 0) profileJob(jobs[i], samples);
+    }
+    if (samples != NULL) fclose(samples);
+    return 0;
+  }
+  // Results of each job, in the same order as jobs.
+  vector <job_result> results(jobs.size());
+  // Jobs running in the slots of the pool, by process id.
+  map <pid_t, int> running;
+  int nextJob = 0;
+  double runStart = monotonicSeconds();
+  while (nextJob < jobs.size() || !running.empty()) {
+    // Fill the free slots with the next jobs.
+    while (nextJob < jobs.size() && running.size() < slots) {
+      job_result &result = results[nextJob];
+      result.jobIndex = nextJob;
+      result.startTime = monotonicSeconds();
+      pid_t pid = ERROR_OCURRED;
+      errno = execErrors[nextJob];
+      if (errno == 0) pid = launchJob(jobs[nextJob]);
+      // The program was not found or an error occurred while trying to fork.
+      if (pid == ERROR_OCURRED) {
+        printResult(false, jobs[nextJob].name, errno, strerror(errno));
+        result.success = false;
+        result.code = errno;
+        result.wallTime = 0;
+      }
+      else running[pid] = nextJob;
+      ++nextJob;
+    }
+    if (running.empty()) continue;
+    // Status returned by the child process, contains either success or
+    // failure code.
+    int status;
+    // Waitpid is used to wait for state changes in a child of the calling
+    // process and obtain information about the child whose state has changed.
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid == ERROR_OCURRED) break;
+    int jobIndex = running[pid];
+    running.erase(pid);
+    job_result &result = results[jobIndex];
+    result.wallTime = monotonicSeconds() - result.startTime;
+    analyzeStatus(jobs[jobIndex], status, result);
+  }
+  // A single job keeps the original output.
+  if (jobs.size() > 1) {
+    printSummary(jobs, results, monotonicSeconds() - runStart);
   }
   return 0;
 }
@@ -3,6 +3,9 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <sys/stat.h>
+#include <dirent.h>
 #include "jobdesc.h"
 #include "yaml-cpp/yaml.h"
 
@@ -17,11 +20,10 @@ const string ARGS_ATTR   = "Args";
 const string INPUT_ATTR  = "Input";
 const string OUTPUT_ATTR = "Output";
 const string ERROR_ATTR  = "Error";
-const string STD_IN      = "stdin";
-const string STD_OUT     = "stdout";
-const string STD_ERR     = "stderr";
-const string WRITE_MODE  = "w";
+// Files stay open while jobs are forked, they must not inherit them.
+const string WRITE_MODE  = "we";
 const string READ_MODE   = "r";
+const string STREAM_SOURCE = "-";
 
 /**
     Receives a reference to a string and trims it, that is, removes it's
@@ -86,22 +88,20 @@ string parseAttribute(ifstream &ifs, string &value) {
 }
 
 /**
-    Method that uses a custom implementation to parse a YAML file and fill
-    a job_desc with the respective values.
+    Method that uses a custom implementation to parse the attributes of a
+    single job and fill a job_desc with the respective values.
+    @param ifs Reference to ifstream positioned right after the "- Job : -"
+               header of the job.
     @param destination Reference to the job_desc (job description) to be filled.
-    @param fileName Name of the YAML file to be opened and parsed.
-    @return true if the file was successfully parsed, false otherwise.
+    @return true if the job was successfully parsed, false otherwise.
   */
-bool parseFromCustom(job_desc &destination, char* fileName) {
+bool parseCustomJob(ifstream &ifs, job_desc &destination) {
   // Bitmask used to determine whether all attributes were parsed
   // successfully or not. Each attribute is a bit, starting from Name (0) to
   // Error (5). If all attributes were parsed the mask should look like this:
   // 111111, that is equal to (1 << 6) - 1.
   short completeMask = 0;
-  ifstream ifs (fileName, ifstream::in);
-  if (!ifs.is_open()) return false;
   string buffer;
-  ifs >> buffer >> buffer >> buffer >> buffer; // - Job : -
 
   for (int i = 0; i < PARAMS_COUNT; ++i) {
     string attrName = parseAttribute(ifs, buffer);
@@ -143,23 +143,40 @@ bool parseFromCustom(job_desc &destination, char* fileName) {
 }
 
 /**
-    Method that uses 'yaml-cpp' library to parse a YAML file and fill a
-    job_desc with the respective values.
-    @param destination Reference to the job_desc (job description) to be filled.
+    Method that uses a custom implementation to parse a YAML file and fill
+    a vector of job_desc with every job found in it.
+    @param jobs Reference to the vector where jobs will be appended.
     @param fileName Name of the YAML file to be opened and parsed.
     @return true if the file was successfully parsed, false otherwise.
+  */
+bool parseFromCustom(vector <job_desc> &jobs, const char* fileName) {
+  ifstream ifs (fileName, ifstream::in);
+  if (!ifs.is_open()) return false;
+  string buffer;
+  int parsedJobs = 0;
+  // Every job starts with: - Job : -
+  while (ifs >> buffer >> buffer >> buffer >> buffer) {
+    job_desc job;
+    if (!parseCustomJob(ifs, job)) return false;
+    jobs.push_back(job);
+    ++parsedJobs;
+  }
+  return parsedJobs > 0;
+}
+
+/**
+    Method that uses 'yaml-cpp' library to fill a job_desc with the values of
+    a single job.
+    @param node Map inside the 'Job' node.
+    @param destination Reference to the job_desc (job description) to be filled.
+    @return true if the job was successfully parsed, false otherwise.
 */
-bool parseFromLib(job_desc &destination, char* fileName) {
+bool parseLibJob(YAML::Node node, job_desc &destination) {
   // Bitmask used to determine whether all attributes were parsed
   // successfully or not. Each attribute is a bit, starting from Name (0) to
   // Error (5). If all attributes were parsed the mask should look like this:
   // 111111, that is equal to (1 << 6) - 1.
   short completeMask = 0;
-  YAML::Node node = YAML::LoadFile(fileName);
-  // If the 'Job' node doesn't exist return false because we couldn't load
-  // YAML file.
-  if (!node[0][JOB_ATTR][0]) return false;
-  node = node[0][JOB_ATTR][0]; // Map inside Job
   // Iterate through pairs found in Job node.
   for (YAML::const_iterator it = node.begin(); it != node.end(); ++it) {
     // Get the key, i.e. attribute name as string.
@@ -200,26 +217,89 @@ bool parseFromLib(job_desc &destination, char* fileName) {
 }
 
 /**
-    Loads a job description from a YAML file, storing all the data in the
-    job_desc structure given.
-    @param description Reference to job_desc where data will be saved.
-    @param fileName Name of the YAML file that contains the job description.
+    Method that uses 'yaml-cpp' library to fill a vector of job_desc with
+    every job of a loaded YAML document, that is a list of 'Job' entries.
+    @param jobs Reference to the vector where jobs will be appended.
+    @param rootNode Loaded YAML document.
+    @return true if the document was successfully parsed, false otherwise.
+*/
+bool parseFromLib(vector <job_desc> &jobs, YAML::Node rootNode) {
+  if (!rootNode.IsSequence() || rootNode.size() == 0) return false;
+  for (int i = 0; i < rootNode.size(); ++i) {
+    // If the 'Job' node doesn't exist return false because we couldn't load
+    // YAML file.
+    if (!rootNode[i][JOB_ATTR][0]) return false;
+    job_desc job;
+    if (!parseLibJob(rootNode[i][JOB_ATTR][0], job)) return false;
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+/**
+    Loads every job description of a single YAML file.
+    @param jobs Reference to the vector where jobs will be appended.
+    @param fileName Name of the YAML file.
     @param parseMode If 1 'yaml-cpp' library will be used to parse, if 2 the
                      custom parse implementation will be used.
+    @return true if the file was successfully parsed, false otherwise.
   */
-bool job_desc::loadFromYAML(job_desc &destination, char* fileName,
-                            int parseMode) {
-  bool parseResult;
-  switch (parseMode) {
-    case LIB_PARSE:
-      parseResult = parseFromLib(destination, fileName);
-      break;
-    case CUSTOM_PARSE:
-      parseResult = parseFromCustom(destination, fileName);
-      break;
-    default:
-      parseResult = parseFromLib(destination, fileName);
-      break;
+bool loadJobsFromFile(vector <job_desc> &jobs, const char* fileName,
+                      int parseMode) {
+  if (parseMode == CUSTOM_PARSE) return parseFromCustom(jobs, fileName);
+  return parseFromLib(jobs, YAML::LoadFile(fileName));
+}
+
+/**
+    Checks if a file name has a YAML extension.
+    @param fileName Name of the file.
+    @return true if it ends with ".yml" or ".yaml", false otherwise.
+  */
+bool hasYAMLExtension(const string &fileName) {
+  size_t dot = fileName.rfind('.');
+  if (dot == string::npos) return false;
+  string extension = fileName.substr(dot);
+  return extension == ".yml" || extension == ".yaml";
+}
+
+/**
+    Loads every job description found in a source, which can be a YAML file
+    with a list of jobs, a directory with YAML files (read in name order) or
+    "-" for a stream of YAML documents in standard input.
+    @param jobs Reference to the vector where jobs will be appended.
+    @param source Name of the file or directory, or "-".
+    @param parseMode If 1 'yaml-cpp' library will be used to parse, if 2 the
+                     custom parse implementation will be used. The stream
+                     source is always parsed with the library.
+    @return true if every job was successfully parsed, false otherwise.
+  */
+bool loadJobsFromYAML(vector <job_desc> &jobs, const char* source,
+                      int parseMode) {
+  if (source == STREAM_SOURCE) {
+    // Each document of the stream is a list of jobs.
+    vector <YAML::Node> documents = YAML::LoadAll(cin);
+    for (int i = 0; i < documents.size(); ++i) {
+      if (!parseFromLib(jobs, documents[i])) return false;
+    }
+    return !documents.empty();
+  }
+  struct stat sourceStat;
+  if (stat(source, &sourceStat) == -1) return false;
+  if (!S_ISDIR(sourceStat.st_mode)) {
+    return loadJobsFromFile(jobs, source, parseMode);
+  }
+  DIR *directory = opendir(source);
+  if (directory == NULL) return false;
+  vector <string> manifests;
+  struct dirent *entry;
+  while ((entry = readdir(directory)) != NULL) {
+    if (hasYAMLExtension(entry->d_name)) manifests.push_back(entry->d_name);
+  }
+  closedir(directory);
+  sort(manifests.begin(), manifests.end());
+  for (int i = 0; i < manifests.size(); ++i) {
+    string path = string(source) + "/" + manifests[i];
+    if (!loadJobsFromFile(jobs, path.c_str(), parseMode)) return false;
   }
-  return parseResult;
+  return !manifests.empty();
 }
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include "jobexec.h"
 
 extern const int PARAMS_COUNT;
 extern const std::string JOB_ATTR;
@@ -12,19 +13,26 @@ extern const std::string ARGS_ATTR;
 extern const std::string INPUT_ATTR;
 extern const std::string OUTPUT_ATTR;
 extern const std::string ERROR_ATTR;
-extern const std::string STD_IN;
-extern const std::string STD_OUT;
-extern const std::string STD_ERR;
 extern const std::string WRITE_MODE;
 extern const std::string READ_MODE;
 
+extern const std::string STREAM_SOURCE;
+
 const int LIB_PARSE = 1;
 const int CUSTOM_PARSE = 2;
 
-struct job_desc {
-  std::string name, exec, input, output, error;
-  std::vector <std::string> args;
-  bool loadFromYAML(job_desc &destination, char* fileName, int parseMode);
-};
+/**
+    Loads every job description found in a source, which can be a YAML file
+    with a list of jobs, a directory with YAML files (read in name order) or
+    "-" for a stream of YAML documents in standard input.
+    @param jobs Reference to the vector where jobs will be appended.
+    @param source Name of the file or directory, or "-".
+    @param parseMode If 1 'yaml-cpp' library will be used to parse, if 2 the
+                     custom parse implementation will be used. The stream
+                     source is always parsed with the library.
+    @return true if every job was successfully parsed, false otherwise.
+  */
+bool loadJobsFromYAML(std::vector <job_desc> &jobs, const char* source,
+                      int parseMode);
 
 #endif
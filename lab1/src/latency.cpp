@@ -0,0 +1,74 @@
+#include <vector>
+#include <cmath>
+#include "latency.h"
+
+using namespace std;
+
+// Buckets per power of two are 2^(SUB_BITS - 1), values below 2^SUB_BITS
+// have one bucket each.
+const int SUB_BITS = 6;
+const int HALF_BUCKETS = 1 << (SUB_BITS - 1);
+// Enough buckets for any 64 bits value.
+const int BUCKET_COUNT = (64 - SUB_BITS + 2) * HALF_BUCKETS;
+
+latency_histogram::latency_histogram() : counts(BUCKET_COUNT, 0), total(0),
+                                         maxValue(0) {}
+
+/**
+    Finds the bucket of a value.
+    @param value Value to look for.
+    @return Index of the bucket.
+ */
+int bucketOf(unsigned long long value) {
+  if (value < (1ULL << SUB_BITS)) return value;
+  int highestBit = 63 - __builtin_clzll(value);
+  int shift = highestBit - SUB_BITS + 1;
+  return shift * HALF_BUCKETS + (value >> shift);
+}
+
+/**
+    Finds the highest value that falls in a bucket.
+    @param bucket Index of the bucket.
+    @return Highest value of the bucket.
+ */
+unsigned long long bucketHighest(int bucket) {
+  if (bucket < (1 << SUB_BITS)) return bucket;
+  int shift = bucket / HALF_BUCKETS - 1;
+  unsigned long long sub = bucket - shift * HALF_BUCKETS;
+  return ((sub + 1) << shift) - 1;
+}
+
+/**
+    Records a latency in a histogram.
+    @param histogram Reference to the histogram.
+    @param nanoseconds Latency to record.
+ */
+void recordLatency(latency_histogram &histogram,
+                   unsigned long long nanoseconds) {
+  ++histogram.counts[bucketOf(nanoseconds)];
+  ++histogram.total;
+  if (nanoseconds > histogram.maxValue) histogram.maxValue = nanoseconds;
+}
+
+/**
+    Computes a percentile of the recorded latencies.
+    @param histogram Reference to the histogram.
+    @param percentile Percentile to compute, from 0 to 100.
+    @return Highest value of the bucket holding the percentile (never above
+            the maximum recorded value), or 0 if nothing was recorded.
+ */
+unsigned long long latencyPercentile(latency_histogram &histogram,
+                                     double percentile) {
+  if (histogram.total == 0) return 0;
+  unsigned long long wanted = ceil(percentile / 100 * histogram.total);
+  if (wanted == 0) wanted = 1;
+  unsigned long long seen = 0;
+  for (int i = 0; i < histogram.counts.size(); ++i) {
+    seen += histogram.counts[i];
+    if (seen >= wanted) {
+      unsigned long long highest = bucketHighest(i);
+      return highest < histogram.maxValue ? highest : histogram.maxValue;
+    }
+  }
+  return histogram.maxValue;
+}
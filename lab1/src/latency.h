@@ -0,0 +1,35 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <vector>
+
+/**
+    This structure stores a log-linear histogram of latencies in nanoseconds.
+    Each power of two is split in 32 buckets, so any recorded value is known
+    with an error below 3.2%, from nanoseconds up to hours.
+ */
+struct latency_histogram {
+  std::vector <unsigned long long> counts;
+  unsigned long long total, maxValue;
+  latency_histogram();
+};
+
+/**
+    Records a latency in a histogram.
+    @param histogram Reference to the histogram.
+    @param nanoseconds Latency to record.
+ */
+void recordLatency(latency_histogram &histogram,
+                   unsigned long long nanoseconds);
+
+/**
+    Computes a percentile of the recorded latencies.
+    @param histogram Reference to the histogram.
+    @param percentile Percentile to compute, from 0 to 100.
+    @return Highest value of the bucket holding the percentile (never above
+            the maximum recorded value), or 0 if nothing was recorded.
+ */
+unsigned long long latencyPercentile(latency_histogram &histogram,
+                                     double percentile);
+
+#endif
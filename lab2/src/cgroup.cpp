@@ -0,0 +1,133 @@
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include "cgroup.h"
+
+using namespace std;
+
+const long long MEMORY_UNKNOWN = -1;
+
+/**
+  Parses a memory size such as "1048576", "512K", "256M" or "2G".
+  @param text String with the size.
+  @param bytes Reference where the size in bytes will be stored.
+  @return true if the size is valid and fits in a long long, false otherwise.
+ */
+bool parseMemorySize(const string &text, long long &bytes) {
+  char *end;
+  errno = 0;
+  bytes = strtoll(text.c_str(), &end, 10);
+  if (end == text.c_str() || bytes < 0 || errno == ERANGE) return false;
+  int shift = 0;
+  switch (*end) {
+    case 'G': case 'g': shift += 10;
+      // fall through
+    case 'M': case 'm': shift += 10;
+      // fall through
+    case 'K': case 'k': shift += 10; ++end;
+      // fall through
+    case '\0': break;
+    default: return false;
+  }
+  if (bytes > (LLONG_MAX >> shift)) return false;
+  bytes <<= shift;
+  return *end == '\0';
+}
+
+/**
+  Writes a value into a cgroup interface file.
+  @param file Path of the file.
+  @param value Value to write.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool writeCgroupFile(const string &file, const string &value) {
+  int fd = open(file.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd == -1) return false;
+  bool written = write(fd, value.c_str(), value.size()) == value.size();
+  int writeError = errno;
+  close(fd);
+  errno = writeError;
+  return written;
+}
+
+/**
+  Enables the memory controller for the children of a delegated cgroup v2
+  subtree. It is not an error if it was already enabled.
+  @param root Path of the delegated cgroup directory.
+  @return true if the memory controller is available for children, false
+          otherwise.
+ */
+bool enableMemoryController(const string &root) {
+  return writeCgroupFile(root + "/cgroup.subtree_control", "+memory");
+}
+
+/**
+  Creates a child cgroup for a pipe under the delegated subtree, setting its
+  memory.max if a limit is given.
+  @param root Path of the delegated cgroup directory.
+  @param name Name of the child cgroup.
+  @param memoryMax Memory limit in bytes, 0 means no limit.
+  @param path Reference where the path of the new cgroup will be stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool createCgroup(const string &root, const string &name, long long memoryMax,
+                  string &path) {
+  path = root + "/" + name;
+  if (mkdir(path.c_str(), S_IRWXU) == -1 && errno != EEXIST) return false;
+  if (memoryMax > 0) {
+    stringstream limit;
+    limit << memoryMax;
+    if (!writeCgroupFile(path + "/memory.max", limit.str())) {
+      int limitError = errno;
+      rmdir(path.c_str());
+      errno = limitError;
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+  Moves the calling process into the given cgroup. Children forked later will
+  belong to it too.
+  @param path Path of the cgroup.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool joinCgroup(const string &path) {
+  // Writing "0" moves the writing process itself.
+  return writeCgroupFile(path + "/cgroup.procs", "0");
+}
+
+/**
+  Reads a memory accounting file of a cgroup, i.e. "memory.current" or
+  "memory.peak".
+  @param path Path of the cgroup.
+  @param file Name of the file to read.
+  @return The value in bytes, or MEMORY_UNKNOWN if it could not be read.
+ */
+long long readCgroupMemory(const string &path, const string &file) {
+  FILE *accounting = fopen((path + "/" + file).c_str(), "re");
+  if (accounting == NULL) return MEMORY_UNKNOWN;
+  long long value;
+  if (fscanf(accounting, "%lld", &value) != 1) value = MEMORY_UNKNOWN;
+  fclose(accounting);
+  return value;
+}
+
+/**
+  Removes a cgroup that no longer has processes.
+  @param path Path of the cgroup.
+ */
+void removeCgroup(const string &path) {
+  rmdir(path.c_str());
+}
@@ -0,0 +1,62 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <string>
+
+extern const long long MEMORY_UNKNOWN;
+
+/**
+  Parses a memory size such as "1048576", "512K", "256M" or "2G".
+  @param text String with the size.
+  @param bytes Reference where the size in bytes will be stored.
+  @return true if the size is valid, false otherwise.
+ */
+bool parseMemorySize(const std::string &text, long long &bytes);
+
+/**
+  Enables the memory controller for the children of a delegated cgroup v2
+  subtree. It is not an error if it was already enabled.
+  @param root Path of the delegated cgroup directory.
+  @return true if the memory controller is available for children, false
+          otherwise.
+ */
+bool enableMemoryController(const std::string &root);
+
+/**
+  Creates a child cgroup for a pipe under the delegated subtree, setting its
+  memory.max if a limit is given.
+  @param root Path of the delegated cgroup directory.
+  @param name Name of the child cgroup.
+  @param memoryMax Memory limit in bytes, 0 means no limit.
+  @param path Reference where the path of the new cgroup will be stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool createCgroup(const std::string &root, const std::string &name,
+                  long long memoryMax, std::string &path);
+
+/**
+  Moves the calling process into the given cgroup. Children forked later will
+  belong to it too.
+  @param path Path of the cgroup.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool joinCgroup(const std::string &path);
+
+/**
+  Reads a memory accounting file of a cgroup, i.e. "memory.current" or
+  "memory.peak".
+  @param path Path of the cgroup.
+  @param file Name of the file to read.
+  @return The value in bytes, or MEMORY_UNKNOWN if it could not be read.
+ */
+long long readCgroupMemory(const std::string &path, const std::string &file);
+
+/**
+  Removes a cgroup that no longer has processes.
+  @param path Path of the cgroup.
+ */
+void removeCgroup(const std::string &path);
+
+#endif
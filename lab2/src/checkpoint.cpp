@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "checkpoint.h"
+#include "history.h"
+
+using namespace std;
+
+#define ERROR_OCURRED -1
+
+const string DEFAULT_CHECKPOINT_DIR = "./checkpoints";
+const string CHECKPOINT_EXT = ".ckpt";
+// Suffix of a checkpoint that is still being written.
+const string PARTIAL_EXT = ".part";
+
+/**
+  Names the checkpoint file of each stage of a pipe that saves its output:
+  <dir>/<pipe>.<stage number>.<job>.<signature>.ckpt, where the signature
+  covers the input of the pipe (its data when it is fed) and every stage up
+  to that one, so that a changed pipe does not resume from the output of the
+  old one. Names are escaped, those of matrix instances may hold paths.
+  @param pipeToRun Reference to the pipe, its checkpoint files are stored.
+  @param stages Stages of the pipe, in pipe order.
+  @param dir Directory of the checkpoints.
+  @return true if some stage of the pipe saves its output, false otherwise.
+ */
+bool nameCheckpoints(pipe_desc &pipeToRun, const vector <job_desc> &stages,
+                     const string &dir) {
+  bool named = false;
+  pipeToRun.checkpointFiles.assign(stages.size(), "");
+  string description = pipeToRun.input;
+  if (pipeToRun.feedInput) description += '\0' + pipeToRun.inputData;
+  for (int i = 0; i < stages.size(); ++i) {
+    description += '\0' + stages[i].exec;
+    for (int j = 0; j < stages[i].args.size(); ++j) {
+      description += '\0' + stages[i].args[j];
+    }
+    if (i >= pipeToRun.checkpoints.size() || !pipeToRun.checkpoints[i]) {
+      continue;
+    }
+    pipeToRun.checkpointFiles[i] = dir + "/" +
+                                   escapeFileName(pipeToRun.name) + "." +
+                                   toStr(i + 1) + "." +
+                                   escapeFileName(stages[i].name) + "." +
+                                   signDescription(description) +
+                                   CHECKPOINT_EXT;
+    named = true;
+  }
+  return named;
+}
+
+/**
+  Makes a pipe resume after its last stage with a completed checkpoint: the
+  stages up to it are dropped and the checkpoint becomes the input. A
+  checkpoint older than the input file of the pipe is not used.
+  @param pipeToRun Reference to the pipe, whose checkpoint files are named.
+  @return true if the pipe resumes from a checkpoint, false if it runs whole.
+ */
+bool resumeFromCheckpoint(pipe_desc &pipeToRun) {
+  struct stat input;
+  bool hasInput = pipeToRun.input != STD_IN &&
+                  stat(pipeToRun.input.c_str(), &input) == 0;
+  for (int i = pipeToRun.checkpointFiles.size() - 1; i >= 0; --i) {
+    struct stat checkpoint;
+    if (pipeToRun.checkpointFiles[i].empty() ||
+        stat(pipeToRun.checkpointFiles[i].c_str(), &checkpoint) != 0 ||
+        (hasInput && checkpoint.st_mtime < input.st_mtime)) continue;
+    pipeToRun.input = pipeToRun.checkpointFiles[i];
+    pipeToRun.feedInput = pipeToRun.inputEndpoint = false;
+    pipeToRun.resumedStage = i;
+    int dropped = i + 1;
+    pipeToRun.jobsIndexes.erase(pipeToRun.jobsIndexes.begin(),
+                                pipeToRun.jobsIndexes.begin() + dropped);
+    pipeToRun.checkpoints.erase(pipeToRun.checkpoints.begin(),
+                                pipeToRun.checkpoints.begin() + dropped);
+    if (pipeToRun.stagePlacement.size() >= dropped) {
+      pipeToRun.stagePlacement.erase(pipeToRun.stagePlacement.begin(),
+                                     pipeToRun.stagePlacement.begin() +
+                                     dropped);
+    }
+    return true;
+  }
+  return false;
+}
+
+/**
+  Tells the first stage a pipe runs: the one after the checkpoint it resumed
+  from, or the first one.
+  @param pipeToRun Reference to the pipe.
+  @return Index of the stage in the whole pipe.
+ */
+int firstRunStage(const pipe_desc &pipeToRun) {
+  return pipeToRun.resumedStage + 1;
+}
+
+/**
+  Opens the files that receive the checkpoints of a pipe while it runs, each
+  one under a temporary name until it is complete.
+  @param pipeToRun Reference to the pipe.
+  @param io Reference to the pipeline io, its tee descriptors are set.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool openCheckpoints(const pipe_desc &pipeToRun, pipeline_io &io) {
+  const vector <string> &files = pipeToRun.checkpointFiles;
+  if (files.empty()) return true;
+  int first = firstRunStage(pipeToRun);
+  io.teeFds.assign(files.size() - first, ERROR_OCURRED);
+  for (int i = 0; i < io.teeFds.size(); ++i) {
+    if (files[first + i].empty()) continue;
+    string partial = files[first + i] + PARTIAL_EXT;
+    io.teeFds[i] = open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+                        O_CLOEXEC, 0644);
+    if (io.teeFds[i] == ERROR_OCURRED) return false;
+  }
+  return true;
+}
+
+/**
+  Closes the checkpoint files of a pipe once it was waited. A checkpoint is
+  kept if its stage succeeded and all its output was saved. When every
+  stage of the pipe succeeded no checkpoint is needed anymore, so every one
+  is removed, the one it resumed from included.
+  @param pipeToRun Reference to the pipe.
+  @param io Reference to the pipeline io given to openCheckpoints.
+  @param handle Reference to the waited pipeline handle.
+  @param started Whether every stage was started and the last one waited.
+ */
+void closeCheckpoints(const pipe_desc &pipeToRun, pipeline_io &io,
+                      const pipeline_handle &handle, bool started) {
+  const vector <string> &files = pipeToRun.checkpointFiles;
+  // The status of a pipe is the one of its last stage, a checkpoint is still
+  // needed if an earlier one failed.
+  bool success = started;
+  for (int i = 0; i < handle.statuses.size(); ++i) {
+    success &= handle.statuses[i].success;
+  }
+  int first = firstRunStage(pipeToRun);
+  for (int i = 0; i < io.teeFds.size(); ++i) {
+    if (io.teeFds[i] == ERROR_OCURRED) continue;
+    close(io.teeFds[i]);
+    const string &file = files[first + i];
+    string partial = file + PARTIAL_EXT;
+    bool complete = i < handle.statuses.size() &&
+                    handle.statuses[i].success &&
+                    i < handle.teeStatuses.size() &&
+                    handle.teeStatuses[i].success;
+    // An incomplete checkpoint also drops the one of a previous run.
+    if (complete && !success) rename(partial.c_str(), file.c_str());
+    else {
+      unlink(partial.c_str());
+      unlink(file.c_str());
+    }
+  }
+  io.teeFds.clear();
+  for (int i = 0; i < first && success; ++i) {
+    if (!files[i].empty()) unlink(files[i].c_str());
+  }
+}
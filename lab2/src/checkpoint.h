@@ -0,0 +1,66 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include "jobexec.h"
+#include "jobdesc.h"
+
+extern const std::string DEFAULT_CHECKPOINT_DIR;
+
+/**
+  Names the checkpoint file of each stage of a pipe that saves its output:
+  <dir>/<pipe>.<stage number>.<job>.<signature>.ckpt, where the signature
+  covers the input of the pipe (its data when it is fed) and every stage up
+  to that one, so that a changed pipe does not resume from the output of the
+  old one.
+  @param pipeToRun Reference to the pipe, its checkpoint files are stored.
+  @param stages Stages of the pipe, in pipe order.
+  @param dir Directory of the checkpoints.
+  @return true if some stage of the pipe saves its output, false otherwise.
+ */
+bool nameCheckpoints(pipe_desc &pipeToRun,
+                     const std::vector <job_desc> &stages,
+                     const std::string &dir);
+
+/**
+  Makes a pipe resume after its last stage with a completed checkpoint: the
+  stages up to it are dropped and the checkpoint becomes the input. A
+  checkpoint older than the input file of the pipe is not used.
+  @param pipeToRun Reference to the pipe, whose checkpoint files are named.
+  @return true if the pipe resumes from a checkpoint, false if it runs whole.
+ */
+bool resumeFromCheckpoint(pipe_desc &pipeToRun);
+
+/**
+  Tells the first stage a pipe runs: the one after the checkpoint it resumed
+  from, or the first one.
+  @param pipeToRun Reference to the pipe.
+  @return Index of the stage in the whole pipe.
+ */
+int firstRunStage(const pipe_desc &pipeToRun);
+
+/**
+  Opens the files that receive the checkpoints of a pipe while it runs, each
+  one under a temporary name until it is complete.
+  @param pipeToRun Reference to the pipe.
+  @param io Reference to the pipeline io, its tee descriptors are set.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool openCheckpoints(const pipe_desc &pipeToRun, pipeline_io &io);
+
+/**
+  Closes the checkpoint files of a pipe once it was waited. A checkpoint is
+  kept if its stage succeeded and all its output was saved. When every
+  stage of the pipe succeeded no checkpoint is needed anymore, so every one
+  is removed, the one it resumed from included.
+  @param pipeToRun Reference to the pipe.
+  @param io Reference to the pipeline io given to openCheckpoints.
+  @param handle Reference to the waited pipeline handle.
+  @param started Whether every stage was started and the last one waited.
+ */
+void closeCheckpoints(const pipe_desc &pipeToRun, pipeline_io &io,
+                      const pipeline_handle &handle, bool started);
+
+#endif
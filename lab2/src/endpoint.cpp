@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include "endpoint.h"
+#include "protocol.h"
+
+using namespace std;
+
+#define ERROR_OCURRED -1
+
+// Most bytes a relay moves with one splice call.
+const size_t RELAY_CHUNK = 64 * 1024;
+
+/**
+  Tells if an input or output names an endpoint: a "unix:<path>" socket
+  address or an existing FIFO.
+  @param name Input or output of a pipe.
+  @return true if it is an endpoint, false otherwise.
+ */
+bool isEndpoint(const string &name) {
+  if (name.compare(0, UNIX_PREFIX.size(), UNIX_PREFIX) == 0) return true;
+  struct stat info;
+  return name != STD_IN && name != STD_OUT &&
+         stat(name.c_str(), &info) == 0 && S_ISFIFO(info.st_mode);
+}
+
+/**
+  Maps the counters shared with the relays of a pipe with endpoints.
+  @param pipeToRun Reference to the pipe, its counters are stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool createEndpointStats(pipe_desc &pipeToRun) {
+  void *shared = mmap(NULL, sizeof(endpoint_stats), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) return false;
+  // Anonymous memory starts zeroed.
+  pipeToRun.endpointStats = (endpoint_stats *) shared;
+  return true;
+}
+
+/**
+  Unmaps the counters of a pipe, if it has them.
+  @param pipeToRun Reference to the pipe.
+ */
+void releaseEndpointStats(pipe_desc &pipeToRun) {
+  if (pipeToRun.endpointStats == NULL) return;
+  munmap(pipeToRun.endpointStats, sizeof(endpoint_stats));
+  pipeToRun.endpointStats = NULL;
+}
+
+/**
+  Prints the bytes that went through the endpoints of a finished pipe.
+  @param out Stream to print to.
+  @param pipeToRun Reference to the pipe.
+ */
+void printEndpointStats(FILE *out, const pipe_desc &pipeToRun) {
+  const endpoint_stats *stats = pipeToRun.endpointStats;
+  if (stats == NULL) return;
+  if (pipeToRun.inputEndpoint) {
+    fprintf(out, "## %s read %llu bytes from %s ##\n",
+            pipeToRun.name.c_str(), stats->inputBytes,
+            pipeToRun.input.c_str());
+  }
+  if (pipeToRun.outputEndpoint) {
+    fprintf(out, "## %s wrote %llu bytes to %s, %d reconnects ##\n",
+            pipeToRun.name.c_str(), stats->outputBytes,
+            pipeToRun.output.c_str(), stats->reconnects);
+  }
+}
+
+/**
+  Opens an endpoint: connects to a socket or opens a FIFO, which waits until
+  the other side opens it too.
+  @param name Endpoint to open.
+  @param flags O_RDONLY or O_WRONLY, for FIFOs.
+  @param fd Reference where the descriptor will be stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool openEndpoint(const string &name, int flags, int &fd) {
+  if (name.compare(0, UNIX_PREFIX.size(), UNIX_PREFIX) == 0) {
+    return connectEndpoint(name, fd);
+  }
+  fd = open(name.c_str(), flags | O_CLOEXEC);
+  return fd != ERROR_OCURRED;
+}
+
+/**
+  Opens an endpoint, trying again after the delay of the pipe as many times
+  as the pipe allows.
+  @param pipeToRun Reference to the pipe.
+  @param name Endpoint to open.
+  @param flags O_RDONLY or O_WRONLY, for FIFOs.
+  @param fd Reference where the descriptor will be stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately by the last attempt.
+ */
+bool openWithRetries(const pipe_desc &pipeToRun, const string &name,
+                     int flags, int &fd) {
+  for (int attempt = 0; ; ++attempt) {
+    if (openEndpoint(name, flags, fd)) return true;
+    if (attempt >= pipeToRun.reconnectAttempts) return false;
+    usleep(pipeToRun.reconnectDelay * 1000000);
+  }
+}
+
+/**
+  Moves bytes from one descriptor to another, with splice when one of them
+  is a pipe and with read and write otherwise.
+  @param from Descriptor to read from.
+  @param to Descriptor to write to.
+  @return Bytes moved, 0 at end of file. On error, returns -1 and errno is
+          set appropriately.
+ */
+ssize_t moveChunk(int from, int to) {
+  ssize_t moved = splice(from, NULL, to, NULL, RELAY_CHUNK, SPLICE_F_MOVE);
+  if (moved != ERROR_OCURRED || errno != EINVAL) return moved;
+  char buffer[BUFSIZ];
+  ssize_t bytes = read(from, buffer, sizeof(buffer));
+  if (bytes <= 0) return bytes;
+  for (ssize_t written = 0; written < bytes; ) {
+    ssize_t sent = write(to, buffer + written, bytes - written);
+    if (sent == ERROR_OCURRED) {
+      if (errno == EINTR) continue;
+      return ERROR_OCURRED;
+    }
+    written += sent;
+  }
+  return bytes;
+}
+
+/**
+  Tells if an error means that the other side of an endpoint went away.
+  @param error Value of errno.
+  @return true for a closed FIFO or a reset or closed socket.
+ */
+bool lostEndpoint(int error) {
+  return error == EPIPE || error == ECONNRESET || error == ENOTCONN;
+}
+
+/**
+  Body of the relay of an output endpoint: moves what arrives on its standard
+  input to the endpoint, which blocks the pipe while the consumer is slow.
+  When the consumer goes away the endpoint is opened again as the pipe
+  allows; what the consumer had not read is lost.
+  @param pipeToRun Reference to the pipe.
+  @return On success, returns true once the input reached end of file. On
+          error, returns false and errno is set appropriately.
+ */
+bool relayOutput(const pipe_desc &pipeToRun) {
+  int fd;
+  if (!openWithRetries(pipeToRun, pipeToRun.output, O_WRONLY, fd)) {
+    return false;
+  }
+  while (true) {
+    ssize_t moved = moveChunk(STDIN_FILENO, fd);
+    if (moved == 0) break;
+    if (moved > 0) {
+      __atomic_add_fetch(&pipeToRun.endpointStats->outputBytes, moved,
+                         __ATOMIC_RELAXED);
+      continue;
+    }
+    if (errno == EINTR) continue;
+    int error = errno;
+    close(fd);
+    errno = error;
+    if (!lostEndpoint(error) || pipeToRun.reconnectAttempts == 0) {
+      return false;
+    }
+    usleep(pipeToRun.reconnectDelay * 1000000);
+    if (!openWithRetries(pipeToRun, pipeToRun.output, O_WRONLY, fd)) {
+      return false;
+    }
+    __atomic_add_fetch(&pipeToRun.endpointStats->reconnects, 1,
+                       __ATOMIC_RELAXED);
+  }
+  close(fd);
+  return true;
+}
+
+/**
+  Body of the relay of an input endpoint: moves what the endpoint sends to
+  its standard output, the pipe of the first stage, until the endpoint ends.
+  A first stage that stops reading is not an error.
+  @param pipeToRun Reference to the pipe.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool relayInput(const pipe_desc &pipeToRun) {
+  int fd;
+  if (!openWithRetries(pipeToRun, pipeToRun.input, O_RDONLY, fd)) {
+    return false;
+  }
+  while (true) {
+    ssize_t moved = moveChunk(fd, STDOUT_FILENO);
+    if (moved == 0) break;
+    if (moved > 0) {
+      __atomic_add_fetch(&pipeToRun.endpointStats->inputBytes, moved,
+                         __ATOMIC_RELAXED);
+      continue;
+    }
+    if (errno == EINTR) continue;
+    if (errno == EPIPE) break;
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+/**
+  Forks the relay of one endpoint, connected to the pipeline through a pipe.
+  @param pipeToRun Reference to the pipe.
+  @param output Whether it relays the output, or else the input.
+  @param pipelineEnd Reference where the end of the pipe for the pipeline
+                     will be stored.
+  @param relays Reference to the relays, the new one is added.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool startRelay(const pipe_desc &pipeToRun, bool output, int &pipelineEnd,
+                endpoint_relays &relays) {
+  int ends[2];
+  if (pipe2(ends, O_CLOEXEC) == ERROR_OCURRED) return false;
+  // The relay reads the output from the pipe, or writes the input to it.
+  int relayEnd = output ? ends[0] : ends[1];
+  pipelineEnd = output ? ends[1] : ends[0];
+  relays.ends.push_back(pipelineEnd);
+  fflush(stdout);
+  pid_t relay = fork();
+  if (relay == ERROR_OCURRED) {
+    int error = errno;
+    close(relayEnd);
+    errno = error;
+    return false;
+  }
+  if (relay == 0) {
+    // A consumer that goes away is noticed as EPIPE.
+    signal(SIGPIPE, SIG_IGN);
+    int stream = output ? STDIN_FILENO : STDOUT_FILENO;
+    if (dup2(relayEnd, stream) == ERROR_OCURRED) exit(errno);
+    // The stages must see end of file when the relay ends, so no other
+    // end of their pipes may stay open here.
+    if (close_range(STDERR_FILENO + 1, ~0U, 0) == ERROR_OCURRED) exit(errno);
+    bool relayed = output ? relayOutput(pipeToRun) : relayInput(pipeToRun);
+    exit(relayed ? EXIT_SUCCESS : errno);
+  }
+  close(relayEnd);
+  relays.pids.push_back(relay);
+  relays.outputs.push_back(output);
+  return true;
+}
+
+/**
+  Starts a relay for each endpoint of a pipe: a child that connects to it,
+  retrying as the pipe allows, and moves data between it and a pipe given to
+  the pipeline. It is meant to be called from the pipe master.
+  @param pipeToRun Reference to the pipe.
+  @param io Reference to the pipeline io, its input and output descriptors
+            are set.
+  @param relays Reference to the endpoint_relays to fill.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately; relays already started are left in 'relays'.
+ */
+bool startEndpointRelays(const pipe_desc &pipeToRun, pipeline_io &io,
+                         endpoint_relays &relays) {
+  if (pipeToRun.inputEndpoint &&
+      !startRelay(pipeToRun, false, io.inputFd, relays)) return false;
+  if (pipeToRun.outputEndpoint &&
+      !startRelay(pipeToRun, true, io.outputFd, relays)) return false;
+  return true;
+}
+
+/**
+  Closes the ends given to the pipeline, once it started.
+  @param relays Reference to the relays.
+ */
+void closeRelayEnds(endpoint_relays &relays) {
+  for (int i = 0; i < relays.ends.size(); ++i) close(relays.ends[i]);
+  relays.ends.clear();
+}
+
+/**
+  Waits until every relay of a pipe finishes, once its pipeline finished. An
+  input relay still running is stopped, the pipeline needs no more input.
+  @param relays Reference to the relays.
+  @return true if every relay succeeded, false otherwise and errno is set to
+          the failure code of the first one that failed.
+ */
+bool waitEndpointRelays(endpoint_relays &relays) {
+  int error = 0;
+  for (int i = 0; i < relays.pids.size(); ++i) {
+    int status;
+    pid_t relay = relays.pids[i];
+    // An endpoint may keep its input open after the stages are gone.
+    if (!relays.outputs[i] && waitpid(relay, &status, WNOHANG) == 0) {
+      kill(relay, SIGKILL);
+      waitpid(relay, &status, 0);
+      continue;
+    }
+    if (relays.outputs[i] && waitpid(relay, &status, 0) != relay) continue;
+    job_status decoded = decodeStatus(status);
+    if (!decoded.success && error == 0) error = decoded.code;
+  }
+  relays.pids.clear();
+  relays.outputs.clear();
+  errno = error;
+  return error == 0;
+}
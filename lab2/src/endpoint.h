@@ -0,0 +1,92 @@
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include "jobexec.h"
+#include "jobdesc.h"
+
+/**
+  This structure counts what went through the endpoints of a pipe and how
+  many times its output endpoint was reconnected. It lives in memory shared
+  by the coordinator and the relays of the pipe master, which update it as
+  they move data.
+  */
+struct endpoint_stats {
+  unsigned long long inputBytes, outputBytes;
+  int reconnects;
+};
+
+/**
+  This structure stores the relays a pipe master started for the endpoints
+  of its pipe: their process ids, whether each one relays the output or the
+  input, and the ends of their pipes given to the pipeline, which the pipe
+  master closes once the pipeline starts.
+  */
+struct endpoint_relays {
+  std::vector <pid_t> pids;
+  std::vector <bool> outputs;
+  std::vector <int> ends;
+};
+
+/**
+  Tells if an input or output names an endpoint: a "unix:<path>" socket
+  address or an existing FIFO.
+  @param name Input or output of a pipe.
+  @return true if it is an endpoint, false otherwise.
+ */
+bool isEndpoint(const std::string &name);
+
+/**
+  Maps the counters shared with the relays of a pipe with endpoints.
+  @param pipeToRun Reference to the pipe, its counters are stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool createEndpointStats(pipe_desc &pipeToRun);
+
+/**
+  Unmaps the counters of a pipe, if it has them.
+  @param pipeToRun Reference to the pipe.
+ */
+void releaseEndpointStats(pipe_desc &pipeToRun);
+
+/**
+  Prints the bytes that went through the endpoints of a finished pipe.
+  @param out Stream to print to.
+  @param pipeToRun Reference to the pipe.
+ */
+void printEndpointStats(FILE *out, const pipe_desc &pipeToRun);
+
+/**
+  Starts a relay for each endpoint of a pipe: a child that connects to it,
+  retrying as the pipe allows, and moves data between it and a pipe given to
+  the pipeline. It is meant to be called from the pipe master.
+  @param pipeToRun Reference to the pipe.
+  @param io Reference to the pipeline io, its input and output descriptors
+            are set.
+  @param relays Reference to the endpoint_relays to fill.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately; relays already started are left in 'relays'.
+ */
+bool startEndpointRelays(const pipe_desc &pipeToRun, pipeline_io &io,
+                         endpoint_relays &relays);
+
+/**
+  Closes the ends given to the pipeline, once it started.
+  @param relays Reference to the relays.
+ */
+void closeRelayEnds(endpoint_relays &relays);
+
+/**
+  Waits until every relay of a pipe finishes, once its pipeline finished. An
+  input relay still running is stopped, the pipeline needs no more input.
+  @param relays Reference to the relays.
+  @return true if every relay succeeded, false otherwise and errno is set to
+          the failure code of the first one that failed.
+ */
+bool waitEndpointRelays(endpoint_relays &relays);
+
+#endif
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "errors.h"
+#include "protocol.h"
+
+using namespace std;
+
+#define ERROR_OCURRED -1
+
+// Bytes of the error stream kept for each stage when only --stderr-dir is
+// given.
+const long long DEFAULT_ERROR_TAIL = 16 * 1024;
+const string SPILL_EXT = ".err";
+// Milliseconds between checks for a failed stage while the streams of a pipe
+// are read.
+const int FAILURE_POLL_MS = 100;
+const string ERRORS_FILE_TEMPLATE = "/tmp/runpipe-errors-XXXXXX";
+
+/**
+  Prepares the capture of the error streams of the stages of a pipe, if the
+  pipe asks for it: a pipe per stage, whose write ends are given to the
+  pipeline, and a spill file per stage when the pipe has an error directory.
+  @param capture Reference to the error_capture to fill.
+  @param pipeToRun Reference to the pipe.
+  @param stages Jobs of the pipe.
+  @param io Reference to the pipeline io, its error descriptors are set.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool openErrorCapture(error_capture &capture, const pipe_desc &pipeToRun,
+                      const vector <job_desc> &stages, pipeline_io &io) {
+  if (pipeToRun.errorTail < 0) return true;
+  capture.tailBytes = pipeToRun.errorTail;
+  capture.stages.resize(stages.size());
+  io.errorFds.assign(stages.size(), ERROR_OCURRED);
+  for (int i = 0; i < stages.size(); ++i) {
+    stage_errors &stage = capture.stages[i];
+    stage.name = stages[i].name;
+    int errorPipe[2];
+    if (pipe2(errorPipe, O_CLOEXEC) == ERROR_OCURRED) return false;
+    stage.fd = errorPipe[0];
+    io.errorFds[i] = errorPipe[1];
+    if (pipeToRun.errorDir.empty()) continue;
+    string spillName = pipeToRun.errorDir + "/" +
+                       escapeFileName(pipeToRun.name) + "." + toStr(i + 1) +
+                       "." + escapeFileName(stage.name) + SPILL_EXT;
+    stage.spillFd = open(spillName.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+                         O_CLOEXEC, 0644);
+    if (stage.spillFd == ERROR_OCURRED) return false;
+  }
+  return true;
+}
+
+/**
+  Closes the write ends of the error pipes once the pipeline started, so that
+  each one reaches end of file when its stage ends.
+  @param io Reference to the pipeline io.
+ */
+void closeErrorWriters(pipeline_io &io) {
+  for (int i = 0; i < io.errorFds.size(); ++i) {
+    if (io.errorFds[i] != ERROR_OCURRED) close(io.errorFds[i]);
+  }
+  io.errorFds.clear();
+}
+
+/**
+  Tells if some error stream is still open.
+  @param capture Reference to the error capture.
+  @return true if a stage may still write to its error stream.
+ */
+bool capturingErrors(error_capture &capture) {
+  for (int i = 0; i < capture.stages.size(); ++i) {
+    if (capture.stages[i].fd != ERROR_OCURRED) return true;
+  }
+  return false;
+}
+
+/**
+  Adds the open error streams to a list of descriptors to poll.
+  @param capture Reference to the error capture.
+  @param fds Reference to the list of descriptors.
+ */
+void watchErrors(error_capture &capture, vector <struct pollfd> &fds) {
+  for (int i = 0; i < capture.stages.size(); ++i) {
+    if (capture.stages[i].fd == ERROR_OCURRED) continue;
+    struct pollfd watched;
+    watched.fd = capture.stages[i].fd;
+    watched.events = POLLIN;
+    fds.push_back(watched);
+  }
+}
+
+/**
+  Adds bytes to the ring of a stage, overwriting the oldest ones once the
+  ring is full.
+  @param stage Reference to the stage.
+  @param data Bytes to add.
+  @param bytes Number of bytes.
+  @param capacity Size of the ring.
+ */
+void appendRing(stage_errors &stage, const char *data, size_t bytes,
+                size_t capacity) {
+  if (capacity == 0) return;
+  if (bytes >= capacity) {
+    stage.ring.assign(data + bytes - capacity, capacity);
+    stage.start = 0;
+    return;
+  }
+  if (stage.ring.size() < capacity) {
+    size_t filled = min(bytes, capacity - stage.ring.size());
+    stage.ring.append(data, filled);
+    data += filled;
+    bytes -= filled;
+  }
+  while (bytes > 0) {
+    size_t copied = min(bytes, capacity - stage.start);
+    stage.ring.replace(stage.start, copied, data, copied);
+    stage.start = (stage.start + copied) % capacity;
+    data += copied;
+    bytes -= copied;
+  }
+}
+
+/**
+  Reads once from the error stream of a stage, closing it at end of file.
+  @param stage Reference to the stage.
+  @param capacity Size of the ring of the stage.
+ */
+void readStageErrors(stage_errors &stage, size_t capacity) {
+  char buffer[BUFSIZ];
+  ssize_t bytes = read(stage.fd, buffer, sizeof(buffer));
+  if (bytes == ERROR_OCURRED && errno == EINTR) return;
+  if (bytes <= 0) {
+    close(stage.fd);
+    stage.fd = ERROR_OCURRED;
+    return;
+  }
+  stage.total += bytes;
+  appendRing(stage, buffer, bytes, capacity);
+  if (stage.spillFd != ERROR_OCURRED &&
+      write(stage.spillFd, buffer, bytes) != bytes) {
+    // A full disk must not stop the stage, the tail is still kept.
+    close(stage.spillFd);
+    stage.spillFd = ERROR_OCURRED;
+  }
+}
+
+/**
+  Reads from every error stream that poll found ready.
+  @param capture Reference to the error capture.
+  @param fds Reference to the polled descriptors.
+ */
+void readErrors(error_capture &capture, const vector <struct pollfd> &fds) {
+  for (int i = 0; i < fds.size(); ++i) {
+    if (fds[i].revents == 0) continue;
+    for (int j = 0; j < capture.stages.size(); ++j) {
+      stage_errors &stage = capture.stages[j];
+      if (stage.fd == fds[i].fd) readStageErrors(stage, capture.tailBytes);
+    }
+  }
+}
+
+/**
+  Reads every error stream until all the stages close them. The pipeline is
+  stopped meanwhile as soon as a stage fails it, the other stages would keep
+  their streams open.
+  @param capture Reference to the error capture.
+  @param handle Reference to the handle of the pipeline of the stages.
+ */
+void drainErrors(error_capture &capture, pipeline_handle &handle) {
+  while (capturingErrors(capture)) {
+    vector <struct pollfd> fds;
+    watchErrors(capture, fds);
+    int ready = poll(&fds[0], fds.size(), FAILURE_POLL_MS);
+    stopIfFailed(handle);
+    if (ready == ERROR_OCURRED) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    readErrors(capture, fds);
+  }
+}
+
+/**
+  Encodes the tails of the captured error streams as message fields: name,
+  total bytes and tail of each stage. Spill files are closed.
+  @param capture Reference to the error capture.
+  @param fields Reference to the vector to append the fields to.
+ */
+void encodeErrors(error_capture &capture, vector <string> &fields) {
+  for (int i = 0; i < capture.stages.size(); ++i) {
+    stage_errors &stage = capture.stages[i];
+    stringstream total;
+    total << stage.total;
+    fields.push_back(stage.name);
+    fields.push_back(total.str());
+    fields.push_back(stage.ring.substr(stage.start) +
+                     stage.ring.substr(0, stage.start));
+    if (stage.spillFd != ERROR_OCURRED) close(stage.spillFd);
+    stage.spillFd = ERROR_OCURRED;
+  }
+}
+
+/**
+  Decodes the tails encoded by encodeErrors.
+  @param fields Fields of the message.
+  @param first Index of the first field of the tails.
+  @param tails Reference to the vector to fill.
+  @return true if the fields are well formed, false otherwise.
+ */
+bool decodeErrors(const vector <string> &fields, size_t first,
+                  vector <error_tail> &tails) {
+  if (first > fields.size() || (fields.size() - first) % 3 != 0) {
+    return false;
+  }
+  for (size_t i = first; i < fields.size(); i += 3) {
+    error_tail stage;
+    stage.name = fields[i];
+    stage.total = strtoull(fields[i + 1].c_str(), NULL, 10);
+    stage.tail = fields[i + 2];
+    tails.push_back(stage);
+  }
+  return true;
+}
+
+/**
+  Creates the errors file of a pipe, where its pipe master leaves the tails of
+  the error streams. The file has no name and is closed on exec.
+  @param fd Reference where the descriptor of the file will be stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool createErrorsFile(int &fd) {
+  vector <char> name(ERRORS_FILE_TEMPLATE.begin(), ERRORS_FILE_TEMPLATE.end());
+  name.push_back('\0');
+  fd = mkostemp(&name[0], O_CLOEXEC);
+  if (fd == ERROR_OCURRED) return false;
+  unlink(&name[0]);
+  return true;
+}
+
+/**
+  Writes the tails of the captured error streams to the errors file of a
+  pipe.
+  @param capture Reference to the error capture.
+  @param fd Descriptor of the errors file.
+  @return true if the tails were written, false otherwise.
+ */
+bool writeErrorTails(error_capture &capture, int fd) {
+  vector <string> fields;
+  encodeErrors(capture, fields);
+  return writeAll(fd, encodeMessage(fields));
+}
+
+/**
+  Reads the tails a pipe master wrote to the errors file of its pipe.
+  @param fd Descriptor of the errors file.
+  @param tails Reference to the vector to fill.
+  @return true if the tails could be read, false otherwise.
+ */
+bool readErrorTails(int fd, vector <error_tail> &tails) {
+  if (lseek(fd, 0, SEEK_SET) == ERROR_OCURRED) return false;
+  message_reader reader(fd);
+  vector <string> fields;
+  return receiveMessage(reader, fields) && decodeErrors(fields, 0, tails);
+}
+
+/**
+  Prints the tail of the error stream of each stage that wrote to it.
+  @param out Stream to print to.
+  @param pipeName Name of the pipe.
+  @param tails Tails of the stages of the pipe.
+ */
+void printErrorTails(FILE *out, const string &pipeName,
+                     const vector <error_tail> &tails) {
+  for (int i = 0; i < tails.size(); ++i) {
+    const error_tail &stage = tails[i];
+    if (stage.total == 0) continue;
+    fprintf(out, "## %s stderr of stage %d (%s), last %zu of %llu bytes ##\n",
+            pipeName.c_str(), i + 1, stage.name.c_str(), stage.tail.size(),
+            stage.total);
+    fwrite(stage.tail.data(), 1, stage.tail.size(), out);
+    if (!stage.tail.empty() && stage.tail[stage.tail.size() - 1] != '\n') {
+      fputc('\n', out);
+    }
+  }
+}
@@ -0,0 +1,153 @@
+#ifndef ERRORS_H
+#define ERRORS_H
+
+#include <stdio.h>
+#include <poll.h>
+#include <string>
+#include <vector>
+#include "jobdesc.h"
+
+extern const long long DEFAULT_ERROR_TAIL;
+extern const int FAILURE_POLL_MS;
+
+/**
+  This structure stores the error stream captured from a stage: its last
+  bytes, kept in a ring of fixed size, and how many it wrote in total.
+  */
+struct stage_errors {
+  std::string name, ring;
+  // Position of the oldest byte once the ring is full.
+  size_t start;
+  unsigned long long total;
+  // Descriptor the error stream is read from and file that receives all of
+  // it, -1 when closed or not given.
+  int fd, spillFd;
+  stage_errors() : start(0), total(0), fd(-1), spillFd(-1) {}
+};
+
+/**
+  This structure stores the error streams captured from the stages of a pipe
+  and the size of the ring of each one.
+  */
+struct error_capture {
+  std::vector <stage_errors> stages;
+  size_t tailBytes;
+  error_capture() : tailBytes(0) {}
+};
+
+/**
+  This structure stores the end of the error stream of a finished stage and
+  how many bytes the stage wrote to it.
+  */
+struct error_tail {
+  std::string name, tail;
+  unsigned long long total;
+  error_tail() : total(0) {}
+};
+
+/**
+  Prepares the capture of the error streams of the stages of a pipe, if the
+  pipe asks for it: a pipe per stage, whose write ends are given to the
+  pipeline, and a spill file per stage when the pipe has an error directory.
+  @param capture Reference to the error_capture to fill.
+  @param pipeToRun Reference to the pipe.
+  @param stages Jobs of the pipe.
+  @param io Reference to the pipeline io, its error descriptors are set.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool openErrorCapture(error_capture &capture, const pipe_desc &pipeToRun,
+                      const std::vector <job_desc> &stages, pipeline_io &io);
+
+/**
+  Closes the write ends of the error pipes once the pipeline started, so that
+  each one reaches end of file when its stage ends.
+  @param io Reference to the pipeline io.
+ */
+void closeErrorWriters(pipeline_io &io);
+
+/**
+  Tells if some error stream is still open.
+  @param capture Reference to the error capture.
+  @return true if a stage may still write to its error stream.
+ */
+bool capturingErrors(error_capture &capture);
+
+/**
+  Adds the open error streams to a list of descriptors to poll.
+  @param capture Reference to the error capture.
+  @param fds Reference to the list of descriptors.
+ */
+void watchErrors(error_capture &capture, std::vector <struct pollfd> &fds);
+
+/**
+  Reads from every error stream that poll found ready.
+  @param capture Reference to the error capture.
+  @param fds Reference to the polled descriptors.
+ */
+void readErrors(error_capture &capture,
+                const std::vector <struct pollfd> &fds);
+
+/**
+  Reads every error stream until all the stages close them. The pipeline is
+  stopped meanwhile as soon as a stage fails it, the other stages would keep
+  their streams open.
+  @param capture Reference to the error capture.
+  @param handle Reference to the handle of the pipeline of the stages.
+ */
+void drainErrors(error_capture &capture, pipeline_handle &handle);
+
+/**
+  Encodes the tails of the captured error streams as message fields: name,
+  total bytes and tail of each stage. Spill files are closed.
+  @param capture Reference to the error capture.
+  @param fields Reference to the vector to append the fields to.
+ */
+void encodeErrors(error_capture &capture, std::vector <std::string> &fields);
+
+/**
+  Decodes the tails encoded by encodeErrors.
+  @param fields Fields of the message.
+  @param first Index of the first field of the tails.
+  @param tails Reference to the vector to fill.
+  @return true if the fields are well formed, false otherwise.
+ */
+bool decodeErrors(const std::vector <std::string> &fields, size_t first,
+                  std::vector <error_tail> &tails);
+
+/**
+  Creates the errors file of a pipe, where its pipe master leaves the tails of
+  the error streams. The file has no name and is closed on exec.
+  @param fd Reference where the descriptor of the file will be stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool createErrorsFile(int &fd);
+
+/**
+  Writes the tails of the captured error streams to the errors file of a
+  pipe.
+  @param capture Reference to the error capture.
+  @param fd Descriptor of the errors file.
+  @return true if the tails were written, false otherwise.
+ */
+bool writeErrorTails(error_capture &capture, int fd);
+
+/**
+  Reads the tails a pipe master wrote to the errors file of its pipe.
+  @param fd Descriptor of the errors file.
+  @param tails Reference to the vector to fill.
+  @return true if the tails could be read, false otherwise.
+ */
+bool readErrorTails(int fd, std::vector <error_tail> &tails);
+
+/**
+  Prints the tail of the error stream of each stage that wrote to it.
+  @param out Stream to print to.
+  @param pipeName Name of the pipe.
+  @param tails Tails of the stages of the pipe.
+ */
+void printErrorTails(FILE *out, const std::string &pipeName,
+                     const std::vector <error_tail> &tails);
+
+#endif
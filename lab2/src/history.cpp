@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <queue>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "history.h"
+
+using namespace std;
+
+const string DEFAULT_HISTORY_FILE = "./.runpipe_history";
+
+// Weight of the newest run in the moving averages.
+const double HISTORY_WEIGHT = 0.5;
+// Prediction used when no pipe of the run was ever seen.
+const double UNKNOWN_WALL = 1.0;
+
+/**
+  Signs a description with its FNV-1a hash.
+  @param description Description to sign.
+  @return The hash as 16 hexadecimal digits.
+ */
+string signDescription(const string &description) {
+  unsigned long long hash = 14695981039346656037ULL;
+  for (int i = 0; i < description.size(); ++i) {
+    hash ^= (unsigned char) description[i];
+    hash *= 1099511628211ULL;
+  }
+  char signature[17];
+  snprintf(signature, sizeof(signature), "%016llx", hash);
+  return signature;
+}
+
+/**
+  Builds the key under which a pipe is stored in the history. It contains the
+  name of the pipe and a signature of its jobs, so that a pipe whose jobs
+  change does not reuse old timings.
+  @param pipe Reference to the pipe.
+  @param allJobs Reference to vector that contains all jobs.
+  @return Key of the pipe.
+ */
+string historyKey(pipe_desc &pipe, vector <job_desc> &allJobs) {
+  // Signature of the executables and arguments of every job in order.
+  string description = pipe.input;
+  for (int i = 0; i < pipe.jobsIndexes.size(); ++i) {
+    job_desc &job = allJobs[pipe.jobsIndexes[i]];
+    description += '\0' + job.exec;
+    for (int j = 0; j < job.args.size(); ++j) description += '\0' + job.args[j];
+  }
+  return signDescription(description) + " " + pipe.name;
+}
+
+/**
+  Loads the history file. A missing file means an empty history.
+  Each line has: <signature> <wall> <cpu> <runs> <pipe name>.
+  @param fileName Name of the history file.
+  @param history Reference to the map to be filled, by pipe key.
+ */
+void loadHistory(const string &fileName, map <string, pipe_history> &history) {
+  ifstream ifs(fileName.c_str());
+  string line;
+  while (getline(ifs, line)) {
+    stringstream fields(line);
+    string signature, name;
+    pipe_history entry;
+    if (!(fields >> signature >> entry.wall >> entry.cpu >> entry.runs)) {
+      continue;
+    }
+    // The name is the rest of the line, it may contain spaces.
+    fields.get();
+    getline(fields, name);
+    history[signature + " " + name] = entry;
+  }
+}
+
+/**
+  Saves the history file, replacing its previous content.
+  @param fileName Name of the history file.
+  @param history Reference to the map to save.
+  @return true if the file could be written, false otherwise.
+ */
+bool saveHistory(const string &fileName, map <string, pipe_history> &history) {
+  ofstream ofs(fileName.c_str());
+  if (!ofs.is_open()) return false;
+  for (map <string, pipe_history>::iterator it = history.begin();
+       it != history.end(); ++it) {
+    size_t space = it->first.find(' ');
+    ofs << it->first.substr(0, space) << " " << it->second.wall << " "
+        << it->second.cpu << " " << it->second.runs << " "
+        << it->first.substr(space + 1) << endl;
+  }
+  return true;
+}
+
+/**
+  Adds an observed run of a pipe to its history entry.
+  @param entry Reference to the history entry of the pipe.
+  @param wall Wall time of the run in seconds.
+  @param cpu CPU time of the run in seconds.
+ */
+void recordRun(pipe_history &entry, double wall, double cpu) {
+  if (entry.runs == 0) {
+    entry.wall = wall;
+    entry.cpu = cpu;
+  }
+  else {
+    entry.wall += HISTORY_WEIGHT * (wall - entry.wall);
+    entry.cpu += HISTORY_WEIGHT * (cpu - entry.cpu);
+  }
+  ++entry.runs;
+}
+
+/**
+  Predicts the wall time of every pipe from the history. Pipes that were
+  never seen get the mean prediction of the known ones, or one second when
+  none is known.
+  @param pipes Reference to the pipes, their 'predictedWall' is filled.
+  @param allJobs Reference to vector that contains all jobs.
+  @param history Reference to the loaded history.
+ */
+void predictWallTimes(vector <pipe_desc> &pipes, vector <job_desc> &allJobs,
+                      map <string, pipe_history> &history) {
+  double knownTotal = 0;
+  int knownCount = 0;
+  vector <bool> known(pipes.size(), false);
+  for (int i = 0; i < pipes.size(); ++i) {
+    map <string, pipe_history>::iterator entry =
+        history.find(historyKey(pipes[i], allJobs));
+    if (entry == history.end() || entry->second.runs == 0) continue;
+    pipes[i].predictedWall = entry->second.wall;
+    knownTotal += entry->second.wall;
+    ++knownCount;
+    known[i] = true;
+  }
+  double unknownWall = knownCount > 0 ? knownTotal / knownCount : UNKNOWN_WALL;
+  for (int i = 0; i < pipes.size(); ++i) {
+    if (!known[i]) pipes[i].predictedWall = unknownWall;
+  }
+}
+
+/**
+  Compares two pipes by their predicted wall time, longest first.
+ */
+bool longerPredicted(const pipe_desc &a, const pipe_desc &b) {
+  return a.predictedWall > b.predictedWall;
+}
+
+/**
+  Sorts pipes longest-expected-first (LPT), keeping YAML order among equal
+  predictions.
+  @param pipes Reference to the pipes to sort.
+ */
+void sortLongestFirst(vector <pipe_desc> &pipes) {
+  stable_sort(pipes.begin(), pipes.end(), longerPredicted);
+}
+
+/**
+  Simulates running the pipes in the given order with a number of slots, each
+  pipe taking the first slot that gets free.
+  @param pipes Reference to the pipes in launch order.
+  @param slots Number of pipes that can run at the same time.
+  @return Predicted makespan in seconds.
+ */
+double predictMakespan(vector <pipe_desc> &pipes, int slots) {
+  // Times at which each slot gets free, earliest on top.
+  priority_queue <double, vector <double>, greater <double> > freeAt;
+  for (int i = 0; i < slots; ++i) freeAt.push(0);
+  double makespan = 0;
+  for (int i = 0; i < pipes.size(); ++i) {
+    double end = freeAt.top() + pipes[i].predictedWall;
+    freeAt.pop();
+    freeAt.push(end);
+    makespan = max(makespan, end);
+  }
+  return makespan;
+}
@@ -0,0 +1,91 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "jobdesc.h"
+
+extern const std::string DEFAULT_HISTORY_FILE;
+
+/**
+  This structure stores what was observed in previous runs of a pipe: moving
+  averages of its wall and CPU time in seconds and how many runs were seen.
+  */
+struct pipe_history {
+  double wall, cpu;
+  int runs;
+  pipe_history() : wall(0), cpu(0), runs(0) {}
+};
+
+/**
+  Signs a description with its FNV-1a hash.
+  @param description Description to sign.
+  @return The hash as 16 hexadecimal digits.
+ */
+std::string signDescription(const std::string &description);
+
+/**
+  Builds the key under which a pipe is stored in the history. It contains the
+  name of the pipe and a signature of its jobs, so that a pipe whose jobs
+  change does not reuse old timings.
+  @param pipe Reference to the pipe.
+  @param allJobs Reference to vector that contains all jobs.
+  @return Key of the pipe.
+ */
+std::string historyKey(pipe_desc &pipe, std::vector <job_desc> &allJobs);
+
+/**
+  Loads the history file. A missing file means an empty history.
+  @param fileName Name of the history file.
+  @param history Reference to the map to be filled, by pipe key.
+ */
+void loadHistory(const std::string &fileName,
+                 std::map <std::string, pipe_history> &history);
+
+/**
+  Saves the history file, replacing its previous content.
+  @param fileName Name of the history file.
+  @param history Reference to the map to save.
+  @return true if the file could be written, false otherwise.
+ */
+bool saveHistory(const std::string &fileName,
+                 std::map <std::string, pipe_history> &history);
+
+/**
+  Adds an observed run of a pipe to its history entry.
+  @param entry Reference to the history entry of the pipe.
+  @param wall Wall time of the run in seconds.
+  @param cpu CPU time of the run in seconds.
+ */
+void recordRun(pipe_history &entry, double wall, double cpu);
+
+/**
+  Predicts the wall time of every pipe from the history. Pipes that were
+  never seen get the mean prediction of the known ones, or one second when
+  none is known.
+  @param pipes Reference to the pipes, their 'predictedWall' is filled.
+  @param allJobs Reference to vector that contains all jobs.
+  @param history Reference to the loaded history.
+ */
+void predictWallTimes(std::vector <pipe_desc> &pipes,
+                      std::vector <job_desc> &allJobs,
+                      std::map <std::string, pipe_history> &history);
+
+/**
+  Sorts pipes longest-expected-first (LPT), keeping YAML order among equal
+  predictions.
+  @param pipes Reference to the pipes to sort.
+ */
+void sortLongestFirst(std::vector <pipe_desc> &pipes);
+
+/**
+  Simulates running the pipes in the given order with a number of slots, each
+  pipe taking the first slot that gets free.
+  @param pipes Reference to the pipes in launch order.
+  @param slots Number of pipes that can run at the same time.
+  @return Predicted makespan in seconds.
+ */
+double predictMakespan(std::vector <pipe_desc> &pipes, int slots);
+
+#endif
@@ -0,0 +1,668 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/io_uring.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include "ioengine.h"
+
+using namespace std;
+
+#define ERROR_OCURRED -1
+
+const string IO_ENGINE_URING    = "uring";
+const string IO_ENGINE_EPOLL    = "epoll";
+const string IO_ENGINE_BLOCKING = "blocking";
+
+// Entries of the submission ring.
+const unsigned RING_ENTRIES = 64;
+// Size of each registered buffer, and how many relays and streams use.
+const size_t SLOT_BYTES = 64 * 1024;
+const int RELAY_SLOTS = 8;
+const int STREAM_SLOTS = 24;
+// Registered files: the input and output of relays, then the streams.
+const int RELAY_INPUT = 0;
+const int RELAY_OUTPUT = 1;
+const int FIXED_FILES = 256;
+// Marks the user data of writes and cancellations, the rest is the slot.
+const unsigned long long WRITE_TAG = 1ULL << 32;
+const unsigned long long CANCEL_TAG = 1ULL << 33;
+// Offset that makes a read or write use the current file position.
+const unsigned long long CURRENT_POSITION = ~0ULL;
+
+io_engine::io_engine() : kind(IO_ENGINE_BLOCKING), ringFd(-1), epollFd(-1),
+                         sqRing(NULL), cqRing(NULL), sqes(NULL),
+                         sqRingSize(0), sqesSize(0),
+                         sqHead(NULL), sqTail(NULL), sqMask(NULL),
+                         sqArray(NULL), cqHead(NULL), cqTail(NULL),
+                         cqMask(NULL), cqes(NULL), queued(0), buffers(NULL),
+                         nextStream(0) {}
+
+/**
+  Tells if a name is a known I/O engine.
+  @param name Name to check.
+  @return true if it is "uring", "epoll" or "blocking".
+ */
+bool isIOEngine(const string &name) {
+  return name == IO_ENGINE_URING || name == IO_ENGINE_EPOLL ||
+         name == IO_ENGINE_BLOCKING;
+}
+
+/**
+  Replaces entries of the registered files table.
+  @param engine Reference to the engine.
+  @param index First entry to replace.
+  @param fds Descriptors to put in the table, -1 clears an entry.
+  @param count Number of entries.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool updateFiles(io_engine &engine, int index, int *fds, int count) {
+  struct io_uring_files_update update;
+  memset(&update, 0, sizeof(update));
+  update.offset = index;
+  update.fds = (unsigned long) fds;
+  ++engine.stats.syscalls;
+  return syscall(__NR_io_uring_register, engine.ringFd,
+                 IORING_REGISTER_FILES_UPDATE, &update, count) == count;
+}
+
+/**
+  Sets up io_uring: creates the ring, maps it and registers the buffers and
+  an empty table of files.
+  @param engine Reference to the engine.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately; what was set up is released by closeEngine.
+ */
+bool openRing(io_engine &engine) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ++engine.stats.syscalls;
+  engine.ringFd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+  if (engine.ringFd == ERROR_OCURRED) return false;
+  // Waits with a timeout, I/O at the current position and a single mapping
+  // for both rings are needed.
+  unsigned needed = IORING_FEAT_EXT_ARG | IORING_FEAT_RW_CUR_POS |
+                    IORING_FEAT_SINGLE_MMAP;
+  if ((params.features & needed) != needed) {
+    errno = ENOSYS;
+    return false;
+  }
+  engine.sqRingSize = params.sq_off.array +
+                      params.sq_entries * sizeof(unsigned);
+  size_t cqSize = params.cq_off.cqes +
+                  params.cq_entries * sizeof(struct io_uring_cqe);
+  if (cqSize > engine.sqRingSize) engine.sqRingSize = cqSize;
+  void *rings = mmap(NULL, engine.sqRingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, engine.ringFd,
+                     IORING_OFF_SQ_RING);
+  if (rings == MAP_FAILED) return false;
+  engine.sqRing = engine.cqRing = rings;
+  engine.sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *entries = mmap(NULL, engine.sqesSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, engine.ringFd,
+                       IORING_OFF_SQES);
+  if (entries == MAP_FAILED) return false;
+  engine.sqes = entries;
+  char *ring = (char *) rings;
+  engine.sqHead = (unsigned *) (ring + params.sq_off.head);
+  engine.sqTail = (unsigned *) (ring + params.sq_off.tail);
+  engine.sqMask = (unsigned *) (ring + params.sq_off.ring_mask);
+  engine.sqArray = (unsigned *) (ring + params.sq_off.array);
+  engine.cqHead = (unsigned *) (ring + params.cq_off.head);
+  engine.cqTail = (unsigned *) (ring + params.cq_off.tail);
+  engine.cqMask = (unsigned *) (ring + params.cq_off.ring_mask);
+  engine.cqes = ring + params.cq_off.cqes;
+
+  // The buffers stay pinned for the kernel, pipe masters forked later do not
+  // need a copy of them.
+  size_t bufferBytes = (RELAY_SLOTS + STREAM_SLOTS) * SLOT_BYTES;
+  void *buffers = mmap(NULL, bufferBytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffers == MAP_FAILED) return false;
+  engine.buffers = (char *) buffers;
+  madvise(buffers, bufferBytes, MADV_DONTFORK);
+  vector <struct iovec> slots(RELAY_SLOTS + STREAM_SLOTS);
+  for (int i = 0; i < slots.size(); ++i) {
+    slots[i].iov_base = engine.buffers + i * SLOT_BYTES;
+    slots[i].iov_len = SLOT_BYTES;
+  }
+  ++engine.stats.syscalls;
+  if (syscall(__NR_io_uring_register, engine.ringFd, IORING_REGISTER_BUFFERS,
+              &slots[0], slots.size()) == ERROR_OCURRED) return false;
+  vector <int> files(FIXED_FILES, ERROR_OCURRED);
+  ++engine.stats.syscalls;
+  return syscall(__NR_io_uring_register, engine.ringFd, IORING_REGISTER_FILES,
+                 &files[0], files.size()) != ERROR_OCURRED;
+}
+
+/**
+  Opens an I/O engine. When io_uring cannot be set up (old kernel, disabled
+  or locked memory exhausted) the epoll engine is used instead.
+  @param engine Reference to the engine, its kind tells the one that runs.
+  @param kind Engine to open, empty for the best one available.
+  @return true if the requested engine runs, false if it fell back.
+ */
+bool openEngine(io_engine &engine, const string &kind) {
+  engine.kind = kind.empty() ? IO_ENGINE_URING : kind;
+  bool requested = true;
+  if (engine.kind == IO_ENGINE_URING) {
+    if (openRing(engine)) return true;
+    int error = errno;
+    closeEngine(engine);
+    errno = error;
+    engine.kind = IO_ENGINE_EPOLL;
+    requested = false;
+  }
+  if (engine.kind == IO_ENGINE_EPOLL) {
+    ++engine.stats.syscalls;
+    engine.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (engine.epollFd == ERROR_OCURRED) {
+      engine.kind = IO_ENGINE_BLOCKING;
+      requested = false;
+    }
+  }
+  return requested;
+}
+
+/**
+  Releases everything an I/O engine holds.
+  @param engine Reference to the engine.
+ */
+void closeEngine(io_engine &engine) {
+  if (engine.buffers != NULL) {
+    munmap(engine.buffers, (RELAY_SLOTS + STREAM_SLOTS) * SLOT_BYTES);
+  }
+  if (engine.sqes != NULL) munmap(engine.sqes, engine.sqesSize);
+  if (engine.sqRing != NULL) munmap(engine.sqRing, engine.sqRingSize);
+  if (engine.ringFd != ERROR_OCURRED) close(engine.ringFd);
+  if (engine.epollFd != ERROR_OCURRED) close(engine.epollFd);
+  string kind = engine.kind;
+  io_stats stats = engine.stats;
+  engine = io_engine();
+  engine.kind = kind;
+  engine.stats = stats;
+}
+
+/**
+  Queues a submission entry, to be given to the kernel with the next
+  enterRing.
+  @param engine Reference to the engine.
+  @param entry Entry to queue.
+ */
+void queueEntry(io_engine &engine, const struct io_uring_sqe &entry) {
+  unsigned tail = *engine.sqTail;
+  unsigned index = tail & *engine.sqMask;
+  ((struct io_uring_sqe *) engine.sqes)[index] = entry;
+  engine.sqArray[index] = index;
+  // The entry must be complete before the kernel sees the new tail.
+  __atomic_store_n(engine.sqTail, tail + 1, __ATOMIC_RELEASE);
+  ++engine.queued;
+}
+
+/**
+  Queues a read or write of a registered buffer.
+  @param engine Reference to the engine.
+  @param opcode IORING_OP_READ_FIXED or IORING_OP_WRITE_FIXED.
+  @param file Registered file, or descriptor if it is not registered.
+  @param registered Whether file is an index of the registered files.
+  @param slot Registered buffer.
+  @param start First byte of the buffer to use.
+  @param length Bytes to read or write.
+  @param offset Offset in the file, CURRENT_POSITION for the current one.
+  @param userData Value returned with the completion.
+ */
+void queueTransfer(io_engine &engine, int opcode, int file, bool registered,
+                   int slot, size_t start, size_t length,
+                   unsigned long long offset, unsigned long long userData) {
+  struct io_uring_sqe entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.opcode = opcode;
+  entry.fd = file;
+  if (registered) entry.flags = IOSQE_FIXED_FILE;
+  entry.addr = (unsigned long) (engine.buffers + slot * SLOT_BYTES + start);
+  entry.len = length;
+  entry.off = offset;
+  entry.buf_index = slot;
+  entry.user_data = userData;
+  queueEntry(engine, entry);
+}
+
+/**
+  Gives the queued entries to the kernel and waits for completions.
+  @param engine Reference to the engine.
+  @param wait Completions to wait for.
+  @param timeoutMs Maximum time to wait in milliseconds, -1 for no limit.
+  @return false if the ring cannot be used anymore, true otherwise (also
+          when the timeout expired or a signal arrived).
+ */
+bool enterRing(io_engine &engine, unsigned wait, int timeoutMs) {
+  unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+  struct __kernel_timespec timeout;
+  struct io_uring_getevents_arg arguments;
+  void *argument = NULL;
+  size_t argumentSize = 0;
+  if (wait > 0 && timeoutMs >= 0) {
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+    memset(&arguments, 0, sizeof(arguments));
+    arguments.ts = (unsigned long) &timeout;
+    argument = &arguments;
+    argumentSize = sizeof(arguments);
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+  ++engine.stats.syscalls;
+  int entered = syscall(__NR_io_uring_enter, engine.ringFd, engine.queued,
+                        wait, flags, argument, argumentSize);
+  // The kernel moves the head past the entries it took.
+  engine.queued = *engine.sqTail -
+                  __atomic_load_n(engine.sqHead, __ATOMIC_ACQUIRE);
+  return entered != ERROR_OCURRED || errno == ETIME || errno == EINTR ||
+         errno == EBUSY;
+}
+
+/**
+  Takes the next completion of the ring, if any.
+  @param engine Reference to the engine.
+  @param userData Reference filled with the user data of the request.
+  @param result Reference filled with its result, -errno on error.
+  @return true if a completion was taken, false if there is none.
+ */
+bool nextCompletion(io_engine &engine, unsigned long long &userData,
+                    int &result) {
+  unsigned head = *engine.cqHead;
+  if (head == __atomic_load_n(engine.cqTail, __ATOMIC_ACQUIRE)) return false;
+  struct io_uring_cqe &completion =
+      ((struct io_uring_cqe *) engine.cqes)[head & *engine.cqMask];
+  userData = completion.user_data;
+  result = completion.res;
+  __atomic_store_n(engine.cqHead, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+  Copies a file with one read and one write system call per buffer.
+  @param engine Reference to the engine.
+  @param input Descriptor of the file to copy.
+  @param output Descriptor to write to.
+  @param lastByte Reference filled with the last byte copied.
+  @return Bytes copied. On error, returns -1 and errno is set appropriately.
+ */
+long long relayWithCalls(io_engine &engine, int input, int output,
+                         char &lastByte) {
+  vector <char> buffer(SLOT_BYTES);
+  long long copied = 0;
+  while (true) {
+    ++engine.stats.syscalls;
+    ssize_t bytes = read(input, &buffer[0], buffer.size());
+    if (bytes == 0) return copied;
+    if (bytes == ERROR_OCURRED) {
+      if (errno == EINTR) continue;
+      return ERROR_OCURRED;
+    }
+    engine.stats.bytesRead += bytes;
+    for (ssize_t written = 0; written < bytes; ) {
+      ++engine.stats.syscalls;
+      ssize_t sent = write(output, &buffer[written], bytes - written);
+      if (sent == ERROR_OCURRED) {
+        if (errno == EINTR) continue;
+        return ERROR_OCURRED;
+      }
+      written += sent;
+      engine.stats.bytesWritten += sent;
+    }
+    lastByte = buffer[bytes - 1];
+    copied += bytes;
+  }
+}
+
+/**
+  Copies a file through io_uring: every free buffer reads the file ahead at
+  its own offset, and the buffers are written in file order, one write in
+  flight at a time since the output may be a pipe or a terminal.
+  @param engine Reference to the engine.
+  @param input Descriptor of the file to copy.
+  @param output Descriptor to write to.
+  @param lastByte Reference filled with the last byte copied.
+  @return Bytes copied. On error, returns -1 and errno is set appropriately.
+ */
+long long relayWithRing(io_engine &engine, int input, int output,
+                        char &lastByte) {
+  int files[2] = {input, output};
+  if (!updateFiles(engine, RELAY_INPUT, files, 2)) return ERROR_OCURRED;
+  // Slots in the order of their offsets, the bytes each one holds (-1 while
+  // it is read) and the bytes of it already written.
+  deque <int> order;
+  vector <long long> held(RELAY_SLOTS, 0), written(RELAY_SLOTS, 0);
+  vector <bool> busy(RELAY_SLOTS, false);
+  long long offset = 0, copied = 0;
+  bool ended = false, writing = false;
+  int inFlight = 0, error = 0;
+  while (true) {
+    for (int slot = 0; slot < RELAY_SLOTS && !ended && error == 0; ++slot) {
+      if (busy[slot]) continue;
+      queueTransfer(engine, IORING_OP_READ_FIXED, RELAY_INPUT, true, slot, 0,
+                    SLOT_BYTES, offset, slot);
+      busy[slot] = true;
+      held[slot] = -1;
+      written[slot] = 0;
+      order.push_back(slot);
+      offset += SLOT_BYTES;
+      ++inFlight;
+    }
+    // Slots past the end of the file read nothing.
+    while (!order.empty() && held[order.front()] == 0) {
+      busy[order.front()] = false;
+      order.pop_front();
+    }
+    if (!writing && error == 0 && !order.empty() && held[order.front()] > 0) {
+      int slot = order.front();
+      queueTransfer(engine, IORING_OP_WRITE_FIXED, RELAY_OUTPUT, true, slot,
+                    written[slot], held[slot] - written[slot],
+                    CURRENT_POSITION, WRITE_TAG | slot);
+      writing = true;
+      ++inFlight;
+    }
+    if (inFlight == 0) break;
+    if (!enterRing(engine, 1, -1)) return ERROR_OCURRED;
+    unsigned long long userData;
+    int result;
+    while (nextCompletion(engine, userData, result)) {
+      --inFlight;
+      int slot = userData & ~WRITE_TAG;
+      if (result < 0) {
+        error = -result;
+        if (userData & WRITE_TAG) writing = false;
+        else held[slot] = 0;
+      }
+      else if (userData & WRITE_TAG) {
+        writing = false;
+        written[slot] += result;
+        engine.stats.bytesWritten += result;
+        copied += result;
+        if (written[slot] == held[slot]) {
+          lastByte = engine.buffers[slot * SLOT_BYTES + held[slot] - 1];
+          busy[slot] = false;
+          order.pop_front();
+        }
+      }
+      else {
+        held[slot] = result;
+        engine.stats.bytesRead += result;
+        if (result < SLOT_BYTES) ended = true;
+      }
+    }
+  }
+  if (error != 0) {
+    errno = error;
+    return ERROR_OCURRED;
+  }
+  return copied;
+}
+
+/**
+  Copies everything from a file to a descriptor. With io_uring several reads
+  of the file are in flight at once, each into a registered buffer, while
+  the buffers already read are written in order, one write at a time.
+  @param engine Reference to the engine.
+  @param input Descriptor of the file to copy, read from its start.
+  @param output Descriptor to write to, at its current position.
+  @param lastByte Reference filled with the last byte copied.
+  @return Bytes copied. On error, returns -1 and errno is set appropriately.
+ */
+long long relayFile(io_engine &engine, int input, int output, char &lastByte) {
+  if (engine.kind == IO_ENGINE_URING) {
+    return relayWithRing(engine, input, output, lastByte);
+  }
+  return relayWithCalls(engine, input, output, lastByte);
+}
+
+/**
+  Starts watching a stream, so that waitStreams reads from it.
+  @param engine Reference to the engine.
+  @param fd Descriptor of the stream.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool watchStream(io_engine &engine, int fd) {
+  if (engine.kind == IO_ENGINE_EPOLL) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    ++engine.stats.syscalls;
+    return epoll_ctl(engine.epollFd, EPOLL_CTL_ADD, fd, &event) !=
+           ERROR_OCURRED;
+  }
+  if (engine.kind != IO_ENGINE_URING) return true;
+  // A stream that finds the table full is read by its descriptor.
+  set <int> used;
+  map <int, int>::iterator it;
+  for (it = engine.fixedFiles.begin(); it != engine.fixedFiles.end(); ++it) {
+    used.insert(it->second);
+  }
+  for (int index = RELAY_OUTPUT + 1; index < FIXED_FILES; ++index) {
+    if (used.count(index) > 0) continue;
+    if (updateFiles(engine, index, &fd, 1)) engine.fixedFiles[fd] = index;
+    break;
+  }
+  return true;
+}
+
+/**
+  Stops watching a stream, before it is closed.
+  @param engine Reference to the engine.
+  @param fd Descriptor of the stream.
+ */
+void unwatchStream(io_engine &engine, int fd) {
+  if (engine.kind == IO_ENGINE_EPOLL) {
+    ++engine.stats.syscalls;
+    epoll_ctl(engine.epollFd, EPOLL_CTL_DEL, fd, NULL);
+    return;
+  }
+  map <int, int>::iterator it = engine.fixedFiles.find(fd);
+  if (it == engine.fixedFiles.end()) return;
+  int cleared = ERROR_OCURRED;
+  updateFiles(engine, it->second, &cleared, 1);
+  engine.fixedFiles.erase(it);
+}
+
+/**
+  Reads once from a stream, blocking until some output or its end arrives.
+  @param engine Reference to the engine.
+  @param fd Descriptor of the stream.
+  @param data Reference to the string the output is appended to.
+  @return Number of bytes read, 0 at end of file, -1 on error.
+ */
+ssize_t readOnce(io_engine &engine, int fd, string &data) {
+  char buffer[SLOT_BYTES];
+  ssize_t bytes;
+  do {
+    ++engine.stats.syscalls;
+    bytes = read(fd, buffer, sizeof(buffer));
+  } while (bytes == ERROR_OCURRED && errno == EINTR);
+  if (bytes > 0) {
+    data.append(buffer, bytes);
+    engine.stats.bytesRead += bytes;
+  }
+  return bytes;
+}
+
+/**
+  Waits for the streams with poll and reads from each ready one.
+  @param engine Reference to the engine.
+  @param fds Descriptors of the streams.
+  @param timeoutMs Maximum time to wait in milliseconds.
+  @param results Reference to the results, one per stream.
+  @param data Reference to the output read, one per stream.
+ */
+void waitWithPoll(io_engine &engine, const vector <int> &fds, int timeoutMs,
+                  vector <ssize_t> &results, vector <string> &data) {
+  vector <struct pollfd> watched(fds.size());
+  for (int i = 0; i < fds.size(); ++i) {
+    watched[i].fd = fds[i];
+    watched[i].events = POLLIN;
+  }
+  ++engine.stats.syscalls;
+  if (poll(&watched[0], watched.size(), timeoutMs) <= 0) return;
+  for (int i = 0; i < watched.size(); ++i) {
+    if (watched[i].revents != 0) {
+      results[i] = readOnce(engine, fds[i], data[i]);
+    }
+  }
+}
+
+/**
+  Waits for the streams in the epoll set and reads from each ready one.
+  @param engine Reference to the engine.
+  @param fds Descriptors of the streams.
+  @param timeoutMs Maximum time to wait in milliseconds.
+  @param results Reference to the results, one per stream.
+  @param data Reference to the output read, one per stream.
+ */
+void waitWithEpoll(io_engine &engine, const vector <int> &fds, int timeoutMs,
+                   vector <ssize_t> &results, vector <string> &data) {
+  map <int, int> positions;
+  for (int i = 0; i < fds.size(); ++i) positions[fds[i]] = i;
+  vector <struct epoll_event> events(fds.size());
+  ++engine.stats.syscalls;
+  int ready = epoll_wait(engine.epollFd, &events[0], events.size(),
+                         timeoutMs);
+  for (int i = 0; i < ready; ++i) {
+    map <int, int>::iterator it = positions.find(events[i].data.fd);
+    if (it == positions.end()) continue;
+    results[it->second] = readOnce(engine, it->first, data[it->second]);
+  }
+}
+
+/**
+  Takes the completions of the reads submitted for the streams.
+  @param engine Reference to the engine.
+  @param picked Stream read into each stream slot.
+  @param done Reference telling which reads completed.
+  @param results Reference to the results, one per stream.
+  @param data Reference to the output read, one per stream.
+  @return Number of completions taken, cancellations included.
+ */
+int takeStreamReads(io_engine &engine, const vector <int> &picked,
+                    vector <bool> &done, vector <ssize_t> &results,
+                    vector <string> &data) {
+  int taken = 0;
+  unsigned long long userData;
+  int result;
+  while (nextCompletion(engine, userData, result)) {
+    ++taken;
+    if (userData & CANCEL_TAG) continue;
+    int slot = userData;
+    done[slot] = true;
+    // A cancelled read read nothing.
+    if (result < 0) continue;
+    int stream = picked[slot];
+    results[stream] = result;
+    data[stream].assign(engine.buffers + (RELAY_SLOTS + slot) * SLOT_BYTES,
+                        result);
+    engine.stats.bytesRead += result;
+  }
+  return taken;
+}
+
+/**
+  Submits one read for each stream at once and waits until some completes,
+  then cancels the others and waits for them to end, so that no read is left
+  pending on a descriptor that may be closed.
+  @param engine Reference to the engine.
+  @param fds Descriptors of the streams.
+  @param timeoutMs Maximum time to wait in milliseconds.
+  @param results Reference to the results, one per stream.
+  @param data Reference to the output read, one per stream.
+ */
+void waitWithRing(io_engine &engine, const vector <int> &fds, int timeoutMs,
+                  vector <ssize_t> &results, vector <string> &data) {
+  int count = fds.size() < STREAM_SLOTS ? fds.size() : STREAM_SLOTS;
+  vector <int> picked(count);
+  for (int slot = 0; slot < count; ++slot) {
+    picked[slot] = (engine.nextStream + slot) % fds.size();
+    int fd = fds[picked[slot]];
+    map <int, int>::iterator it = engine.fixedFiles.find(fd);
+    bool registered = it != engine.fixedFiles.end();
+    queueTransfer(engine, IORING_OP_READ_FIXED, registered ? it->second : fd,
+                  registered, RELAY_SLOTS + slot, 0, SLOT_BYTES,
+                  CURRENT_POSITION, slot);
+  }
+  engine.nextStream = (engine.nextStream + count) % fds.size();
+  vector <bool> done(count, false);
+  int pending = count;
+  if (!enterRing(engine, 1, timeoutMs)) return;
+  pending -= takeStreamReads(engine, picked, done, results, data);
+  if (pending == 0) return;
+  for (int slot = 0; slot < count; ++slot) {
+    if (done[slot]) continue;
+    struct io_uring_sqe entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.opcode = IORING_OP_ASYNC_CANCEL;
+    entry.addr = slot;
+    entry.user_data = CANCEL_TAG | slot;
+    queueEntry(engine, entry);
+    ++pending;
+  }
+  while (pending > 0 && enterRing(engine, pending, -1)) {
+    pending -= takeStreamReads(engine, picked, done, results, data);
+  }
+}
+
+/**
+  Waits until some of the given streams has output or the timeout expires
+  and reads from those that have. With io_uring one read is submitted for
+  every stream at once and those still waiting are cancelled afterwards.
+  @param engine Reference to the engine.
+  @param fds Descriptors of the streams, all watched.
+  @param timeoutMs Maximum time to wait in milliseconds.
+  @param results Reference filled, for each stream, with the bytes read, 0 at
+                 end of file, -1 on error or if nothing was read.
+  @param data Reference filled with what was read from each stream.
+ */
+void waitStreams(io_engine &engine, const vector <int> &fds, int timeoutMs,
+                 vector <ssize_t> &results, vector <string> &data) {
+  results.assign(fds.size(), ERROR_OCURRED);
+  data.assign(fds.size(), "");
+  if (fds.empty()) {
+    usleep(timeoutMs * 1000);
+    return;
+  }
+  if (engine.kind == IO_ENGINE_URING) {
+    waitWithRing(engine, fds, timeoutMs, results, data);
+  }
+  else if (engine.kind == IO_ENGINE_EPOLL) {
+    waitWithEpoll(engine, fds, timeoutMs, results, data);
+  }
+  else waitWithPoll(engine, fds, timeoutMs, results, data);
+}
+
+/**
+  Prints the system calls and CPU time spent by the coordinator per
+  megabyte of output.
+  @param engine Reference to the engine.
+ */
+void printIOStats(io_engine &engine) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+               usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  double megabytes = engine.stats.bytesRead / (1024.0 * 1024.0);
+  double perMegabyte = megabytes > 0 ? 1 / megabytes : 0;
+  printf("## I/O %s: %llu syscalls, %.1fM read, %.1fM relayed, "
+         "%.1f syscalls/MB, CPU %.3fs (%.4fs/MB) ##\n", engine.kind.c_str(),
+         engine.stats.syscalls, megabytes,
+         engine.stats.bytesWritten / (1024.0 * 1024.0),
+         engine.stats.syscalls * perMegabyte, cpu, cpu * perMegabyte);
+}
@@ -0,0 +1,130 @@
+#ifndef IOENGINE_H
+#define IOENGINE_H
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <map>
+
+extern const std::string IO_ENGINE_URING;
+extern const std::string IO_ENGINE_EPOLL;
+extern const std::string IO_ENGINE_BLOCKING;
+
+/**
+  This structure counts the system calls the coordinator made to collect and
+  relay output, and the bytes it moved.
+  */
+struct io_stats {
+  unsigned long long syscalls, bytesRead, bytesWritten;
+  io_stats() : syscalls(0), bytesRead(0), bytesWritten(0) {}
+};
+
+/**
+  This structure stores the I/O engine of the coordinator: which one runs and
+  its state. The io_uring engine maps the submission and completion rings,
+  registers a set of buffers and a table of files, whose first two entries
+  are used by relays and the rest by the watched streams. The epoll engine
+  keeps the watched streams in an epoll set; the blocking one needs no state.
+  */
+struct io_engine {
+  std::string kind;
+  int ringFd, epollFd;
+  // Rings shared with the kernel (one mapping holds both) and their sizes.
+  void *sqRing, *cqRing, *sqes;
+  size_t sqRingSize, sqesSize;
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray, *cqHead, *cqTail, *cqMask;
+  void *cqes;
+  // Submission entries queued and not yet given to the kernel.
+  unsigned queued;
+  // Registered buffers, in slots of the same size.
+  char *buffers;
+  // Registered file of each watched stream, and the watched stream that
+  // reads first next time, so that none waits behind the others.
+  std::map <int, int> fixedFiles;
+  unsigned nextStream;
+  io_stats stats;
+  io_engine();
+};
+
+/**
+  Tells if a name is a known I/O engine.
+  @param name Name to check.
+  @return true if it is "uring", "epoll" or "blocking".
+ */
+bool isIOEngine(const std::string &name);
+
+/**
+  Opens an I/O engine. When io_uring cannot be set up (old kernel, disabled
+  or locked memory exhausted) the epoll engine is used instead.
+  @param engine Reference to the engine, its kind tells the one that runs.
+  @param kind Engine to open, empty for the best one available.
+  @return true if the requested engine runs, false if it fell back.
+ */
+bool openEngine(io_engine &engine, const std::string &kind);
+
+/**
+  Releases everything an I/O engine holds.
+  @param engine Reference to the engine.
+ */
+void closeEngine(io_engine &engine);
+
+/**
+  Copies everything from a file to a descriptor. With io_uring several reads
+  of the file are in flight at once, each into a registered buffer, while
+  the buffers already read are written in order, one write at a time.
+  @param engine Reference to the engine.
+  @param input Descriptor of the file to copy, read from its start.
+  @param output Descriptor to write to, at its current position.
+  @param lastByte Reference filled with the last byte copied.
+  @return Bytes copied. On error, returns -1 and errno is set appropriately.
+ */
+long long relayFile(io_engine &engine, int input, int output, char &lastByte);
+
+/**
+  Starts watching a stream, so that waitStreams reads from it.
+  @param engine Reference to the engine.
+  @param fd Descriptor of the stream.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool watchStream(io_engine &engine, int fd);
+
+/**
+  Stops watching a stream, before it is closed.
+  @param engine Reference to the engine.
+  @param fd Descriptor of the stream.
+ */
+void unwatchStream(io_engine &engine, int fd);
+
+/**
+  Waits until some of the given streams has output or the timeout expires
+  and reads from those that have. With io_uring one read is submitted for
+  every stream at once and those still waiting are cancelled afterwards.
+  @param engine Reference to the engine.
+  @param fds Descriptors of the streams, all watched.
+  @param timeoutMs Maximum time to wait in milliseconds.
+  @param results Reference filled, for each stream, with the bytes read, 0 at
+                 end of file, -1 on error or if nothing was read.
+  @param data Reference filled with what was read from each stream.
+ */
+void waitStreams(io_engine &engine, const std::vector <int> &fds,
+                 int timeoutMs, std::vector <ssize_t> &results,
+                 std::vector <std::string> &data);
+
+/**
+  Reads once from a stream, blocking until some output or its end arrives.
+  @param engine Reference to the engine.
+  @param fd Descriptor of the stream.
+  @param data Reference to the string the output is appended to.
+  @return Number of bytes read, 0 at end of file, -1 on error.
+ */
+ssize_t readOnce(io_engine &engine, int fd, std::string &data);
+
+/**
+  Prints the system calls and CPU time spent by the coordinator per
+  megabyte of output.
+  @param engine Reference to the engine.
+ */
+void printIOStats(io_engine &engine);
+
+#endif
@@ -1,4 +1,6 @@
 #include <cstdio>
+#include <time.h>
+#include <sched.h>
 #include <string>
 #include <fstream>
 #include <iostream>
@@ -6,6 +8,11 @@
 #include <map>
 #include <set>
 #include "jobdesc.h"
+#include "placement.h"
+#include "cgroup.h"
+#include "priority.h"
+#include "schedule.h"
+#include "matrix.h"
 #include "yaml-cpp/yaml.h"
 
 using namespace std;
@@ -16,14 +23,28 @@ const string PIPE_ATTR    = "Pipe";
 const string NAME_ATTR    = "Name";
 const string EXEC_ATTR    = "Exec";
 const string ARGS_ATTR    = "Args";
+const string PLACEMENT_ATTR = "Placement";
+const string CPUS_ATTR    = "CPUs";
+const string MEMORY_MAX_ATTR = "MemoryMax";
+const string PRIORITY_ATTR = "Priority";
+const string IO_CLASS_ATTR = "IOClass";
+const string EVERY_ATTR   = "Every";
+const string JITTER_ATTR  = "Jitter";
+const string MATRIX_ATTR  = "Matrix";
+const string MAX_PARALLEL_ATTR = "MaxParallel";
+const string CHECKPOINT_ATTR = "Checkpoint";
+const string INPUT_DATA_ATTR = "InputData";
+const string INPUT_FROM_ATTR = "InputFrom";
+const string BASE64_ATTR  = "Base64";
+const string RECONNECT_ATTR = "Reconnect";
+const string ATTEMPTS_ATTR = "Attempts";
+const string DELAY_ATTR   = "Delay";
+const string PIPEFAIL_ATTR = "Pipefail";
 const string INPUT_ATTR   = "input";
 const string OUTPUT_ATTR  = "output";
-const string STD_IN       = "stdin";
-const string STD_OUT      = "stdout";
 const string DEFAULT_PIPE = "default-pipe";
 const string TEMP_DIR     = "./tmp/";
 const string TEMP_EXT     = ".tmp";
-const int FD_CLOSED       = -1;
 
 /**
   Utility to convert an integer into a string.
@@ -36,6 +57,150 @@ std::string toStr(int x) {
   return converter.str();
 }
 
+/**
+  Utility to use a name as part of a file name: '/' and '%' are written as
+  "%2F" and "%25", so that different names give different files.
+  @param name Name of a pipe or job, matrix instances include their values.
+  @return Name that can be used as one path component.
+*/
+std::string escapeFileName(const std::string &name) {
+  string escaped;
+  for (int i = 0; i < name.size(); ++i) {
+    if (name[i] == '/') escaped += "%2F";
+    else if (name[i] == '%') escaped += "%25";
+    else escaped += name[i];
+  }
+  return escaped;
+}
+
+/**
+  Utility to read a monotonic clock.
+  @return Seconds elapsed since an arbitrary point in the past.
+*/
+double monotonicSeconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+  Parses the optional 'Priority' and 'IOClass' fields of a job or a pipe.
+  @param node YAML node of the job or pipe.
+  @param destination Reference to the priority_desc to fill.
+  @return true if the fields are missing or valid, false otherwise.
+*/
+bool parsePriorityFields(YAML::Node node, priority_desc &destination) {
+  if (node[PRIORITY_ATTR] &&
+      !parsePriority(node[PRIORITY_ATTR].as<string>(), destination)) {
+    return false;
+  }
+  if (node[IO_CLASS_ATTR] &&
+      !parseIOClass(node[IO_CLASS_ATTR].as<string>(), destination)) {
+    return false;
+  }
+  return true;
+}
+
+/**
+  Parses the optional 'Matrix' field of a job or a pipe: a map from variable
+  name to its values, either a list or a string (range, glob pattern or
+  single value).
+  @param node YAML node of the job or pipe.
+  @param matrix Reference to the vector of dimensions to fill.
+  @return true if the field is missing or valid, false otherwise.
+*/
+bool parseMatrixField(YAML::Node node, vector <matrix_dim> &matrix) {
+  if (!node[MATRIX_ATTR]) return true;
+  YAML::Node matrixNode = node[MATRIX_ATTR];
+  if (!matrixNode.IsMap() || matrixNode.size() == 0) return false;
+  for (YAML::const_iterator it = matrixNode.begin(); it != matrixNode.end();
+       ++it) {
+    matrix_dim dimension;
+    dimension.name = it->first.as<string>();
+    if (it->second.IsSequence()) {
+      for (int i = 0; i < it->second.size(); ++i) {
+        dimension.values.push_back(it->second[i].as<string>());
+      }
+      dimension.count = dimension.values.size();
+    }
+    else if (!parseMatrixValues(it->second.as<string>(), dimension)) {
+      return false;
+    }
+    matrix.push_back(dimension);
+  }
+  return true;
+}
+
+/**
+  Decodes base64 text (RFC 4648, with or without padding). Whitespace, as
+  left by YAML block scalars, is skipped.
+  @param text Encoded text.
+  @param data Reference to the string filled with the decoded bytes.
+  @return true if the text is valid base64, false otherwise.
+*/
+bool decodeBase64(const string &text, string &data) {
+  static const string ALPHABET =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  data.clear();
+  data.reserve(text.size() / 4 * 3);
+  unsigned bits = 0;
+  int bitCount = 0;
+  bool padded = false;
+  for (int i = 0; i < text.size(); ++i) {
+    char c = text[i];
+    if (c == ' ' || c == '\n' || c == '\r' || c == '\t') continue;
+    if (c == '=') {
+      padded = true;
+      continue;
+    }
+    size_t value = ALPHABET.find(c);
+    // Nothing but padding may follow the padding.
+    if (value == string::npos || padded) return false;
+    bits = (bits << 6) | value;
+    bitCount += 6;
+    if (bitCount >= 8) {
+      bitCount -= 8;
+      data += (char) ((bits >> bitCount) & 0xFF);
+    }
+  }
+  // A single character left over cannot encode a whole byte.
+  return bitCount < 6;
+}
+
+/**
+  Parses the optional 'InputData' and 'InputFrom' fields of a pipe, which
+  feed its first stage from memory: inline data, either literal or a map
+  with its 'Base64' encoding, or the output of a job. The job is not run in
+  the default pipe.
+  @param node YAML node of the pipe.
+  @param destination Reference to the pipe to fill.
+  @param jobIndexByName Map from job name to its index.
+  @param assignedJobs Reference to the set of jobs that belong to a pipe.
+  @return true if the fields are missing or valid, false otherwise.
+*/
+bool parseInputData(YAML::Node node, pipe_desc &destination,
+                    map <string, int> &jobIndexByName,
+                    set <int> &assignedJobs) {
+  if (node[INPUT_DATA_ATTR] && node[INPUT_FROM_ATTR]) return false;
+  if (node[INPUT_DATA_ATTR]) {
+    YAML::Node dataNode = node[INPUT_DATA_ATTR];
+    if (!dataNode.IsMap()) destination.inputData = dataNode.as<string>();
+    else if (!dataNode[BASE64_ATTR] ||
+             !decodeBase64(dataNode[BASE64_ATTR].as<string>(),
+                           destination.inputData)) return false;
+    destination.feedInput = true;
+  }
+  if (node[INPUT_FROM_ATTR]) {
+    string jobName = node[INPUT_FROM_ATTR].as<string>();
+    if (jobIndexByName.count(jobName) == 0) return false;
+    destination.inputFrom = jobIndexByName[jobName];
+    assignedJobs.insert(destination.inputFrom);
+    destination.feedInput = true;
+  }
+  // Fed data replaces the input, which may only be left as stdin.
+  return !destination.feedInput || destination.input == STD_IN;
+}
+
 /**
   Method that uses 'yaml-cpp' library to parse a YAML file and fill a vector of
   job_desc with the respective values. Also, jobIndexByName map contains a
@@ -44,10 +209,12 @@ std::string toStr(int x) {
   @param rootNode Source YAML data loaded and represented as root node.
   @param jobIndexByName Map to be filled by job name as key and index in the
                         jobs vector as value.
+  @param jobMatrices Reference to the vector of job matrices to be filled.
   @return true if the file was successfully parsed, false otherwise.
 */
 bool parseJobs(vector <job_desc> &jobs, YAML::Node &rootNode,
-               map <string, int> &jobIndexByName) {
+               map <string, int> &jobIndexByName,
+               vector <vector <matrix_dim> > &jobMatrices) {
   YAML::Node jobsNode;
   // If 'Jobs' doesn't exist in the YAML, we can't proceed.
   if (!(jobsNode = rootNode[JOBS_ATTR])) return false;
@@ -66,6 +233,9 @@ bool parseJobs(vector <job_desc> &jobs, YAML::Node &rootNode,
     for (int i = 0; i < argsNode.size(); ++i) {
       currentJob.args.push_back(argsNode[i].as<string>());
     }
+    if (!parsePriorityFields(currentJobNode, currentJob.priority)) return false;
+    jobMatrices.push_back(vector <matrix_dim>());
+    if (!parseMatrixField(currentJobNode, jobMatrices.back())) return false;
     jobs.push_back(currentJob);
     // Set the index where we can find the job by it's name in a map.
     jobIndexByName[currentJob.name] = jobs.size() - 1;
@@ -86,10 +256,12 @@ bool parseJobs(vector <job_desc> &jobs, YAML::Node &rootNode,
   @param assignedJobs Set to be filled with each index of every job that occurs
                       in a pipe, that is. This set will be used to determine
                       which jobs should run in a default pipe.
+  @param jobMatrices Matrices of the jobs, added to those of their pipes.
   @return true if the file was successfully parsed, false otherwise.
 */
 bool parsePipes(vector <pipe_desc> &pipes, YAML::Node &rootNode,
-                map <string, int> &jobIndexByName, set <int> &assignedJobs) {
+                map <string, int> &jobIndexByName, set <int> &assignedJobs,
+                vector <vector <matrix_dim> > &jobMatrices) {
   YAML::Node pipesNode;
   // If 'Pipes' doesn't exist in the YAML, we can't proceed.
   if (!(pipesNode = rootNode[PIPES_ATTR])) return false;
@@ -104,19 +276,97 @@ bool parsePipes(vector <pipe_desc> &pipes, YAML::Node &rootNode,
     // If required attribute doesn't exist return false.
     if (!currentPipeNode[NAME_ATTR]) return false;
     currentPipe.name = currentPipeNode[NAME_ATTR].as<string>();
-    if (!currentPipeNode[INPUT_ATTR]) return false;
-    currentPipe.input = currentPipeNode[INPUT_ATTR].as<string>();
+    // The input may be left out when the pipe is fed from memory.
+    currentPipe.input = STD_IN;
+    if (currentPipeNode[INPUT_ATTR]) {
+      currentPipe.input = currentPipeNode[INPUT_ATTR].as<string>();
+    }
+    if (!parseInputData(currentPipeNode, currentPipe, jobIndexByName,
+                        assignedJobs)) return false;
+    if (!currentPipeNode[INPUT_ATTR] && !currentPipe.feedInput) return false;
     if (!currentPipeNode[OUTPUT_ATTR]) return false;
     currentPipe.output = currentPipeNode[OUTPUT_ATTR].as<string>();
+    // Placement is optional, an explicit list of CPUs implies its policy.
+    if (currentPipeNode[PLACEMENT_ATTR]) {
+      currentPipe.placement = currentPipeNode[PLACEMENT_ATTR].as<string>();
+      if (!isPlacementPolicy(currentPipe.placement)) return false;
+    }
+    if (currentPipeNode[CPUS_ATTR]) {
+      YAML::Node cpusNode = currentPipeNode[CPUS_ATTR];
+      for (int i = 0; i < cpusNode.size(); ++i) {
+        int cpu = cpusNode[i].as<int>();
+        // A CPU beyond a cpu_set_t could not be given to any stage.
+        if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+        currentPipe.cpus.push_back(cpu);
+      }
+      currentPipe.placement = PLACEMENT_CPUS;
+    }
+    if (currentPipeNode[MEMORY_MAX_ATTR]) {
+      string memoryMax = currentPipeNode[MEMORY_MAX_ATTR].as<string>();
+      if (!parseMemorySize(memoryMax, currentPipe.memoryMax)) return false;
+    }
+    if (!parsePriorityFields(currentPipeNode, currentPipe.priority)) {
+      return false;
+    }
+    // A repeating pipe needs a period, the jitter is optional.
+    if (currentPipeNode[EVERY_ATTR]) {
+      string every = currentPipeNode[EVERY_ATTR].as<string>();
+      if (!parseDuration(every, currentPipe.every) ||
+          currentPipe.every <= 0) return false;
+    }
+    if (currentPipeNode[JITTER_ATTR]) {
+      string jitter = currentPipeNode[JITTER_ATTR].as<string>();
+      if (!currentPipeNode[EVERY_ATTR] ||
+          !parseDuration(jitter, currentPipe.jitter)) return false;
+    }
+    // Endpoints are opened again after a failure only when asked.
+    if (currentPipeNode[RECONNECT_ATTR]) {
+      YAML::Node reconnectNode = currentPipeNode[RECONNECT_ATTR];
+      if (!reconnectNode.IsMap()) return false;
+      if (reconnectNode[ATTEMPTS_ATTR]) {
+        currentPipe.reconnectAttempts = reconnectNode[ATTEMPTS_ATTR].as<int>();
+        if (currentPipe.reconnectAttempts < 0) return false;
+      }
+      if (reconnectNode[DELAY_ATTR] &&
+          !parseDuration(reconnectNode[DELAY_ATTR].as<string>(),
+                         currentPipe.reconnectDelay)) return false;
+    }
+    if (currentPipeNode[PIPEFAIL_ATTR]) {
+      currentPipe.pipefail = currentPipeNode[PIPEFAIL_ATTR].as<bool>();
+    }
+    if (!parseMatrixField(currentPipeNode, currentPipe.matrix)) return false;
+    if (currentPipeNode[MAX_PARALLEL_ATTR]) {
+      currentPipe.maxParallel = currentPipeNode[MAX_PARALLEL_ATTR].as<int>();
+      if (currentPipe.maxParallel < 0) return false;
+    }
     if (!currentPipeNode[PIPE_ATTR]) return false;
     YAML::Node pipeNode = currentPipeNode[PIPE_ATTR];
     for (int i = 0; i < pipeNode.size(); ++i) {
-      string jobName = pipeNode[i].as<string>();
+      // A job is given by its name, or by a map with its name and whether
+      // its output is saved to a checkpoint.
+      string jobName;
+      bool checkpoint = false;
+      if (pipeNode[i].IsMap()) {
+        if (!pipeNode[i][NAME_ATTR]) return false;
+        jobName = pipeNode[i][NAME_ATTR].as<string>();
+        if (pipeNode[i][CHECKPOINT_ATTR]) {
+          checkpoint = pipeNode[i][CHECKPOINT_ATTR].as<bool>();
+        }
+      }
+      else jobName = pipeNode[i].as<string>();
+      currentPipe.checkpoints.push_back(checkpoint);
       // Get the index of the job in the map
       int jobIndex = jobIndexByName[jobName];
       currentPipe.jobsIndexes.push_back(jobIndex);
       // Set the job as already assigned.
       assignedJobs.insert(jobIndex);
+      mergeMatrix(currentPipe.matrix, jobMatrices[jobIndex]);
+    }
+    // Each run of a repeating pipe would expand the whole matrix again.
+    if (currentPipe.every > 0 && !currentPipe.matrix.empty()) return false;
+    // The output of the last stage is the one of the pipe.
+    if (!currentPipe.checkpoints.empty() && currentPipe.checkpoints.back()) {
+      return false;
     }
     pipes.push_back(currentPipe);
   }
@@ -135,12 +385,16 @@ bool parsePipes(vector <pipe_desc> &pipes, YAML::Node &rootNode,
                   description.
   @param assignedJobs Set of integers that represent jobs indexes that were
                       assigned to a pipe.
+  @param jobMatrices Reference to a vector where the matrix of each job (empty
+                     if it has none) will be saved, by job index.
 */
 bool loadFromYAML(vector <job_desc> &jobs, vector <pipe_desc> &pipes,
-                  char* fileName, set <int> &assignedJobs) {
+                  char* fileName, set <int> &assignedJobs,
+                  vector <vector <matrix_dim> > &jobMatrices) {
   YAML::Node rootNode = YAML::LoadFile(fileName);
   map <string, int> jobIndexByName;
-  if (!parseJobs(jobs, rootNode, jobIndexByName)) return false;
-  if (!parsePipes(pipes, rootNode, jobIndexByName, assignedJobs)) return false;
+  if (!parseJobs(jobs, rootNode, jobIndexByName, jobMatrices)) return false;
+  if (!parsePipes(pipes, rootNode, jobIndexByName, assignedJobs,
+                  jobMatrices)) return false;
   return true;
 }
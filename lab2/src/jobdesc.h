@@ -1,9 +1,12 @@
 #ifndef JOB_DESC_H
 #define JOB_DESC_H
 
+#include <sys/types.h>
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
+#include "jobexec.h"
 
 extern const std::string JOBS_ATTR;
 extern const std::string PIPES_ATTR;
@@ -11,28 +14,100 @@ extern const std::string PIPE_ATTR;
 extern const std::string NAME_ATTR;
 extern const std::string EXEC_ATTR;
 extern const std::string ARGS_ATTR;
-extern const std::string STD_IN;
-extern const std::string STD_OUT;
-extern const std::string STD_ERR;
+extern const std::string PLACEMENT_ATTR;
+extern const std::string CPUS_ATTR;
+extern const std::string MEMORY_MAX_ATTR;
+extern const std::string PRIORITY_ATTR;
+extern const std::string IO_CLASS_ATTR;
 extern const std::string DEFAULT_PIPE;
 extern const std::string TEMP_DIR;
 extern const std::string TEMP_EXT;
-extern const int FD_CLOSED;
 
 /**
-  This structure stores the information of a job.
+  This structure stores a dimension of a matrix: the variable it binds and
+  its values, given as a range (first value, step and count), a list or a
+  glob pattern. Patterns are only expanded when the matrix starts.
   */
-struct job_desc {
-  std::string name, exec;
-  std::vector <std::string> args;
+struct matrix_dim {
+  std::string name, pattern;
+  std::vector <std::string> values;
+  bool isRange;
+  long long first, step, count;
+  matrix_dim() : isRange(false), first(0), step(1), count(0) {}
 };
 
+struct endpoint_stats;
+
 /**
   This structure stores the information of a pipe.
   */
 struct pipe_desc {
-  std::string name, input, output, tempOutput;
-  std::vector <int> jobsIndexes;
+  std::string name, input, output, tempOutput, placement;
+  std::vector <int> jobsIndexes, cpus;
+  std::vector <stage_placement> stagePlacement;
+  // Memory limit of the pipe cgroup in bytes (0 means no limit), path of that
+  // cgroup once created and highest memory usage observed in it.
+  long long memoryMax, peakMemory;
+  std::string cgroup;
+  // Endpoint of the worker that runs the pipe, empty when it runs here.
+  std::string worker;
+  // Descriptor where the pipe master writes the output instead of the
+  // temporal file, -1 if it is not streamed.
+  int outputFd;
+  // Bytes of the error stream of each stage to keep (-1 when it is not
+  // captured), directory that receives it whole and descriptor of the file
+  // where the pipe master leaves the tails.
+  long long errorTail;
+  std::string errorDir;
+  int errorsFd;
+  // Wall time in seconds expected from previous runs and time at which the
+  // pipe was started.
+  double predictedWall, startTime;
+  priority_desc priority;
+  // Position of the pipe class in the ready queue order and of the pipe in
+  // the YAML file.
+  int classRank, order;
+  // Seconds between runs of a repeating pipe (0 runs it once) and most
+  // seconds each run may be delayed at random.
+  double every, jitter;
+  // Dimensions a matrix pipe is expanded over and most instances of it that
+  // may run at once (0 means no limit). An instance has the index it got in
+  // the expansion (-1 for other pipes) and the value of each variable.
+  std::vector <matrix_dim> matrix;
+  int maxParallel, matrixInstance;
+  std::map <std::string, std::string> bindings;
+  // Whether the output of each stage is saved to a checkpoint, the file of
+  // the checkpoint of each stage of the whole pipe (empty for none) and the
+  // stage the pipe resumed after, -1 if it runs whole.
+  std::vector <bool> checkpoints;
+  std::vector <std::string> checkpointFiles;
+  int resumedStage;
+  // Whether the first stage reads 'inputData' from memory instead of
+  // 'input', and the job whose output is that data (-1 when it is given in
+  // the YAML file).
+  bool feedInput;
+  int inputFrom;
+  std::string inputData;
+  // Whether the input and output are endpoints (FIFOs or Unix sockets), how
+  // many times and how many seconds apart they are opened again, and the
+  // counters shared with their relays (NULL when there are none).
+  bool inputEndpoint, outputEndpoint;
+  int reconnectAttempts;
+  double reconnectDelay;
+  endpoint_stats *endpointStats;
+  // Process ids of the stages and of the children saving their checkpoints,
+  // in pipe order, left by the pipe master in memory shared with the monitor
+  // (NULL when the pipe is not monitored).
+  pid_t *stagePids;
+  // Whether a stage that fails fails the pipe and stops the other stages.
+  bool pipefail;
+  pipe_desc() : memoryMax(0), peakMemory(-1), outputFd(-1), errorTail(-1),
+                errorsFd(-1), predictedWall(0), startTime(0), classRank(0),
+                order(0), every(0), jitter(0), maxParallel(0),
+                matrixInstance(-1), resumedStage(-1), feedInput(false),
+                inputFrom(-1), inputEndpoint(false), outputEndpoint(false),
+                reconnectAttempts(0), reconnectDelay(1),
+                endpointStats(NULL), stagePids(NULL), pipefail(false) {}
 };
 
 /**
@@ -46,9 +121,12 @@ struct pipe_desc {
                   description.
   @param assignedJobs Set of integers that represent jobs indexes that were
                       assigned to a pipe.
+  @param jobMatrices Reference to a vector where the matrix of each job (empty
+                     if it has none) will be saved, by job index.
 */
 bool loadFromYAML(std::vector <job_desc> &jobs, std::vector <pipe_desc> &pipes,
-                  char* fileName, std::set<int> &assignedJobs);
+                  char* fileName, std::set<int> &assignedJobs,
+                  std::vector <std::vector <matrix_dim> > &jobMatrices);
 
 /**
   Utility to convert an integer into a string.
@@ -56,4 +134,18 @@ bool loadFromYAML(std::vector <job_desc> &jobs, std::vector <pipe_desc> &pipes,
   @return String representation of x.
  */
 std::string toStr(int x);
+
+/**
+  Utility to use a name as part of a file name: '/' and '%' are written as
+  "%2F" and "%25", so that different names give different files.
+  @param name Name of a pipe or job, matrix instances include their values.
+  @return Name that can be used as one path component.
+ */
+std::string escapeFileName(const std::string &name);
+
+/**
+  Utility to read a monotonic clock.
+  @return Seconds elapsed since an arbitrary point in the past.
+ */
+double monotonicSeconds();
 #endif
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <errno.h>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <glob.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <sstream>
+#include "matrix.h"
+
+using namespace std;
+
+// Failed instances named in the results of a matrix, the rest are counted.
+const int NAMED_FAILURES = 5;
+
+/**
+  Parses the values of a matrix dimension given as a string: a range such as
+  "1..500" or "0..100..10", a glob pattern such as "*.txt" or a single value.
+  A range must have fewer values than a long long holds.
+  @param text String with the values.
+  @param dimension Reference to the matrix_dim to fill.
+  @return true if the values are valid, false otherwise.
+ */
+bool parseMatrixValues(const string &text, matrix_dim &dimension) {
+  const char *firstText = text.c_str();
+  char *end;
+  errno = 0;
+  long long first = strtoll(firstText, &end, 10);
+  if (end != firstText && strncmp(end, "..", 2) == 0) {
+    const char *lastText = end + 2;
+    long long last = strtoll(lastText, &end, 10);
+    if (end == lastText) return false;
+    long long step = 1;
+    if (strncmp(end, "..", 2) == 0) {
+      const char *stepText = end + 2;
+      step = strtoll(stepText, &end, 10);
+      if (end == stepText || step <= 0) return false;
+    }
+    if (*end != '\0' || last < first || errno == ERANGE) return false;
+    // The distance between the bounds and the count must not overflow.
+    if (first < 0 && last > LLONG_MAX + first) return false;
+    if ((last - first) / step == LLONG_MAX) return false;
+    dimension.isRange = true;
+    dimension.first = first;
+    dimension.step = step;
+    dimension.count = (last - first) / step + 1;
+    return true;
+  }
+  if (text.find_first_of("*?[") != string::npos) {
+    dimension.pattern = text;
+    return true;
+  }
+  dimension.values.push_back(text);
+  dimension.count = 1;
+  return true;
+}
+
+/**
+  Adds to a matrix the dimensions of another one whose variables it does not
+  bind yet.
+  @param matrix Reference to the matrix to extend.
+  @param other Dimensions to add.
+ */
+void mergeMatrix(vector <matrix_dim> &matrix,
+                 const vector <matrix_dim> &other) {
+  for (int i = 0; i < other.size(); ++i) {
+    bool bound = false;
+    for (int j = 0; j < matrix.size(); ++j) {
+      bound |= matrix[j].name == other[i].name;
+    }
+    if (!bound) matrix.push_back(other[i]);
+  }
+}
+
+/**
+  Replaces every "{name}" in a text by the value bound to name.
+  @param text Text to substitute.
+  @param bindings Values of the variables.
+  @return The substituted text.
+ */
+string substituteBindings(const string &text,
+                          const map <string, string> &bindings) {
+  string result;
+  size_t start = 0, open;
+  while ((open = text.find('{', start)) != string::npos) {
+    size_t close = text.find('}', open);
+    if (close == string::npos) break;
+    map <string, string>::const_iterator value =
+        bindings.find(text.substr(open + 1, close - open - 1));
+    result += text.substr(start, open - start);
+    // Braces that do not name a variable are kept.
+    if (value == bindings.end()) result += text.substr(open, close - open + 1);
+    else result += value->second;
+    start = close + 1;
+  }
+  return result + text.substr(start);
+}
+
+/**
+  Starts the expansion of a matrix: expands its glob patterns and counts its
+  instances.
+  @param state Reference to the state of the matrix.
+  @param matrixPipe Reference to the matrix pipe.
+  @return true if the instances were counted, false if they are more than a
+          long long holds.
+ */
+bool startMatrix(matrix_state &state, const pipe_desc &matrixPipe) {
+  state.pipe = matrixPipe;
+  state.started = true;
+  state.total = 1;
+  for (int i = 0; i < state.pipe.matrix.size(); ++i) {
+    matrix_dim &dimension = state.pipe.matrix[i];
+    if (!dimension.pattern.empty()) {
+      glob_t found;
+      if (glob(dimension.pattern.c_str(), 0, NULL, &found) == 0) {
+        dimension.values.assign(found.gl_pathv,
+                                found.gl_pathv + found.gl_pathc);
+      }
+      globfree(&found);
+      dimension.count = dimension.values.size();
+    }
+    if (dimension.count > 0 && state.total > LLONG_MAX / dimension.count) {
+      return false;
+    }
+    state.total *= dimension.count;
+  }
+  return true;
+}
+
+/**
+  Builds an instance of a matrix: the matrix pipe with each variable bound to
+  one of its values and substituted in the input and output.
+  @param state Reference to the state of the matrix.
+  @param index Index of the instance, the last dimension changes fastest.
+  @return The instance.
+ */
+pipe_desc buildInstance(matrix_state &state, long long index) {
+  pipe_desc instance = state.pipe;
+  instance.matrix.clear();
+  instance.matrixInstance = index;
+  vector <string> values(state.pipe.matrix.size());
+  long long rest = index;
+  for (int i = state.pipe.matrix.size() - 1; i >= 0; --i) {
+    matrix_dim &dimension = state.pipe.matrix[i];
+    long long position = rest % dimension.count;
+    rest /= dimension.count;
+    if (dimension.isRange) {
+      stringstream value;
+      value << dimension.first + position * dimension.step;
+      values[i] = value.str();
+    }
+    else values[i] = dimension.values[position];
+    instance.bindings[dimension.name] = values[i];
+  }
+  string suffix;
+  for (int i = 0; i < values.size(); ++i) {
+    if (i > 0) suffix += ",";
+    suffix += state.pipe.matrix[i].name + "=" + values[i];
+  }
+  instance.name = state.pipe.name + "[" + suffix + "]";
+  instance.input = substituteBindings(instance.input, instance.bindings);
+  instance.output = substituteBindings(instance.output, instance.bindings);
+  // Instances run at the same time, each one needs its own temporal file.
+  stringstream tempOutput;
+  tempOutput << state.pipe.tempOutput << "." << index;
+  instance.tempOutput = tempOutput.str();
+  return instance;
+}
+
+/**
+  Finds the next pipe of the ready queue that may be launched: the first one
+  that is not a matrix already running its maximum of instances. Matrices
+  are started when first found, those with no instances or too many to count
+  are dropped.
+  @param readyPipes Reference to the queue of pipes waiting to be admitted.
+  @param matrices Reference to the matrix states, by pipe order.
+  @return Iterator to the pipe, or the end of the queue if none may start.
+ */
+deque <pipe_desc>::iterator findNextPipe(deque <pipe_desc> &readyPipes,
+                                         map <int, matrix_state> &matrices) {
+  deque <pipe_desc>::iterator it = readyPipes.begin();
+  while (it != readyPipes.end()) {
+    if (it->matrix.empty()) return it;
+    matrix_state &state = matrices[it->order];
+    if (!state.started && !startMatrix(state, *it)) {
+      printf("## %s matrix has too many instances ##\n", it->name.c_str());
+      it = readyPipes.erase(it);
+      continue;
+    }
+    if (state.total == 0) {
+      printf("## %s matrix has no instances ##\n", it->name.c_str());
+      it = readyPipes.erase(it);
+      continue;
+    }
+    if (state.pipe.maxParallel == 0 ||
+        state.running < state.pipe.maxParallel) return it;
+    ++it;
+  }
+  return it;
+}
+
+/**
+  Takes a pipe out of the ready queue. A matrix gives its next instance,
+  staying in the queue until all of them are taken.
+  @param readyPipes Reference to the queue of pipes waiting to be admitted.
+  @param next Iterator returned by findNextPipe.
+  @param matrices Reference to the matrix states, by pipe order.
+  @return The pipe to launch.
+ */
+pipe_desc takeNextPipe(deque <pipe_desc> &readyPipes,
+                       deque <pipe_desc>::iterator next,
+                       map <int, matrix_state> &matrices) {
+  if (next->matrix.empty()) {
+    pipe_desc nextPipe = *next;
+    readyPipes.erase(next);
+    return nextPipe;
+  }
+  matrix_state &state = matrices[next->order];
+  pipe_desc instance = buildInstance(state, state.next++);
+  ++state.running;
+  if (state.next >= state.total) readyPipes.erase(next);
+  return instance;
+}
+
+/**
+  Records a finished instance of a matrix and, once every instance finished,
+  prints the aggregated results of the matrix.
+  @param out Stream to print to.
+  @param state Reference to the state of the matrix.
+  @param instanceName Name of the instance.
+  @param success Whether the instance was successful.
+  @param wallTime Wall time of the instance in seconds.
+  @return true if it was the last instance, false otherwise.
+ */
+bool recordInstance(FILE *out, matrix_state &state,
+                    const string &instanceName, bool success,
+                    double wallTime) {
+  --state.running;
+  if (success) ++state.succeeded;
+  else {
+    ++state.failed;
+    if (state.failedNames.size() < NAMED_FAILURES) {
+      state.failedNames.push_back(instanceName);
+    }
+  }
+  state.totalWall += wallTime;
+  if (wallTime > state.longestWall) state.longestWall = wallTime;
+  if (state.next < state.total || state.running > 0) return false;
+  fprintf(out, "## %s matrix: %lld instances, %d succeeded, %d failed",
+          state.pipe.name.c_str(), state.total, state.succeeded,
+          state.failed);
+  for (int i = 0; i < state.failedNames.size(); ++i) {
+    fprintf(out, "%s%s", i == 0 ? " (" : ", ", state.failedNames[i].c_str());
+  }
+  if (state.failed > state.failedNames.size()) fprintf(out, ", ...");
+  if (!state.failedNames.empty()) fprintf(out, ")");
+  fprintf(out, ", wall mean %.2fs, max %.2fs ##\n",
+          state.totalWall / state.total, state.longestWall);
+  return true;
+}
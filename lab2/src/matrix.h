@@ -0,0 +1,96 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include "jobdesc.h"
+
+/**
+  This structure stores the expansion of a matrix pipe: the pipe it expands,
+  how many instances it has (known once it starts), the index of the next
+  one, how many are running and the aggregated results of those finished.
+  */
+struct matrix_state {
+  pipe_desc pipe;
+  bool started;
+  long long total, next;
+  int running, succeeded, failed;
+  double totalWall, longestWall;
+  // Names of the first failed instances.
+  std::vector <std::string> failedNames;
+  matrix_state() : started(false), total(0), next(0), running(0),
+                   succeeded(0), failed(0), totalWall(0), longestWall(0) {}
+};
+
+/**
+  Parses the values of a matrix dimension given as a string: a range such as
+  "1..500" or "0..100..10", a glob pattern such as "*.txt" or a single value.
+  A range must have fewer values than a long long holds.
+  @param text String with the values.
+  @param dimension Reference to the matrix_dim to fill.
+  @return true if the values are valid, false otherwise.
+ */
+bool parseMatrixValues(const std::string &text, matrix_dim &dimension);
+
+/**
+  Adds to a matrix the dimensions of another one whose variables it does not
+  bind yet.
+  @param matrix Reference to the matrix to extend.
+  @param other Dimensions to add.
+ */
+void mergeMatrix(std::vector <matrix_dim> &matrix,
+                 const std::vector <matrix_dim> &other);
+
+/**
+  Replaces every "{name}" in a text by the value bound to name.
+  @param text Text to substitute.
+  @param bindings Values of the variables.
+  @return The substituted text.
+ */
+std::string substituteBindings(const std::string &text,
+                               const std::map <std::string,
+                                               std::string> &bindings);
+
+/**
+  Finds the next pipe of the ready queue that may be launched: the first one
+  that is not a matrix already running its maximum of instances. Matrices
+  are started when first found, those with no instances or too many to count
+  are dropped.
+  @param readyPipes Reference to the queue of pipes waiting to be admitted.
+  @param matrices Reference to the matrix states, by pipe order.
+  @return Iterator to the pipe, or the end of the queue if none may start.
+ */
+std::deque <pipe_desc>::iterator findNextPipe(
+    std::deque <pipe_desc> &readyPipes,
+    std::map <int, matrix_state> &matrices);
+
+/**
+  Takes a pipe out of the ready queue. A matrix gives its next instance,
+  staying in the queue until all of them are taken.
+  @param readyPipes Reference to the queue of pipes waiting to be admitted.
+  @param next Iterator returned by findNextPipe.
+  @param matrices Reference to the matrix states, by pipe order.
+  @return The pipe to launch.
+ */
+pipe_desc takeNextPipe(std::deque <pipe_desc> &readyPipes,
+                       std::deque <pipe_desc>::iterator next,
+                       std::map <int, matrix_state> &matrices);
+
+/**
+  Records a finished instance of a matrix and, once every instance finished,
+  prints the aggregated results of the matrix.
+  @param out Stream to print to.
+  @param state Reference to the state of the matrix.
+  @param instanceName Name of the instance.
+  @param success Whether the instance was successful.
+  @param wallTime Wall time of the instance in seconds.
+  @return true if it was the last instance, false otherwise.
+ */
+bool recordInstance(FILE *out, matrix_state &state,
+                    const std::string &instanceName, bool success,
+                    double wallTime);
+
+#endif
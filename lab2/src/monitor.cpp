@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <cstdlib>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include "monitor.h"
+#include "checkpoint.h"
+
+using namespace std;
+
+#define ERROR_OCURRED -1
+
+const string PROC_DIR = "/proc/";
+
+// Seconds between two prints of the table of stages.
+const double MONITOR_PRINT_S = 1.0;
+// Name shown for the child that saves the checkpoint of a stage.
+const string CHECKPOINT_STAGE = "checkpoint";
+
+run_monitor::run_monitor() : startTime(monotonicSeconds()),
+                             lastPrint(monotonicSeconds()) {}
+
+/**
+  This structure stores the fields of /proc/<pid>/stat used by the monitor.
+  */
+struct process_stat {
+  char state;
+  pid_t parent;
+  unsigned long long cpuTicks, startTicks;
+};
+
+/**
+  Reads /proc/<pid>/stat.
+  @param pid Process id.
+  @param stat Reference to the process_stat to fill.
+  @return true if the process exists, false otherwise.
+ */
+bool readProcessStat(pid_t pid, process_stat &stat) {
+  ifstream ifs((PROC_DIR + toStr(pid) + "/stat").c_str());
+  string line;
+  if (!getline(ifs, line)) return false;
+  // The command name is between parentheses and may hold spaces, the other
+  // fields follow the last ')'.
+  size_t nameEnd = line.rfind(')');
+  if (nameEnd == string::npos) return false;
+  stringstream fields(line.substr(nameEnd + 1));
+  vector <string> field;
+  string value;
+  while (fields >> value) field.push_back(value);
+  // State is field 3 of the file, utime 14, stime 15 and starttime 22.
+  if (field.size() < 20) return false;
+  stat.state = field[0][0];
+  stat.parent = atoi(field[1].c_str());
+  stat.cpuTicks = strtoull(field[11].c_str(), NULL, 10) +
+                  strtoull(field[12].c_str(), NULL, 10);
+  stat.startTicks = strtoull(field[19].c_str(), NULL, 10);
+  return true;
+}
+
+/**
+  Reads the bytes read and written by a process from /proc/<pid>/io.
+  @param pid Process id.
+  @param readBytes Reference where 'rchar' will be stored.
+  @param writtenBytes Reference where 'wchar' will be stored.
+  @return true if the counters could be read, false otherwise.
+ */
+bool readProcessIO(pid_t pid, unsigned long long &readBytes,
+                   unsigned long long &writtenBytes) {
+  ifstream ifs((PROC_DIR + toStr(pid) + "/io").c_str());
+  string key;
+  unsigned long long value;
+  int found = 0;
+  while (ifs >> key >> value) {
+    if (key == "rchar:") readBytes = value, ++found;
+    else if (key == "wchar:") writtenBytes = value, ++found;
+  }
+  return found == 2;
+}
+
+/**
+  Measures the pipe behind a descriptor of a process, opening it through
+  /proc/<pid>/fd only for the time of the measure so that no end of the pipe
+  is kept open.
+  @param pid Process id.
+  @param fd Descriptor of the process.
+  @param queued Reference where the bytes waiting in the pipe will be stored.
+  @param capacity Reference where the capacity of the pipe will be stored.
+  @return true if the descriptor is a pipe, false otherwise.
+ */
+bool measurePipe(pid_t pid, int fd, long long &queued, long long &capacity) {
+  string path = PROC_DIR + toStr(pid) + "/fd/" + toStr(fd);
+  int pipeFd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (pipeFd == -1) return false;
+  struct stat info;
+  int bytes = 0;
+  bool measured = fstat(pipeFd, &info) == 0 && S_ISFIFO(info.st_mode) &&
+                  ioctl(pipeFd, FIONREAD, &bytes) == 0;
+  capacity = fcntl(pipeFd, F_GETPIPE_SZ);
+  close(pipeFd);
+  queued = bytes;
+  return measured && capacity > 0;
+}
+
+/**
+  Gives the number of process ids a pipe may leave for the monitor: each of
+  its stages and the child saving the checkpoint of each one.
+  @param pipeToRun Reference to the pipe.
+  @return Number of slots of its shared process ids.
+ */
+size_t stagePidSlots(const pipe_desc &pipeToRun) {
+  return 2 * pipeToRun.jobsIndexes.size();
+}
+
+/**
+  Maps the memory where the pipe master of a monitored pipe leaves the
+  process ids of its stages.
+  @param pipeToRun Reference to the pipe, the mapping is stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool shareStagePids(pipe_desc &pipeToRun) {
+  void *shared = mmap(NULL, stagePidSlots(pipeToRun) * sizeof(pid_t),
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                      -1, 0);
+  if (shared == MAP_FAILED) return false;
+  // Anonymous memory starts zeroed, no process has id 0.
+  pipeToRun.stagePids = (pid_t *) shared;
+  return true;
+}
+
+/**
+  Leaves the process ids of a started pipeline for the monitor, each stage
+  followed by the child saving its checkpoint, if any. Called by the pipe
+  master, it does nothing if the pipe is not monitored.
+  @param pipeToRun Reference to the pipe.
+  @param handle Reference to the handle of its pipeline.
+ */
+void publishStagePids(pipe_desc &pipeToRun, const pipeline_handle &handle) {
+  if (pipeToRun.stagePids == NULL) return;
+  int slot = 0;
+  for (int i = 0; i < handle.pids.size(); ++i) {
+    pipeToRun.stagePids[slot++] = handle.pids[i];
+    if (i < handle.teePids.size() && handle.teePids[i] != ERROR_OCURRED) {
+      pipeToRun.stagePids[slot++] = handle.teePids[i];
+    }
+  }
+}
+
+/**
+  Unmaps the process ids of the stages of a pipe, if it has them.
+  @param pipeToRun Reference to the pipe.
+ */
+void releaseStagePids(pipe_desc &pipeToRun) {
+  if (pipeToRun.stagePids == NULL) return;
+  munmap(pipeToRun.stagePids, stagePidSlots(pipeToRun) * sizeof(pid_t));
+  pipeToRun.stagePids = NULL;
+}
+
+/**
+  Finds the stages of a pipe in the process ids its pipe master left once
+  the whole pipeline was started. Other children of the pipe master, as the
+  relays of its endpoints or the feeder of its input, are not stages.
+  @param watched Reference to the monitored pipe, its stages get their pids
+                 once all of them are published.
+ */
+void findStages(pipe_monitor &watched) {
+  for (int i = 0; i < watched.stages.size(); ++i) {
+    if (watched.stagePids[i] <= 0) return;
+  }
+  for (int i = 0; i < watched.stages.size(); ++i) {
+    watched.stages[i].pid = watched.stagePids[i];
+  }
+  watched.stagesFound = true;
+  watched.lastSample = monotonicSeconds();
+}
+
+/**
+  Starts monitoring a pipe launched by a pipe master.
+  @param monitor Reference to the run monitor.
+  @param master Process id of the pipe master.
+  @param pipeToWatch Reference to the pipe.
+  @param allJobs Reference to vector that contains all jobs.
+ */
+void watchPipe(run_monitor &monitor, pid_t master, pipe_desc &pipeToWatch,
+               vector <job_desc> &allJobs) {
+  if (pipeToWatch.stagePids == NULL) return;
+  pipe_monitor watched;
+  watched.name = pipeToWatch.name;
+  watched.stagePids = pipeToWatch.stagePids;
+  for (int i = 0; i < pipeToWatch.jobsIndexes.size(); ++i) {
+    stage_monitor stage;
+    stage.name = allJobs[pipeToWatch.jobsIndexes[i]].name;
+    watched.stages.push_back(stage);
+    // The child that saves a checkpoint sits between its stage and the next.
+    int whole = firstRunStage(pipeToWatch) + i;
+    if (whole < pipeToWatch.checkpointFiles.size() &&
+        !pipeToWatch.checkpointFiles[whole].empty()) {
+      stage.name = CHECKPOINT_STAGE;
+      watched.stages.push_back(stage);
+    }
+  }
+  if (!watched.stages.empty()) monitor.pipes[master] = watched;
+}
+
+/**
+  Samples the stages of a pipe: CPU and I/O rates since the previous sample,
+  bytes waiting between stages and whether each stage waits for its input
+  (the pipe before it is empty) or for its output (the pipe after it is
+  full).
+  @param master Process id of the pipe master.
+  @param watched Reference to the monitored pipe.
+ */
+void samplePipe(pid_t master, pipe_monitor &watched) {
+  double now = monotonicSeconds();
+  double elapsed = now - watched.lastSample;
+  watched.lastSample = now;
+  int stagesCount = watched.stages.size();
+  vector <char> states(stagesCount, 'Z');
+  vector <long long> capacities(stagesCount, 0);
+  for (int i = 0; i < stagesCount; ++i) {
+    stage_monitor &stage = watched.stages[i];
+    if (stage.exited) continue;
+    process_stat stat;
+    // Once reaped by the pipe master, its id may be given to anybody.
+    if (!readProcessStat(stage.pid, stat) || stat.state == 'Z' ||
+        stat.parent != master) {
+      stage.exited = true;
+      stage.cpuPercent = stage.readRate = stage.writeRate = 0;
+      continue;
+    }
+    states[i] = stat.state;
+    unsigned long long readBytes = stage.readBytes;
+    unsigned long long writtenBytes = stage.writtenBytes;
+    readProcessIO(stage.pid, readBytes, writtenBytes);
+    if (elapsed > 0 && stage.samples > 0) {
+      stage.cpuPercent = (stat.cpuTicks - stage.cpuTicks) * 100.0 /
+                         sysconf(_SC_CLK_TCK) / elapsed;
+      stage.readRate = (readBytes - stage.readBytes) / elapsed;
+      stage.writeRate = (writtenBytes - stage.writtenBytes) / elapsed;
+    }
+    stage.cpuTicks = stat.cpuTicks;
+    stage.readBytes = readBytes;
+    stage.writtenBytes = writtenBytes;
+    // The pipe between stages i - 1 and i is measured from its reader,
+    // which outlives the writer.
+    if (i > 0 && !measurePipe(stage.pid, STDIN_FILENO,
+                              watched.stages[i - 1].queued,
+                              capacities[i - 1])) {
+      watched.stages[i - 1].queued = -1;
+    }
+  }
+  for (int i = 0; i < stagesCount; ++i) {
+    stage_monitor &stage = watched.stages[i];
+    if (stage.exited) continue;
+    ++stage.samples;
+    // Only a sleeping stage can be waiting on a pipe, 'D' is disk I/O.
+    if (states[i] != 'S') continue;
+    if (i > 0 && watched.stages[i - 1].queued == 0) ++stage.blockedOnInput;
+    else if (i + 1 < stagesCount && stage.queued >= 0 &&
+             stage.queued + PIPE_BUF > capacities[i]) ++stage.blockedOnOutput;
+  }
+}
+
+/**
+  Formats a rate in bytes per second with a binary unit.
+  @param rate Rate in bytes per second.
+  @return The formatted rate, i.e. "12.5M".
+ */
+string formatRate(double rate) {
+  const char *units = "BKMGT";
+  int unit = 0;
+  while (rate >= 1024 && unit < 4) {
+    rate /= 1024;
+    ++unit;
+  }
+  char formatted[32];
+  snprintf(formatted, sizeof(formatted), "%.1f%c", rate, units[unit]);
+  return formatted;
+}
+
+/**
+  Computes a count as a percentage of the samples of a stage.
+  @param count Number of samples.
+  @param stage Reference to the stage.
+  @return Percentage, 0 if the stage has no samples.
+ */
+double samplesPercent(int count, stage_monitor &stage) {
+  return stage.samples > 0 ? count * 100.0 / stage.samples : 0;
+}
+
+/**
+  Prints the table with the last sample of every stage of every monitored
+  pipe.
+  @param monitor Reference to the run monitor.
+ */
+void printMonitor(run_monitor &monitor) {
+  printf("## Monitor %.1fs ##\n", monotonicSeconds() - monitor.startTime);
+  printf("%-12s %-16s %6s %8s %8s %7s %8s %8s\n", "pipe", "stage", "cpu%",
+         "read/s", "write/s", "queued", "in-wait", "out-wait");
+  map <pid_t, pipe_monitor>::iterator it;
+  for (it = monitor.pipes.begin(); it != monitor.pipes.end(); ++it) {
+    pipe_monitor &watched = it->second;
+    if (!watched.stagesFound) continue;
+    for (int i = 0; i < watched.stages.size(); ++i) {
+      stage_monitor &stage = watched.stages[i];
+      string name = toStr(i + 1) + " " + stage.name;
+      string queued = stage.queued >= 0 ? formatRate(stage.queued) : "-";
+      printf("%-12s %-16s %6.1f %8s %8s %7s %7.0f%% %7.0f%%\n",
+             watched.name.c_str(), name.c_str(), stage.cpuPercent,
+             formatRate(stage.readRate).c_str(),
+             formatRate(stage.writeRate).c_str(), queued.c_str(),
+             samplesPercent(stage.blockedOnInput, stage),
+             samplesPercent(stage.blockedOnOutput, stage));
+    }
+  }
+  fflush(stdout);
+}
+
+/**
+  Samples every stage of every monitored pipe and prints the table of stages
+  when it is due.
+  @param monitor Reference to the run monitor.
+ */
+void sampleMonitor(run_monitor &monitor) {
+  map <pid_t, pipe_monitor>::iterator it;
+  for (it = monitor.pipes.begin(); it != monitor.pipes.end(); ++it) {
+    pipe_monitor &watched = it->second;
+    if (!watched.stagesFound) findStages(watched);
+    if (watched.stagesFound) samplePipe(it->first, watched);
+  }
+  if (monotonicSeconds() - monitor.lastPrint >= MONITOR_PRINT_S) {
+    printMonitor(monitor);
+    monitor.lastPrint = monotonicSeconds();
+  }
+}
+
+/**
+  Prints the bottleneck of a finished pipe, the stage that was busy for the
+  largest share of its samples, and stops monitoring it.
+  @param out Stream to print to.
+  @param monitor Reference to the run monitor.
+  @param master Process id of the pipe master that finished.
+ */
+void reportBottleneck(FILE *out, run_monitor &monitor, pid_t master) {
+  map <pid_t, pipe_monitor>::iterator it = monitor.pipes.find(master);
+  if (it == monitor.pipes.end()) return;
+  pipe_monitor &watched = it->second;
+  int bottleneck = -1;
+  double bottleneckBusy = 0;
+  for (int i = 0; i < watched.stages.size(); ++i) {
+    stage_monitor &stage = watched.stages[i];
+    if (stage.samples == 0) continue;
+    double busy = 100 - samplesPercent(stage.blockedOnInput +
+                                       stage.blockedOnOutput, stage);
+    // Ties go to the stage that used more CPU.
+    if (bottleneck == -1 || busy > bottleneckBusy ||
+        (busy == bottleneckBusy &&
+         stage.cpuTicks > watched.stages[bottleneck].cpuTicks)) {
+      bottleneck = i;
+      bottleneckBusy = busy;
+    }
+  }
+  if (bottleneck != -1) {
+    stage_monitor &stage = watched.stages[bottleneck];
+    fprintf(out, "## %s bottleneck: stage %d (%s), busy %.0f%% (in-wait "
+            "%.0f%%, out-wait %.0f%%) ##\n", watched.name.c_str(),
+            bottleneck + 1, stage.name.c_str(), bottleneckBusy,
+            samplesPercent(stage.blockedOnInput, stage),
+            samplesPercent(stage.blockedOnOutput, stage));
+  }
+  monitor.pipes.erase(it);
+}
@@ -0,0 +1,103 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "jobdesc.h"
+
+/**
+  This structure stores what the monitor measured for a stage of a pipe: the
+  counters of the last sample, the rates computed from them and how many
+  samples found the stage waiting for its input or for room in its output.
+  */
+struct stage_monitor {
+  std::string name;
+  pid_t pid;
+  bool exited;
+  unsigned long long cpuTicks, readBytes, writtenBytes;
+  double cpuPercent, readRate, writeRate;
+  // Bytes waiting in the pipe that leaves the stage, -1 if unknown.
+  long long queued;
+  int samples, blockedOnInput, blockedOnOutput;
+  stage_monitor() : pid(0), exited(false), cpuTicks(0), readBytes(0),
+                    writtenBytes(0), cpuPercent(0), readRate(0),
+                    writeRate(0), queued(-1), samples(0), blockedOnInput(0),
+                    blockedOnOutput(0) {}
+};
+
+/**
+  This structure stores the stages of a running pipe, found in the process
+  ids its pipe master shares once they are started.
+  */
+struct pipe_monitor {
+  std::string name;
+  std::vector <stage_monitor> stages;
+  pid_t *stagePids;
+  bool stagesFound;
+  double lastSample;
+  pipe_monitor() : stagePids(NULL), stagesFound(false), lastSample(0) {}
+};
+
+/**
+  This structure stores the pipes being monitored, by pipe master process id.
+  */
+struct run_monitor {
+  std::map <pid_t, pipe_monitor> pipes;
+  double startTime, lastPrint;
+  run_monitor();
+};
+
+/**
+  Maps the memory where the pipe master of a monitored pipe leaves the
+  process ids of its stages.
+  @param pipeToRun Reference to the pipe, the mapping is stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool shareStagePids(pipe_desc &pipeToRun);
+
+/**
+  Leaves the process ids of a started pipeline for the monitor, each stage
+  followed by the child saving its checkpoint, if any. Called by the pipe
+  master, it does nothing if the pipe is not monitored.
+  @param pipeToRun Reference to the pipe.
+  @param handle Reference to the handle of its pipeline.
+ */
+void publishStagePids(pipe_desc &pipeToRun, const pipeline_handle &handle);
+
+/**
+  Unmaps the process ids of the stages of a pipe, if it has them.
+  @param pipeToRun Reference to the pipe.
+ */
+void releaseStagePids(pipe_desc &pipeToRun);
+
+/**
+  Starts monitoring a pipe launched by a pipe master.
+  @param monitor Reference to the run monitor.
+  @param master Process id of the pipe master.
+  @param pipeToWatch Reference to the pipe.
+  @param allJobs Reference to vector that contains all jobs.
+ */
+void watchPipe(run_monitor &monitor, pid_t master, pipe_desc &pipeToWatch,
+               std::vector <job_desc> &allJobs);
+
+/**
+  Samples every stage of every monitored pipe and prints the table of stages
+  when it is due.
+  @param monitor Reference to the run monitor.
+ */
+void sampleMonitor(run_monitor &monitor);
+
+/**
+  Prints the bottleneck of a finished pipe, the stage that was busy for the
+  largest share of its samples, and stops monitoring it.
+  @param out Stream to print to.
+  @param monitor Reference to the run monitor.
+  @param master Process id of the pipe master that finished.
+ */
+void reportBottleneck(FILE *out, run_monitor &monitor, pid_t master);
+
+#endif
@@ -0,0 +1,204 @@
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include "options.h"
+#include "placement.h"
+#include "cgroup.h"
+#include "history.h"
+#include "priority.h"
+#include "stream.h"
+#include "errors.h"
+#include "checkpoint.h"
+#include "ioengine.h"
+
+using namespace std;
+
+/**
+  Prints how runPipe should be called and which options it accepts.
+ */
+void printUsage() {
+  puts("Usage: ./runPipe <yml-file> [options]");
+  puts("       ./runPipe --worker <endpoint> [-j <slots>]");
+  puts("Options:");
+  puts("  -j, --jobs <n>           run at most n pipes at the same time,");
+  puts("                           longest expected first");
+  puts("  --history <file>         timings of previous runs (default");
+  puts("                           ./.runpipe_history with -j)");
+  puts("  --class-order <list>     order of priority classes in the ready");
+  puts("                           queue (default");
+  puts("                           interactive,normal,batch,idle)");
+  puts("  --placement <policy>     CPU placement of pipe stages: compact,");
+  puts("                           spread or none");
+  puts("  --cgroup <dir>           run each pipe in a child of this cgroup v2");
+  puts("  --memory-budget <size>   admit pipes while their memory fits (needs");
+  puts("                           --cgroup)");
+  puts("  --stream                 print output lines as they arrive,");
+  puts("                           prefixed by the pipe name");
+  puts("  --timestamps             prefix streamed lines with the time since");
+  puts("                           the start too");
+  puts("  --ordered                print outputs in YAML order, the first");
+  puts("                           unfinished pipe as it runs");
+  puts("  --ordered-buffer <size>  output the other pipes keep in memory");
+  puts("                           before spilling to disk (default 64M)");
+  puts("  --stderr-tail <size>     capture the error stream of each stage,");
+  puts("                           keeping its last bytes (default 16K)");
+  puts("  --stderr-dir <dir>       capture it and also save it whole in dir");
+  puts("  --report <file>          write a JSON report of the run");
+  puts("  --checkpoint-dir <dir>   where stages with Checkpoint save their");
+  puts("                           output (default ./checkpoints)");
+  puts("  --resume                 start pipes after their last completed");
+  puts("                           checkpoint");
+  puts("  --io-engine <engine>     how output is collected and relayed:");
+  puts("                           uring, epoll or blocking (default: the");
+  puts("                           first available)");
+  puts("  --io-stats               print the system calls and CPU time spent");
+  puts("                           per MB of output");
+  puts("  --monitor                show CPU, I/O and pipe waits of every");
+  puts("                           stage while pipes run");
+  puts("  --workers <list>         run pipes on these worker agents, a comma");
+  puts("                           separated list of unix:<path> or");
+  puts("                           <host>:<port> endpoints");
+  puts("  --worker <endpoint>      run as a worker agent with -j slots");
+  puts("                           (default: online CPUs)");
+}
+
+/**
+  Parses the command line arguments of runPipe, filling the given options. In
+  case they are wrong a usage message is printed.
+  @param argc Number of arguments of the program.
+  @param argv Command line arguments.
+  @param options Reference to run_options to be filled.
+  @return true if the arguments are correct, false otherwise.
+ */
+bool parseArgs(int argc, char **argv, run_options &options) {
+  options.fileName = NULL;
+  options.placement = PLACEMENT_NONE;
+  options.memoryBudget = 0;
+  options.maxPipes = 0;
+  options.monitor = false;
+  options.stream = options.timestamps = options.ordered = false;
+  options.orderedBuffer = DEFAULT_ORDERED_BUFFER;
+  options.errorTail = -1;
+  options.checkpointDir = DEFAULT_CHECKPOINT_DIR;
+  options.resume = false;
+  options.ioStats = false;
+  options.historyFile.clear();
+  parseClassOrder(DEFAULT_CLASS_ORDER, options.classOrder);
+  for (int i = 1; i < argc; ++i) {
+    // Options that take a value must have it in the next argument.
+    bool hasValue = i + 1 < argc;
+    if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) &&
+        hasValue) {
+      options.maxPipes = atoi(argv[++i]);
+      if (options.maxPipes <= 0) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--history") == 0 && hasValue) {
+      options.historyFile = argv[++i];
+    }
+    else if (strcmp(argv[i], "--class-order") == 0 && hasValue) {
+      if (!parseClassOrder(argv[++i], options.classOrder)) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--placement") == 0 && hasValue) {
+      options.placement = argv[++i];
+      if (!isPlacementPolicy(options.placement)) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--cgroup") == 0 && hasValue) {
+      options.cgroupRoot = argv[++i];
+    }
+    else if (strcmp(argv[i], "--memory-budget") == 0 && hasValue) {
+      if (!parseMemorySize(argv[++i], options.memoryBudget)) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--monitor") == 0) options.monitor = true;
+    else if (strcmp(argv[i], "--stream") == 0) options.stream = true;
+    else if (strcmp(argv[i], "--timestamps") == 0) options.timestamps = true;
+    else if (strcmp(argv[i], "--ordered") == 0) options.ordered = true;
+    else if (strcmp(argv[i], "--ordered-buffer") == 0 && hasValue) {
+      if (!parseMemorySize(argv[++i], options.orderedBuffer)) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--stderr-tail") == 0 && hasValue) {
+      if (!parseMemorySize(argv[++i], options.errorTail)) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--stderr-dir") == 0 && hasValue) {
+      options.errorDir = argv[++i];
+    }
+    else if (strcmp(argv[i], "--report") == 0 && hasValue) {
+      options.reportFile = argv[++i];
+    }
+    else if (strcmp(argv[i], "--checkpoint-dir") == 0 && hasValue) {
+      options.checkpointDir = argv[++i];
+    }
+    else if (strcmp(argv[i], "--resume") == 0) options.resume = true;
+    else if (strcmp(argv[i], "--io-engine") == 0 && hasValue) {
+      options.ioEngine = argv[++i];
+      if (!isIOEngine(options.ioEngine)) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--io-stats") == 0) options.ioStats = true;
+    else if (strcmp(argv[i], "--workers") == 0 && hasValue) {
+      if (!parseWorkerList(argv[++i], options.workers)) {
+        printUsage();
+        return false;
+      }
+    }
+    else if (strcmp(argv[i], "--worker") == 0 && hasValue) {
+      options.workerEndpoint = argv[++i];
+    }
+    else if (argv[i][0] != '-' && options.fileName == NULL) {
+      options.fileName = argv[i];
+    }
+    else {
+      printUsage();
+      return false;
+    }
+  }
+  // A worker only needs the slots it advertises.
+  if (!options.workerEndpoint.empty()) {
+    if (options.fileName != NULL || !options.workers.empty()) {
+      printUsage();
+      return false;
+    }
+    if (options.maxPipes == 0) options.maxPipes = sysconf(_SC_NPROCESSORS_ONLN);
+    return true;
+  }
+  if (!options.errorDir.empty() && options.errorTail < 0) {
+    options.errorTail = DEFAULT_ERROR_TAIL;
+  }
+  // Timings are only kept where they order the pipes or were asked for.
+  if (options.maxPipes > 0 && options.historyFile.empty()) {
+    options.historyFile = DEFAULT_HISTORY_FILE;
+  }
+  // The budget is measured through the cgroups of the pipes. Placement and
+  // cgroups belong to the hosts of the workers, not to the coordinator.
+  if (options.fileName == NULL ||
+      (options.memoryBudget > 0 && options.cgroupRoot.empty()) ||
+      (options.timestamps && !options.stream) ||
+      (options.ordered && options.stream) ||
+      (!options.workers.empty() && (options.placement != PLACEMENT_NONE ||
+                                    !options.cgroupRoot.empty()))) {
+    printUsage();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,60 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <string>
+#include <vector>
+#include "worker.h"
+
+/**
+  This structure stores the options given to runPipe in the command line.
+  */
+struct run_options {
+  char *fileName;
+  std::string placement, cgroupRoot;
+  // File with the timings of previous runs, empty when they are not kept.
+  std::string historyFile;
+  // Maximum number of pipes running at the same time, 0 means no limit.
+  int maxPipes;
+  // Order in which pipes of each priority class leave the ready queue.
+  std::vector <std::string> classOrder;
+  // Maximum memory that all running pipes may use, 0 means no budget.
+  long long memoryBudget;
+  // Endpoint to listen on when running as a worker agent, empty otherwise.
+  std::string workerEndpoint;
+  // Workers that run the pipes, empty to run them locally.
+  std::vector <worker_node> workers;
+  // Whether the stages of running pipes are sampled and shown.
+  bool monitor;
+  // Whether output lines are printed as they arrive, prefixed by the pipe
+  // name and, if 'timestamps' is set, the time since the start.
+  bool stream, timestamps;
+  // Whether outputs are printed whole in YAML order, the first unfinished
+  // one live, and how much output the others may keep in memory.
+  bool ordered;
+  long long orderedBuffer;
+  // Bytes of the error stream of each stage to keep, -1 to leave it on the
+  // terminal, and directory that receives it whole.
+  long long errorTail;
+  std::string errorDir;
+  // File where the JSON report of the run is written, empty for none.
+  std::string reportFile;
+  // Directory of the checkpoints and whether pipes resume from them.
+  std::string checkpointDir;
+  bool resume;
+  // I/O engine of the coordinator, empty for the best one available, and
+  // whether its system calls and CPU time are printed at the end.
+  std::string ioEngine;
+  bool ioStats;
+};
+
+/**
+  Parses the command line arguments of runPipe, filling the given options. In
+  case they are wrong a usage message is printed.
+  @param argc Number of arguments of the program.
+  @param argv Command line arguments.
+  @param options Reference to run_options to be filled.
+  @return true if the arguments are correct, false otherwise.
+ */
+bool parseArgs(int argc, char **argv, run_options &options);
+
+#endif
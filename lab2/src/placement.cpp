@@ -0,0 +1,343 @@
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "placement.h"
+
+using namespace std;
+
+const string PLACEMENT_NONE    = "none";
+const string PLACEMENT_COMPACT = "compact";
+const string PLACEMENT_SPREAD  = "spread";
+const string PLACEMENT_CPUS    = "cpus";
+
+const string CPU_SYSFS_DIR  = "/sys/devices/system/cpu/";
+const string NODE_SYSFS_DIR = "/sys/devices/system/node/";
+
+/**
+  Checks if the given name is a known placement policy.
+  @param policy Name of the policy.
+  @return true if the policy exists, false otherwise.
+ */
+bool isPlacementPolicy(const string &policy) {
+  return policy == PLACEMENT_NONE || policy == PLACEMENT_COMPACT ||
+         policy == PLACEMENT_SPREAD;
+}
+
+/**
+  Parses a CPU list as found in sysfs, i.e. "0-3,8,10-11".
+  @param list String with the list.
+  @return Vector with every CPU in the list.
+ */
+vector<int> parseCpuList(const string &list) {
+  vector<int> result;
+  stringstream splitter(list);
+  string range;
+  while (getline(splitter, range, ',')) {
+    if (range.empty()) continue;
+    size_t dash = range.find('-');
+    int first = atoi(range.substr(0, dash).c_str());
+    int last = (dash == string::npos) ? first :
+               atoi(range.substr(dash + 1).c_str());
+    for (int cpu = first; cpu <= last; ++cpu) result.push_back(cpu);
+  }
+  return result;
+}
+
+/**
+  Reads the first line of a file.
+  @param path Path of the file.
+  @param line Reference to string where the line will be stored.
+  @return true if the file could be read, false otherwise.
+ */
+bool readLine(const string &path, string &line) {
+  ifstream ifs(path.c_str());
+  if (!ifs.is_open()) return false;
+  return !getline(ifs, line).fail();
+}
+
+/**
+  Finds the CPUs that share the unified or data cache of the given level with
+  a CPU.
+  @param cpu CPU to look for.
+  @param level Cache level (2 or 3).
+  @return CPUs sharing that cache, or just the given CPU if the cache level
+          does not exist.
+ */
+vector<int> cacheSiblings(int cpu, int level) {
+  stringstream cacheDir;
+  cacheDir << CPU_SYSFS_DIR << "cpu" << cpu << "/cache/";
+  for (int index = 0; ; ++index) {
+    stringstream indexDir;
+    indexDir << cacheDir.str() << "index" << index << "/";
+    string value, type, shared;
+    if (!readLine(indexDir.str() + "level", value)) break;
+    readLine(indexDir.str() + "type", type);
+    if (atoi(value.c_str()) != level || type == "Instruction") continue;
+    if (readLine(indexDir.str() + "shared_cpu_list", shared)) {
+      return parseCpuList(shared);
+    }
+  }
+  return vector<int>(1, cpu);
+}
+
+/**
+  Keeps only the CPUs of 'group' that also appear in 'allowed'.
+  @param group CPUs to filter.
+  @param allowed Set of allowed CPUs.
+  @return Filtered CPUs.
+ */
+vector<int> filterAllowed(const vector<int> &group, const set<int> &allowed) {
+  vector<int> result;
+  for (int i = 0; i < group.size(); ++i) {
+    if (allowed.count(group[i])) result.push_back(group[i]);
+  }
+  return result;
+}
+
+/**
+  Takes one element of each group at a time until all groups are empty, so
+  that consecutive elements come from different groups.
+  @param groups Groups to interleave.
+  @return Interleaved elements.
+ */
+vector<int> interleave(const vector< vector<int> > &groups) {
+  vector<int> result;
+  for (int round = 0; ; ++round) {
+    bool taken = false;
+    for (int i = 0; i < groups.size(); ++i) {
+      if (round < groups[i].size()) {
+        result.push_back(groups[i][round]);
+        taken = true;
+      }
+    }
+    if (!taken) break;
+  }
+  return result;
+}
+
+/**
+  Groups a list of CPUs by the given key.
+  @param cpus CPUs to group.
+  @param keyOf Key of each CPU.
+  @return Groups in the order their keys first appear.
+ */
+vector< vector<int> > groupBy(const vector<int> &cpus,
+                              map<int, vector<int> > &keyOf) {
+  map<int, int> groupIndex;
+  vector< vector<int> > groups;
+  for (int i = 0; i < cpus.size(); ++i) {
+    // The first CPU of the domain identifies it.
+    int key = keyOf[cpus[i]].empty() ? cpus[i] : keyOf[cpus[i]][0];
+    if (!groupIndex.count(key)) {
+      groupIndex[key] = groups.size();
+      groups.push_back(vector<int>());
+    }
+    groups[groupIndex[key]].push_back(cpus[i]);
+  }
+  return groups;
+}
+
+/**
+  Builds the spread order of the topology: CPUs alternate between NUMA nodes
+  first, then between L3 domains and finally between cores, so that the
+  second hardware thread of a core is only used after every core got one.
+  @param topology Reference to the topology to fill.
+ */
+void buildSpreadOrder(cpu_topology &topology) {
+  map<int, vector<int> > byNode;
+  for (int i = 0; i < topology.cpus.size(); ++i) {
+    int cpu = topology.cpus[i];
+    byNode[topology.nodeOf[cpu]].push_back(cpu);
+  }
+  vector< vector<int> > nodeOrders;
+  for (map<int, vector<int> >::iterator it = byNode.begin();
+       it != byNode.end(); ++it) {
+    vector< vector<int> > l3Orders;
+    vector< vector<int> > l3Groups = groupBy(it->second, topology.l3Of);
+    for (int i = 0; i < l3Groups.size(); ++i) {
+      l3Orders.push_back(interleave(groupBy(l3Groups[i], topology.l2Of)));
+    }
+    nodeOrders.push_back(interleave(l3Orders));
+  }
+  topology.spreadOrder = interleave(nodeOrders);
+}
+
+/**
+  Reads the CPU topology from sysfs. CPUs that are not in the affinity mask of
+  runPipe are ignored.
+  @param topology Reference to cpu_topology to be filled.
+  @return true if the topology could be read, false otherwise.
+ */
+bool loadTopology(cpu_topology &topology) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  if (sched_getaffinity(0, sizeof(mask), &mask) == -1) return false;
+  set<int> allowed;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &mask)) {
+      allowed.insert(cpu);
+      topology.cpus.push_back(cpu);
+      topology.nodeOf[cpu] = 0;
+    }
+  }
+  topology.nodeCount = 1;
+  topology.spreadCursor = 0;
+
+  // Every nodeN directory lists the CPUs of that node.
+  DIR *nodes = opendir(NODE_SYSFS_DIR.c_str());
+  if (nodes != NULL) {
+    int nodeCount = 0;
+    struct dirent *entry;
+    while ((entry = readdir(nodes)) != NULL) {
+      string name = entry->d_name;
+      if (name.compare(0, 4, "node") != 0 || name.size() == 4) continue;
+      int node = atoi(name.substr(4).c_str());
+      string list;
+      if (!readLine(NODE_SYSFS_DIR + name + "/cpulist", list)) continue;
+      vector<int> nodeCpus = filterAllowed(parseCpuList(list), allowed);
+      if (nodeCpus.empty()) continue;
+      for (int i = 0; i < nodeCpus.size(); ++i) {
+        topology.nodeOf[nodeCpus[i]] = node;
+      }
+      ++nodeCount;
+    }
+    closedir(nodes);
+    if (nodeCount > 0) topology.nodeCount = nodeCount;
+  }
+
+  for (int i = 0; i < topology.cpus.size(); ++i) {
+    int cpu = topology.cpus[i];
+    topology.l2Of[cpu] = filterAllowed(cacheSiblings(cpu, 2), allowed);
+    topology.l3Of[cpu] = filterAllowed(cacheSiblings(cpu, 3), allowed);
+    topology.load[cpu] = 0;
+  }
+  buildSpreadOrder(topology);
+  return !topology.cpus.empty();
+}
+
+/**
+  Computes the NUMA node mask that covers the given CPUs. Memory is only bound
+  when the machine has several nodes and all of them fit in the mask,
+  otherwise the mask is 0.
+  @param cpus CPUs of the stage.
+  @param topology Reference to the topology.
+  @return Bit mask of the nodes of the given CPUs.
+ */
+unsigned long nodeMaskOf(const vector<int> &cpus, cpu_topology &topology) {
+  if (topology.nodeCount <= 1) return 0;
+  unsigned long mask = 0;
+  for (int i = 0; i < cpus.size(); ++i) {
+    int node = topology.nodeOf[cpus[i]];
+    // Nodes beyond the mask cannot be bound, memory is left unbound then.
+    if (node < 0 || node >= sizeof(mask) * CHAR_BIT) return 0;
+    mask |= 1UL << node;
+  }
+  return mask;
+}
+
+/**
+  Chooses the CPUs that a compact pipe will share: the least loaded cache
+  domain (L2, then L3, then NUMA node, then the whole machine) with at least as
+  many CPUs as the pipe has stages, so that adjacent stages hand data off
+  through a shared cache.
+  @param stages Number of stages in the pipe.
+  @param topology Reference to the topology.
+  @return CPUs of the chosen domain.
+ */
+vector<int> chooseCompactDomain(int stages, cpu_topology &topology) {
+  map<int, vector<int> > nodeCpus, nodeGroup, machineGroup;
+  for (int i = 0; i < topology.cpus.size(); ++i) {
+    int cpu = topology.cpus[i];
+    nodeCpus[topology.nodeOf[cpu]].push_back(cpu);
+  }
+  for (int i = 0; i < topology.cpus.size(); ++i) {
+    int cpu = topology.cpus[i];
+    nodeGroup[cpu] = nodeCpus[topology.nodeOf[cpu]];
+    machineGroup[cpu] = topology.cpus;
+  }
+  map<int, vector<int> > *levels[] = { &topology.l2Of, &topology.l3Of,
+                                       &nodeGroup, &machineGroup };
+  for (int level = 0; level < 4; ++level) {
+    vector< vector<int> > domains = groupBy(topology.cpus, *levels[level]);
+    int best = -1;
+    long bestLoad = 0, bestSize = 1;
+    for (int i = 0; i < domains.size(); ++i) {
+      if (domains[i].size() < stages && level != 3) continue;
+      long domainLoad = 0;
+      for (int j = 0; j < domains[i].size(); ++j) {
+        domainLoad += topology.load[domains[i][j]];
+      }
+      // Compare load per CPU without dividing.
+      if (best == -1 || domainLoad * bestSize < bestLoad * domains[i].size()) {
+        best = i;
+        bestLoad = domainLoad;
+        bestSize = domains[i].size();
+      }
+    }
+    if (best != -1) return domains[best];
+  }
+  return topology.cpus;
+}
+
+/**
+  Finds a CPU listed by a pipe that runPipe may not run on.
+  @param pipe Reference to the pipe.
+  @param topology Reference to the topology.
+  @return The first such CPU, or -1 if there is none or the topology could
+          not be read.
+ */
+int unavailableCpu(const pipe_desc &pipe, const cpu_topology &topology) {
+  for (int i = 0; i < pipe.cpus.size() && !topology.cpus.empty(); ++i) {
+    if (!binary_search(topology.cpus.begin(), topology.cpus.end(),
+                       pipe.cpus[i])) return pipe.cpus[i];
+  }
+  return -1;
+}
+
+/**
+  Decides on which CPUs each stage of a pipe will run, filling its
+  'stagePlacement' vector. The pipe policy wins over the global one.
+  @param pipe Reference to the pipe to place.
+  @param globalPolicy Policy used when the pipe does not specify one.
+  @param topology Reference to the topology, its load is updated.
+ */
+void planPlacement(pipe_desc &pipe, const string &globalPolicy,
+                   cpu_topology &topology) {
+  string policy = pipe.placement.empty() ? globalPolicy : pipe.placement;
+  int stages = pipe.jobsIndexes.size();
+  pipe.stagePlacement.assign(stages, stage_placement());
+  if (policy == PLACEMENT_NONE || topology.cpus.empty()) return;
+
+  vector<int> compactDomain;
+  if (policy == PLACEMENT_COMPACT) {
+    compactDomain = chooseCompactDomain(stages, topology);
+  }
+  for (int i = 0; i < stages; ++i) {
+    stage_placement &placement = pipe.stagePlacement[i];
+    if (policy == PLACEMENT_CPUS && !pipe.cpus.empty()) {
+      // Explicit lists assign one CPU per stage, wrapping around.
+      placement.cpus.push_back(pipe.cpus[i % pipe.cpus.size()]);
+    }
+    else if (policy == PLACEMENT_COMPACT) {
+      placement.cpus = compactDomain;
+    }
+    else if (policy == PLACEMENT_SPREAD) {
+      int next = topology.spreadCursor++ % topology.spreadOrder.size();
+      placement.cpus.push_back(topology.spreadOrder[next]);
+    }
+    placement.nodeMask = nodeMaskOf(placement.cpus, topology);
+    for (int j = 0; j < placement.cpus.size(); ++j) {
+      ++topology.load[placement.cpus[j]];
+    }
+  }
+}
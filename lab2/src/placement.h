@@ -0,0 +1,66 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "jobdesc.h"
+
+extern const std::string PLACEMENT_NONE;
+extern const std::string PLACEMENT_COMPACT;
+extern const std::string PLACEMENT_SPREAD;
+extern const std::string PLACEMENT_CPUS;
+
+/**
+  This structure stores the CPU topology of the machine as seen by runPipe,
+  together with how many stages were already placed on each CPU.
+  */
+struct cpu_topology {
+  // CPUs runPipe is allowed to run on, in ascending order.
+  std::vector<int> cpus;
+  // NUMA node of each CPU.
+  std::map<int, int> nodeOf;
+  // CPUs sharing the L2 and L3 caches with each CPU (including itself).
+  std::map<int, std::vector<int> > l2Of, l3Of;
+  // CPUs ordered so that consecutive ones are as far apart as possible.
+  std::vector<int> spreadOrder;
+  // Number of stages placed on each CPU.
+  std::map<int, int> load;
+  int nodeCount, spreadCursor;
+};
+
+/**
+  Checks if the given name is a known placement policy.
+  @param policy Name of the policy.
+  @return true if the policy exists, false otherwise.
+ */
+bool isPlacementPolicy(const std::string &policy);
+
+/**
+  Reads the CPU topology from sysfs. CPUs that are not in the affinity mask of
+  runPipe are ignored.
+  @param topology Reference to cpu_topology to be filled.
+  @return true if the topology could be read, false otherwise.
+ */
+bool loadTopology(cpu_topology &topology);
+
+/**
+  Finds a CPU listed by a pipe that runPipe may not run on.
+  @param pipe Reference to the pipe.
+  @param topology Reference to the topology.
+  @return The first such CPU, or -1 if there is none or the topology could
+          not be read.
+ */
+int unavailableCpu(const pipe_desc &pipe, const cpu_topology &topology);
+
+/**
+  Decides on which CPUs each stage of a pipe will run, filling its
+  'stagePlacement' vector. The pipe policy wins over the global one.
+  @param pipe Reference to the pipe to place.
+  @param globalPolicy Policy used when the pipe does not specify one.
+  @param topology Reference to the topology, its load is updated.
+ */
+void planPlacement(pipe_desc &pipe, const std::string &globalPolicy,
+                   cpu_topology &topology);
+
+#endif
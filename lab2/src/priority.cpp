@@ -0,0 +1,187 @@
+#include <sched.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "priority.h"
+
+using namespace std;
+
+const string CLASS_INTERACTIVE   = "interactive";
+const string CLASS_NORMAL        = "normal";
+const string CLASS_BATCH         = "batch";
+const string CLASS_IDLE          = "idle";
+const string DEFAULT_CLASS_ORDER = "interactive,normal,batch,idle";
+
+const string IO_REALTIME    = "realtime";
+const string IO_BEST_EFFORT = "best-effort";
+const string IO_IDLE        = "idle";
+
+// I/O priority constants from <linux/ioprio.h>, which glibc does not wrap.
+const int IOPRIO_CLASS_RT      = 1;
+const int IOPRIO_CLASS_BE      = 2;
+const int IOPRIO_CLASS_IDLE    = 3;
+const int IOPRIO_DEFAULT_LEVEL = 4;
+
+/**
+  Parses an integer, failing if there is anything else in the string.
+  @param text String to parse.
+  @param value Reference where the integer will be stored.
+  @return true if the string is an integer, false otherwise.
+ */
+bool parseInteger(const string &text, int &value) {
+  char *end;
+  value = strtol(text.c_str(), &end, 10);
+  return !text.empty() && *end == '\0';
+}
+
+/**
+  Parses the value of a 'Priority' field: either a class name (interactive,
+  normal, batch or idle) or a nice value between -20 and 19.
+  Interactive and normal pipes run with nice 0, batch ones with nice 10 and
+  SCHED_BATCH and idle ones with nice 19 and SCHED_IDLE. A nice value alone
+  belongs to the normal class.
+  @param value Value of the field.
+  @param destination Reference to the priority_desc to fill.
+  @return true if the value is valid, false otherwise.
+ */
+bool parsePriority(const string &value, priority_desc &destination) {
+  destination.hasNice = true;
+  destination.policy = SCHED_OTHER;
+  destination.priorityClass = value;
+  if (value == CLASS_INTERACTIVE || value == CLASS_NORMAL) {
+    destination.nice = 0;
+  }
+  else if (value == CLASS_BATCH) {
+    destination.nice = 10;
+    destination.policy = SCHED_BATCH;
+  }
+  else if (value == CLASS_IDLE) {
+    destination.nice = 19;
+    destination.policy = SCHED_IDLE;
+  }
+  else {
+    destination.priorityClass = CLASS_NORMAL;
+    if (!parseInteger(value, destination.nice)) return false;
+    return destination.nice >= -20 && destination.nice <= 19;
+  }
+  return true;
+}
+
+/**
+  Parses the value of an 'IOClass' field: realtime, best-effort or idle,
+  optionally followed by a level from 0 to 7, i.e. "best-effort:2".
+  @param value Value of the field.
+  @param destination Reference to the priority_desc to fill.
+  @return true if the value is valid, false otherwise.
+ */
+bool parseIOClass(const string &value, priority_desc &destination) {
+  size_t colon = value.find(':');
+  string ioClass = value.substr(0, colon);
+  destination.ioLevel = IOPRIO_DEFAULT_LEVEL;
+  if (colon != string::npos) {
+    if (!parseInteger(value.substr(colon + 1), destination.ioLevel) ||
+        destination.ioLevel < 0 || destination.ioLevel > 7) return false;
+  }
+  if (ioClass == IO_REALTIME) destination.ioClass = IOPRIO_CLASS_RT;
+  else if (ioClass == IO_BEST_EFFORT) destination.ioClass = IOPRIO_CLASS_BE;
+  else if (ioClass == IO_IDLE) {
+    // The idle class has no levels.
+    destination.ioClass = IOPRIO_CLASS_IDLE;
+    destination.ioLevel = 0;
+  }
+  else return false;
+  return true;
+}
+
+/**
+  Parses a comma separated list of classes giving the order in which pipes of
+  each class leave the ready queue.
+  @param list List of classes, i.e. "interactive,normal,batch,idle".
+  @param classOrder Reference to the vector to fill.
+  @return true if every class is known, false otherwise.
+ */
+bool parseClassOrder(const string &list, vector <string> &classOrder) {
+  classOrder.clear();
+  stringstream splitter(list);
+  string priorityClass;
+  while (getline(splitter, priorityClass, ',')) {
+    if (priorityClass != CLASS_INTERACTIVE && priorityClass != CLASS_NORMAL &&
+        priorityClass != CLASS_BATCH && priorityClass != CLASS_IDLE) {
+      return false;
+    }
+    classOrder.push_back(priorityClass);
+  }
+  return !classOrder.empty();
+}
+
+/**
+  Merges the priority of a job with the one of its pipe: each field the job
+  does not give is taken from the pipe.
+  @param job Priority of the job.
+  @param pipe Priority of the pipe.
+  @return Resulting priority.
+ */
+priority_desc mergePriority(const priority_desc &job,
+                            const priority_desc &pipe) {
+  priority_desc merged = job.hasNice ? job : pipe;
+  merged.ioClass = job.ioClass != 0 ? job.ioClass : pipe.ioClass;
+  merged.ioLevel = job.ioClass != 0 ? job.ioLevel : pipe.ioLevel;
+  return merged;
+}
+
+/**
+  Finds the position of a class in the class order. Classes left out of the
+  order go after all the others.
+  @param priorityClass Class to look for.
+  @param classOrder Order of the classes.
+  @return Rank of the class, lower leaves the queue first.
+ */
+int classRank(const string &priorityClass, const vector <string> &classOrder) {
+  vector <string>::const_iterator position =
+      find(classOrder.begin(), classOrder.end(), priorityClass);
+  return position - classOrder.begin();
+}
+
+/**
+  Computes the rank of every pipe in the ready queue from its class. A pipe
+  without a class of its own takes the most latency-sensitive class among its
+  jobs, or normal.
+  @param pipes Reference to the pipes, their 'classRank' is filled.
+  @param allJobs Reference to vector that contains all jobs.
+  @param classOrder Order of the classes, first leaves the queue first.
+ */
+void rankPipes(vector <pipe_desc> &pipes, vector <job_desc> &allJobs,
+               const vector <string> &classOrder) {
+  for (int i = 0; i < pipes.size(); ++i) {
+    pipe_desc &pipe = pipes[i];
+    if (pipe.priority.hasNice) {
+      pipe.classRank = classRank(pipe.priority.priorityClass, classOrder);
+      continue;
+    }
+    int best = -1;
+    for (int j = 0; j < pipe.jobsIndexes.size(); ++j) {
+      priority_desc &jobPriority = allJobs[pipe.jobsIndexes[j]].priority;
+      if (!jobPriority.hasNice) continue;
+      int rank = classRank(jobPriority.priorityClass, classOrder);
+      if (best == -1 || rank < best) best = rank;
+    }
+    pipe.classRank = best != -1 ? best : classRank(CLASS_NORMAL, classOrder);
+  }
+}
+
+/**
+  Compares two pipes by their class rank.
+ */
+bool lowerClassRank(const pipe_desc &a, const pipe_desc &b) {
+  return a.classRank < b.classRank;
+}
+
+/**
+  Sorts pipes by class rank, keeping the previous order inside a class.
+  @param pipes Reference to the pipes to sort.
+ */
+void sortByClass(vector <pipe_desc> &pipes) {
+  stable_sort(pipes.begin(), pipes.end(), lowerClassRank);
+}
@@ -0,0 +1,69 @@
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include <string>
+#include <vector>
+#include "jobdesc.h"
+
+extern const std::string CLASS_INTERACTIVE;
+extern const std::string CLASS_NORMAL;
+extern const std::string CLASS_BATCH;
+extern const std::string CLASS_IDLE;
+extern const std::string DEFAULT_CLASS_ORDER;
+
+/**
+  Parses the value of a 'Priority' field: either a class name (interactive,
+  normal, batch or idle) or a nice value between -20 and 19.
+  @param value Value of the field.
+  @param destination Reference to the priority_desc to fill.
+  @return true if the value is valid, false otherwise.
+ */
+bool parsePriority(const std::string &value, priority_desc &destination);
+
+/**
+  Parses the value of an 'IOClass' field: realtime, best-effort or idle,
+  optionally followed by a level from 0 to 7, i.e. "best-effort:2".
+  @param value Value of the field.
+  @param destination Reference to the priority_desc to fill.
+  @return true if the value is valid, false otherwise.
+ */
+bool parseIOClass(const std::string &value, priority_desc &destination);
+
+/**
+  Parses a comma separated list of classes giving the order in which pipes of
+  each class leave the ready queue.
+  @param list List of classes, i.e. "interactive,normal,batch,idle".
+  @param classOrder Reference to the vector to fill.
+  @return true if every class is known, false otherwise.
+ */
+bool parseClassOrder(const std::string &list,
+                     std::vector <std::string> &classOrder);
+
+/**
+  Merges the priority of a job with the one of its pipe: each field the job
+  does not give is taken from the pipe.
+  @param job Priority of the job.
+  @param pipe Priority of the pipe.
+  @return Resulting priority.
+ */
+priority_desc mergePriority(const priority_desc &job,
+                            const priority_desc &pipe);
+
+/**
+  Computes the rank of every pipe in the ready queue from its class. A pipe
+  without a class of its own takes the most latency-sensitive class among its
+  jobs, or normal.
+  @param pipes Reference to the pipes, their 'classRank' is filled.
+  @param allJobs Reference to vector that contains all jobs.
+  @param classOrder Order of the classes, first leaves the queue first.
+ */
+void rankPipes(std::vector <pipe_desc> &pipes, std::vector <job_desc> &allJobs,
+               const std::vector <std::string> &classOrder);
+
+/**
+  Sorts pipes by class rank, keeping the previous order inside a class.
+  @param pipes Reference to the pipes to sort.
+ */
+void sortByClass(std::vector <pipe_desc> &pipes);
+
+#endif
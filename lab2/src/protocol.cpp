@@ -0,0 +1,311 @@
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include "protocol.h"
+
+using namespace std;
+
+const string UNIX_PREFIX = "unix:";
+
+// Connections waiting to be accepted by a worker.
+const int LISTEN_BACKLOG = 64;
+// Most fields and bytes a message may hold, and most digits of a number in
+// its header, so that a bad header cannot make the receiver allocate
+// without limit.
+const size_t MAX_MESSAGE_FIELDS = 1 << 16;
+const size_t MAX_MESSAGE_BYTES = 64 << 20;
+const size_t MAX_NUMBER_DIGITS = 20;
+
+/**
+  Fills the address of a Unix socket endpoint.
+  @param endpoint Endpoint, starting with "unix:".
+  @param address Reference to the address to fill.
+  @return true if the path fits in the address, false otherwise.
+ */
+bool unixAddress(const string &endpoint, struct sockaddr_un &address) {
+  string path = endpoint.substr(UNIX_PREFIX.size());
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  strcpy(address.sun_path, path.c_str());
+  return true;
+}
+
+/**
+  Resolves a TCP endpoint "<host>:<port>". The host may not be left out.
+  @param endpoint Endpoint to resolve.
+  @param addresses Reference where the list of addresses will be stored, it
+                   must be released with freeaddrinfo.
+  @return On success, returns true. On error, returns false and errno is set.
+ */
+bool tcpAddresses(const string &endpoint, struct addrinfo *&addresses) {
+  size_t colon = endpoint.rfind(':');
+  if (colon == string::npos || colon == 0) {
+    errno = EINVAL;
+    return false;
+  }
+  string host = endpoint.substr(0, colon), port = endpoint.substr(colon + 1);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+    errno = EHOSTUNREACH;
+    return false;
+  }
+  return true;
+}
+
+/**
+  Tells if an address belongs to the loopback interface.
+  @param address Address to check.
+  @return true for 127.0.0.0/8 and ::1, false otherwise.
+ */
+bool isLoopback(const struct addrinfo *address) {
+  if (address->ai_family == AF_INET) {
+    const struct sockaddr_in *ipv4 =
+        (const struct sockaddr_in *) address->ai_addr;
+    return (ntohl(ipv4->sin_addr.s_addr) >> 24) == IN_LOOPBACKNET;
+  }
+  if (address->ai_family == AF_INET6) {
+    const struct sockaddr_in6 *ipv6 =
+        (const struct sockaddr_in6 *) address->ai_addr;
+    return IN6_IS_ADDR_LOOPBACK(&ipv6->sin6_addr);
+  }
+  return false;
+}
+
+/**
+  Creates a socket listening on an endpoint: "unix:<path>" for a Unix socket
+  or "<host>:<port>" for TCP. Whoever connects can run commands, so TCP
+  endpoints are only accepted on loopback addresses.
+  @param endpoint Endpoint to listen on.
+  @param fd Reference where the listening socket will be stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately, EADDRNOTAVAIL for an address other than loopback.
+ */
+bool listenEndpoint(const string &endpoint, int &fd) {
+  if (endpoint.compare(0, UNIX_PREFIX.size(), UNIX_PREFIX) == 0) {
+    struct sockaddr_un address;
+    if (!unixAddress(endpoint, address)) return false;
+    // A socket left by a previous worker would make bind fail.
+    unlink(address.sun_path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return false;
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) == -1 ||
+        listen(fd, LISTEN_BACKLOG) == -1) {
+      int error = errno;
+      close(fd);
+      errno = error;
+      return false;
+    }
+    return true;
+  }
+  struct addrinfo *addresses;
+  if (!tcpAddresses(endpoint, addresses)) return false;
+  fd = -1;
+  errno = EADDRNOTAVAIL;
+  for (struct addrinfo *it = addresses; it != NULL && fd == -1;
+       it = it->ai_next) {
+    if (!isLoopback(it)) continue;
+    fd = socket(it->ai_family, it->ai_socktype | SOCK_CLOEXEC,
+                it->ai_protocol);
+    if (fd == -1) continue;
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, it->ai_addr, it->ai_addrlen) == -1 ||
+        listen(fd, LISTEN_BACKLOG) == -1) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  int error = errno;
+  freeaddrinfo(addresses);
+  errno = error;
+  return fd != -1;
+}
+
+/**
+  Connects to an endpoint given as in listenEndpoint.
+  @param endpoint Endpoint to connect to.
+  @param fd Reference where the connected socket will be stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool connectEndpoint(const string &endpoint, int &fd) {
+  if (endpoint.compare(0, UNIX_PREFIX.size(), UNIX_PREFIX) == 0) {
+    struct sockaddr_un address;
+    if (!unixAddress(endpoint, address)) return false;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return false;
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == -1) {
+      int error = errno;
+      close(fd);
+      errno = error;
+      return false;
+    }
+    return true;
+  }
+  struct addrinfo *addresses;
+  if (!tcpAddresses(endpoint, addresses)) return false;
+  fd = -1;
+  for (struct addrinfo *it = addresses; it != NULL && fd == -1;
+       it = it->ai_next) {
+    fd = socket(it->ai_family, it->ai_socktype | SOCK_CLOEXEC,
+                it->ai_protocol);
+    if (fd == -1) continue;
+    if (connect(fd, it->ai_addr, it->ai_addrlen) == -1) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  int error = errno;
+  freeaddrinfo(addresses);
+  errno = error;
+  return fd != -1;
+}
+
+/**
+  Encodes a message: a list of fields, each one may hold any bytes. It is
+  encoded as "<field count>\n" followed by "<length>\n<bytes>" for every
+  field.
+  @param fields Fields of the message.
+  @return The encoded message.
+ */
+string encodeMessage(const vector <string> &fields) {
+  stringstream message;
+  message << fields.size() << '\n';
+  for (int i = 0; i < fields.size(); ++i) {
+    message << fields[i].size() << '\n' << fields[i];
+  }
+  return message.str();
+}
+
+/**
+  Writes a whole buffer to a descriptor.
+  @param fd Descriptor to write to.
+  @param data Bytes to write.
+  @return true if everything was written, false otherwise.
+ */
+bool writeAll(int fd, const string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t bytes = write(fd, data.data() + written, data.size() - written);
+    if (bytes == -1 && errno == EINTR) continue;
+    if (bytes <= 0) return false;
+    written += bytes;
+  }
+  return true;
+}
+
+/**
+  Sends a message encoded with encodeMessage.
+  @param fd Connected socket.
+  @param fields Fields of the message.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool sendMessage(int fd, const vector <string> &fields) {
+  string data = encodeMessage(fields);
+  size_t sent = 0;
+  while (sent < data.size()) {
+    // MSG_NOSIGNAL turns a closed peer into EPIPE instead of SIGPIPE, which
+    // would otherwise have to be ignored and would be inherited by the jobs.
+    ssize_t bytes = send(fd, data.data() + sent, data.size() - sent,
+                         MSG_NOSIGNAL);
+    if (bytes == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    sent += bytes;
+  }
+  return true;
+}
+
+/**
+  Reads from the connection until the buffer holds at least some bytes.
+  @param reader Reference to the reader of the connection.
+  @param bytes Number of bytes needed in the buffer.
+  @return true if they are available, false on error or end of file.
+ */
+bool fillBuffer(message_reader &reader, size_t bytes) {
+  char chunk[BUFSIZ];
+  while (reader.buffer.size() < bytes) {
+    ssize_t received = read(reader.fd, chunk, sizeof(chunk));
+    if (received == -1 && errno == EINTR) continue;
+    if (received <= 0) return false;
+    reader.buffer.append(chunk, received);
+  }
+  return true;
+}
+
+/**
+  Takes a number ended by a line break from the buffered connection.
+  @param reader Reference to the reader of the connection.
+  @param number Reference where the number will be stored.
+  @return true if a valid number was read, false otherwise.
+ */
+bool readNumber(message_reader &reader, size_t &number) {
+  size_t lineEnd;
+  while ((lineEnd = reader.buffer.find('\n')) == string::npos) {
+    if (reader.buffer.size() > MAX_NUMBER_DIGITS) {
+      errno = EMSGSIZE;
+      return false;
+    }
+    if (!fillBuffer(reader, reader.buffer.size() + 1)) return false;
+  }
+  if (lineEnd > MAX_NUMBER_DIGITS) {
+    errno = EMSGSIZE;
+    return false;
+  }
+  string line = reader.buffer.substr(0, lineEnd);
+  reader.buffer.erase(0, lineEnd + 1);
+  char *end;
+  number = strtoul(line.c_str(), &end, 10);
+  return !line.empty() && *end == '\0';
+}
+
+/**
+  Receives a message sent with sendMessage, blocking until it is complete.
+  Messages with more than MAX_MESSAGE_FIELDS fields or MAX_MESSAGE_BYTES
+  bytes are refused.
+  @param reader Reference to the reader of the connection.
+  @param fields Reference to the vector where the fields will be stored.
+  @return true if a whole message was received, false on error (EMSGSIZE
+          for a message too large) or if the connection was closed.
+ */
+bool receiveMessage(message_reader &reader, vector <string> &fields) {
+  fields.clear();
+  size_t count;
+  if (!readNumber(reader, count)) return false;
+  if (count > MAX_MESSAGE_FIELDS) {
+    errno = EMSGSIZE;
+    return false;
+  }
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size_t length;
+    if (!readNumber(reader, length)) return false;
+    if (length > MAX_MESSAGE_BYTES - total) {
+      errno = EMSGSIZE;
+      return false;
+    }
+    total += length;
+    if (!fillBuffer(reader, length)) return false;
+    fields.push_back(reader.buffer.substr(0, length));
+    reader.buffer.erase(0, length);
+  }
+  return true;
+}
@@ -0,0 +1,79 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+extern const std::string UNIX_PREFIX;
+extern const size_t MAX_MESSAGE_FIELDS;
+extern const size_t MAX_MESSAGE_BYTES;
+
+/**
+  This structure buffers what was read from a socket and not yet returned as
+  a message.
+  */
+struct message_reader {
+  int fd;
+  std::string buffer;
+  message_reader(int fd) : fd(fd) {}
+};
+
+/**
+  Creates a socket listening on an endpoint: "unix:<path>" for a Unix socket
+  or "<host>:<port>" for TCP. Whoever connects can run commands, so TCP
+  endpoints are only accepted on loopback addresses.
+  @param endpoint Endpoint to listen on.
+  @param fd Reference where the listening socket will be stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately, EADDRNOTAVAIL for an address other than loopback.
+ */
+bool listenEndpoint(const std::string &endpoint, int &fd);
+
+/**
+  Connects to an endpoint given as in listenEndpoint.
+  @param endpoint Endpoint to connect to.
+  @param fd Reference where the connected socket will be stored.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool connectEndpoint(const std::string &endpoint, int &fd);
+
+/**
+  Encodes a message: a list of fields, each one may hold any bytes. It is
+  encoded as "<field count>\n" followed by "<length>\n<bytes>" for every
+  field.
+  @param fields Fields of the message.
+  @return The encoded message.
+ */
+std::string encodeMessage(const std::vector <std::string> &fields);
+
+/**
+  Writes a whole buffer to a descriptor.
+  @param fd Descriptor to write to.
+  @param data Bytes to write.
+  @return true if everything was written, false otherwise.
+ */
+bool writeAll(int fd, const std::string &data);
+
+/**
+  Sends a message encoded with encodeMessage.
+  @param fd Connected socket.
+  @param fields Fields of the message.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool sendMessage(int fd, const std::vector <std::string> &fields);
+
+/**
+  Receives a message sent with sendMessage, blocking until it is complete.
+  Messages with more than MAX_MESSAGE_FIELDS fields or MAX_MESSAGE_BYTES
+  bytes are refused.
+  @param reader Reference to the reader of the connection.
+  @param fields Reference to the vector where the fields will be stored.
+  @return true if a whole message was received, false on error (EMSGSIZE
+          for a message too large) or if the connection was closed.
+ */
+bool receiveMessage(message_reader &reader, std::vector <std::string> &fields);
+
+#endif
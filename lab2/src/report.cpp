@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+#include "report.h"
+
+using namespace std;
+
+/**
+  Measures the UTF-8 sequence that starts at a position of a string.
+  @param text String to look at.
+  @param start Position of the first byte of the sequence.
+  @return Length of the sequence, 0 if it is not valid UTF-8 (a stray
+          continuation byte, a sequence cut short, an overlong form or a
+          surrogate).
+ */
+int utf8Length(const string &text, size_t start) {
+  unsigned char c = text[start];
+  if (c < 0x80) return 1;
+  // The lead byte gives the length and the highest bits of the character.
+  int length;
+  if ((c & 0xe0) == 0xc0) length = 2;
+  else if ((c & 0xf0) == 0xe0) length = 3;
+  else if ((c & 0xf8) == 0xf0) length = 4;
+  else return 0;
+  unsigned int codePoint = c & (0x7f >> length);
+  if (start + length > text.size()) return 0;
+  for (int i = 1; i < length; ++i) {
+    unsigned char next = text[start + i];
+    if ((next & 0xc0) != 0x80) return 0;
+    codePoint = (codePoint << 6) | (next & 0x3f);
+  }
+  const unsigned int smallest[] = {0, 0, 0x80, 0x800, 0x10000};
+  if (codePoint < smallest[length] || codePoint > 0x10ffff ||
+      (codePoint >= 0xd800 && codePoint <= 0xdfff)) return 0;
+  return length;
+}
+
+/**
+  Quotes a string as a JSON string. Valid UTF-8 other than control
+  characters, quotes and backslashes is copied as it is; invalid bytes, as
+  those of a character cut by the ring of an error tail, are written as
+  U+FFFD so that the report stays valid JSON.
+  @param text String to quote.
+  @return The quoted string.
+ */
+string jsonString(const string &text) {
+  string quoted = "\"";
+  for (size_t i = 0; i < text.size(); ++i) {
+    unsigned char c = text[i];
+    if (c >= 0x80) {
+      int length = utf8Length(text, i);
+      if (length == 0) quoted += "\\ufffd";
+      else {
+        quoted.append(text, i, length);
+        i += length - 1;
+      }
+    }
+    else if (c == '"') quoted += "\\\"";
+    else if (c == '\\') quoted += "\\\\";
+    else if (c == '\n') quoted += "\\n";
+    else if (c == '\t') quoted += "\\t";
+    else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    }
+    else quoted += c;
+  }
+  return quoted + "\"";
+}
+
+/**
+  Writes the JSON report of a run.
+  @param fileName Name of the report file.
+  @param pipes Reports of the pipes, in YAML order. Pipes that did not finish
+               are left out.
+  @param makespan Seconds from the first launch to the last pipe finishing.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool writeReport(const string &fileName, const vector <pipe_report> &pipes,
+                 double makespan) {
+  FILE *report = fopen(fileName.c_str(), "we");
+  if (report == NULL) return false;
+  fprintf(report, "{\n  \"makespan\": %.3f,\n  \"pipes\": [", makespan);
+  bool first = true;
+  for (int i = 0; i < pipes.size(); ++i) {
+    const pipe_report &finished = pipes[i];
+    if (!finished.finished) continue;
+    fprintf(report, "%s\n    {\"name\": %s, \"worker\": %s, \"success\": %s, "
+            "\"code\": %d, \"wall\": %.3f, ", first ? "" : ",",
+            jsonString(finished.name).c_str(),
+            jsonString(finished.worker).c_str(),
+            finished.success ? "true" : "false", finished.code,
+            finished.wallTime);
+    first = false;
+    // The wall time of a matrix is the one of its longest instance.
+    if (finished.instances > 0) {
+      fprintf(report, "\"matrix\": {\"instances\": %d, \"failed\": %d}, ",
+              finished.instances, finished.failedInstances);
+    }
+    fprintf(report, "\"stages\": [");
+    for (int j = 0; j < finished.errors.size(); ++j) {
+      const error_tail &stage = finished.errors[j];
+      fprintf(report, "%s\n      {\"name\": %s, \"stderrBytes\": %llu, "
+              "\"stderrTail\": %s}", j == 0 ? "" : ",",
+              jsonString(stage.name).c_str(), stage.total,
+              jsonString(stage.tail).c_str());
+    }
+    fprintf(report, "%s]}", finished.errors.empty() ? "" : "\n    ");
+  }
+  fprintf(report, "\n  ]\n}\n");
+  // Errors while writing show up when the file is closed.
+  bool written = !ferror(report);
+  int error = errno;
+  if (fclose(report) != 0) return false;
+  errno = error;
+  return written;
+}
@@ -0,0 +1,35 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <string>
+#include <vector>
+#include "errors.h"
+
+/**
+  This structure stores how a pipe finished, as written to the JSON report:
+  where it ran, its status, its wall time in seconds and the tails of the
+  error streams of its stages. A matrix also counts its instances.
+  */
+struct pipe_report {
+  std::string name, worker;
+  bool finished, success;
+  int code, instances, failedInstances;
+  double wallTime;
+  std::vector <error_tail> errors;
+  pipe_report() : finished(false), success(false), code(0), instances(0),
+                  failedInstances(0), wallTime(0) {}
+};
+
+/**
+  Writes the JSON report of a run.
+  @param fileName Name of the report file.
+  @param pipes Reports of the pipes, in YAML order. Pipes that did not finish
+               are left out.
+  @param makespan Seconds from the first launch to the last pipe finishing.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool writeReport(const std::string &fileName,
+                 const std::vector <pipe_report> &pipes, double makespan);
+
+#endif
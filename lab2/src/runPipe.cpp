@@ -3,6 +3,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <signal.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <cstring>
@@ -11,36 +13,51 @@
 #include <set>
 #include <map>
 #include <fstream>
+#include <deque>
 #include "jobdesc.h"
+#include "options.h"
+#include "placement.h"
+#include "cgroup.h"
+#include "history.h"
+#include "priority.h"
+#include "worker.h"
+#include "monitor.h"
+#include "stream.h"
+#include "errors.h"
+#include "report.h"
+#include "schedule.h"
+#include "matrix.h"
+#include "checkpoint.h"
+#include "ioengine.h"
+#include "endpoint.h"
 
 using namespace std;
 
 #define ERROR_OCURRED -1
 
-/**
-    Checks if the number of console arguments are correct. In case they are
-    wrong a message is printed.
-    @param argc Number of arguments of the program.
-    @return true if are correct, false otherwise.
- */
-bool checkArgs(int argc) {
- if (argc != 2) {
-    puts("Usage: ./runPipe <yml-file>");
-    return false;
-  }
-  return true;
-}
+// Time to wait between admission checks while pipes wait for memory or for a
+// free worker slot, and between samples of the monitor.
+const int ADMISSION_POLL_US = 100000;
+
+// Set when a resident runPipe is asked to stop scheduling runs.
+volatile sig_atomic_t stopRequested = 0;
+
+// Process group of the stages of the pipe run by a pipe master, -1 while
+// they have none.
+volatile sig_atomic_t stageGroup = ERROR_OCURRED;
 
 /**
     Loads a job description from a YAML file specified in parameters.
     @param destination Reference to job_desc structure to be filled.
     @param fileName Name of the YAML file.
+    @param jobMatrices Reference to the vector of job matrices to be filled.
     @return true if the given job_desc was filled successfully, false
             otherwhise.
  */
 bool loadFile(vector<job_desc> &jobs, vector<pipe_desc> &pipes,
-              char* fileName, set <int> &assignedJobs) {
-  if (!loadFromYAML(jobs, pipes, fileName, assignedJobs)) {
+              char* fileName, set <int> &assignedJobs,
+              vector <vector <matrix_dim> > &jobMatrices) {
+  if (!loadFromYAML(jobs, pipes, fileName, assignedJobs, jobMatrices)) {
     string errorMessage = "An error ocurred while trying to load and parse";
     errorMessage += " the specified YAML file";
     printf("%s\n", errorMessage.c_str());
@@ -52,94 +69,15 @@ bool loadFile(vector<job_desc> &jobs, vector<pipe_desc> &pipes,
 /**
     Prints a message with the result of the execution of a process. It can be
     either successful or not.
+    @param out Stream to print to.
     @param success true if is a success message, false otherwise.
     @param jobName Name of the executed job.
     @param code Response code given by the status or signal.
  */
-void printResult(bool success, string pipeName, int code) {
-  printf("## %s finished ", pipeName.c_str());
-  if (success) printf("successfully ##\n");
-  else printf("unsuccessfully (Err: %d) ##\n", code);
-}
-
-/**
-  Redirects the given stream file descriptor to a file using custom flags and
-  saving and returning a copy of the original stream.
-  @param descriptor Stream file descriptor to be redirected.
-  @param file Name of the file to place instead the stream.
-  @param flags Flags to be used while opening the file.
-  @return On success, a copy of the original file descriptor is returned. On
-          error, -1 is returned, and errno is set appropriately.
- */
-int redirectStreamToFile(int descriptor, const char *file, int flags) {
-  int originalDescriptor = dup(descriptor);
-  if (originalDescriptor == ERROR_OCURRED) return ERROR_OCURRED;
-  if (close(descriptor) == ERROR_OCURRED) return ERROR_OCURRED;
-  if (open(file, flags) == ERROR_OCURRED) return ERROR_OCURRED;
-  return originalDescriptor;
-}
-
-/**
-  Checks if a file descriptor is open. We say that a file descriptor is closed
-  if it is set to -1
-  @param fd File descriptor to check.
-  @return true if the file descriptor is different from -1, false otherwise.
- */
-bool isOpen(int fd) {
-  return fd != FD_CLOSED;
-}
-
-/**
-  Closes a file descriptor, seting it to -1.
-  @param fd Reference to file descriptor to close.
- */
-void closeFileDescriptor(int &fd) {
-  close(fd);
-  fd = FD_CLOSED;
-}
-
-/**
-  Takes 'pipeDescriptor' and duplicates it to 'fdToReplace' slot, then closes
-  the original 'pipeDescriptor'.
-  @param pipeDescriptor Descriptor to duplicate into 'fdToReplace' slot, then
-                        it is closed.
-  @param fdToReplace Descriptor to be replaced by 'pipeDescriptor'.
-  @return On success, returns true. On error, returns false and errno is set
-          appropriately.
- */
-bool setupPipeDescriptor(int pipeDescriptor, int fdToReplace) {
-  if (dup2(pipeDescriptor, fdToReplace) == ERROR_OCURRED) return false;
-  if (close(pipeDescriptor) == ERROR_OCURRED) return false;
-  return true;
-}
-
-/**
-  Receives a processes id and waits until it finishes.
-  @param child Reference to the child process id to wait.
-  @return true if child process exited successfully, false otherwise.
- */
-bool waitForChild(pid_t child) {
-  int status;
-  if (waitpid(child, &status, 0) == child) {
-    // WIFEXITED returns true if the child terminated normally.
-    if (WIFEXITED(status)) {
-      // WEXITSTATUS returns the exit status of the child.
-      int code = WEXITSTATUS(status);
-      if (code != EXIT_SUCCESS) {
-        errno = code;
-        return false;
-      }
-    }
-    // WIFSIGNALED returns true if the child process was terminated by a signal.
-    else if (WIFSIGNALED(status)) {
-      // Returns the number of the signal that caused the child process to
-      // terminate.
-      int signalCode = WTERMSIG(status);
-      errno = signalCode;
-      return false;
-    }
-  }
-  return true;
+void printResult(FILE *out, bool success, string pipeName, int code) {
+  fprintf(out, "## %s finished ", pipeName.c_str());
+  if (success) fprintf(out, "successfully ##\n");
+  else fprintf(out, "unsuccessfully (Err: %d) ##\n", code);
 }
 
 /**
@@ -148,17 +86,22 @@ bool waitForChild(pid_t child) {
   @param jobCount Total number of existing jobs.
   @param assignedJobs Set containing which jobs were previously assigned to any
                       other pipe.
+  @param jobMatrices Matrices of the jobs, added to the one of the pipe.
   @return A pipe description with DEFALUT_PIPE name ("default-pipe"), input and
           output as standard and a list of jobs that were not assigned to
           a pipe and should run in this default pipe.
  */
-pipe_desc buildDefaultPipe(int jobCount, set <int> &assignedJobs) {
+pipe_desc buildDefaultPipe(int jobCount, set <int> &assignedJobs,
+                           vector <vector <matrix_dim> > &jobMatrices) {
   pipe_desc defaultPipe;
   defaultPipe.name = DEFAULT_PIPE;
   defaultPipe.input = STD_IN;
   defaultPipe.output = STD_OUT;
   for (int i = 0; i < jobCount; ++i) {
-    if (assignedJobs.count(i) == 0) defaultPipe.jobsIndexes.push_back(i);
+    if (assignedJobs.count(i) == 0) {
+      defaultPipe.jobsIndexes.push_back(i);
+      mergeMatrix(defaultPipe.matrix, jobMatrices[i]);
+    }
   }
   return defaultPipe;
 }
@@ -199,172 +142,171 @@ void deleteTemporalFiles(vector<pipe_desc> &pipes) {
 }
 
 /**
-  Connects the process with a pipe for input and output if possible, and
-  executes the given job.
-  @param descriptor File descriptors table, contains as many descriptors as
-                    jobsCount - 1. Each descriptor has input and output slot.
-  @param jobPosition Position of the job in the pipe sequence.
-  @param jobsCount Total number of jobs in the pipe sequence.
-  @param job Job to be executed.
-  @return On success, returns true. On error, returns false and errno is set
-          appropriately.
+  Builds the stages of a pipe: each of its jobs with the pipe priority merged
+  in and the CPUs planned for its position.
+  @param pipeToRun Reference to the pipe.
+  @param allJobs Reference to vector that contains all jobs.
+  @return The stages, in pipe order.
  */
-bool executeProcess(int descriptor[][2], int jobPosition, int jobsCount,
-                     job_desc job) {
-  // Take input from previous pipe if possible.
-  // The current process needs to read from the previous pipe, not to write on
-  // it. That's why it closes the output slot and enables the input slot.
-  if (jobPosition > 0) {
-    closeFileDescriptor(descriptor[jobPosition - 1][STDOUT_FILENO]);
-    if (!setupPipeDescriptor(descriptor[jobPosition - 1][STDIN_FILENO],
-                             STDIN_FILENO)) return false;
-  }
-
-  // Write output to next pipe if possible.
-  int pipesCount = jobsCount - 1;
-  if (jobPosition != pipesCount) {
-    closeFileDescriptor(descriptor[jobPosition][STDIN_FILENO]);
-    if (!setupPipeDescriptor(descriptor[jobPosition][STDOUT_FILENO],
-                             STDOUT_FILENO)) return false;
-  }
-
-  // Array that contains: [job name, args..., NULL].
-  char *jobArgs [job.args.size() + 2];
-  jobArgs[0] = (char *) job.exec.c_str();
-  for (int i = 1; i <= job.args.size(); ++i) {
-    jobArgs[i] = (char *) job.args[i - 1].c_str();
-  }
-  // "The list of arguments must be terminated by a NULL pointer, and, since
-  // these are variadic functions, this pointer must be cast (char *) NULL."
-  jobArgs[job.args.size() + 1] = NULL;
-
-  if (execvp(jobArgs[0], jobArgs) == ERROR_OCURRED) return false;
-  else return true;
+vector <job_desc> buildStages(pipe_desc &pipeToRun,
+                              vector <job_desc> &allJobs) {
+  vector <job_desc> stages;
+  for (int i = 0; i < pipeToRun.jobsIndexes.size(); ++i) {
+    job_desc stage = allJobs[pipeToRun.jobsIndexes[i]];
+    // Instances of a matrix run their jobs with the variables bound.
+    stage.exec = substituteBindings(stage.exec, pipeToRun.bindings);
+    // A program named after a variable was not resolved, PATH is searched.
+    if (stage.exec != allJobs[pipeToRun.jobsIndexes[i]].exec) {
+      stage.execPath.clear();
+      stage.execFd = ERROR_OCURRED;
+    }
+    for (int j = 0; j < stage.args.size(); ++j) {
+      stage.args[j] = substituteBindings(stage.args[j], pipeToRun.bindings);
+    }
+    stage.priority = mergePriority(stage.priority, pipeToRun.priority);
+    stage.placement = pipeToRun.stagePlacement[i];
+    stages.push_back(stage);
+  }
+  return stages;
 }
 
 /**
-  Redirects the input and output streams for a given pipe if needed, does as
-  many forks as number of jobs in the pipe, executing them handling required
-  files descriptors and waiting until the last job in the pipe finishes its
-  execution.
+  Runs the jobs of a pipe connected one after the other, reading from the
+  pipe input and writing to its temporal file, and waits until the last job
+  finishes. When the pipe was placed on a worker, the worker runs the jobs
+  and the output is streamed back into the temporal file. Captured error
+  streams are read meanwhile and their tails left in the errors file.
   @param pipeToInit Description of the pipe to initialize.
   @param allJobs Reference to vector that contains all jobs (also those which
                  don't belong to the given pipe).
   @return true if initializing and running the pipe was successfully, false
-          otherwise.
+          otherwise and errno is set to the failure code.
  */
 bool initializePipe(pipe_desc pipeToInit, vector <job_desc> &allJobs) {
-  int originalInput, originalOutput;
-
-  // Redirect input if needed.
-  if (pipeToInit.input != STD_IN) {
-    originalInput = redirectStreamToFile(STDIN_FILENO, pipeToInit.input.c_str(),
-                                         O_RDWR);
-    if (originalInput == ERROR_OCURRED) return false;
-  }
-
-  // Always redirect output to temporal file.
-  originalOutput = redirectStreamToFile(STDOUT_FILENO,
-                                        pipeToInit.tempOutput.c_str(),
-                                        O_RDWR | O_CREAT);
-  if (originalOutput == ERROR_OCURRED) return false;
-
-  // Prepare jobs to execute.
-  int jobsCount = pipeToInit.jobsIndexes.size();
-  // If the pipe doesn't have any associated job so we're done.
-  if (jobsCount == 0) return true;
-
-  // Prepare n - 1 file descriptors, in each child we should close those that
-  // are not needed.
-  int pipesCount = jobsCount - 1;
-  int descriptor[pipesCount][2];
-
-  pid_t lastJob;
-  for (int i = 0; i < jobsCount; ++i) {
-    // If the current job is not the last one, create the pipe that follows it
-    if (i != jobsCount - 1) {
-      if (pipe(descriptor[i]) == ERROR_OCURRED) return false;
-    }
-    // We can close second previous pipe if it is valid because we won't use
-    // it anymore.
-    if (i - 2 >= 0) {
-      closeFileDescriptor(descriptor[i - 2][STDIN_FILENO]);
-      closeFileDescriptor(descriptor[i - 2][STDOUT_FILENO]);
-    }
-    pid_t currentChild;
-    int jobIndex;
-    job_desc currentJob;
-    switch (currentChild = fork()) {
-      case ERROR_OCURRED:
-        return false;
-      case 0:
-        jobIndex = pipeToInit.jobsIndexes[i];
-        currentJob = allJobs[jobIndex];
-        if (!executeProcess(descriptor, i, jobsCount, currentJob)) exit(errno);
-        else exit(EXIT_SUCCESS);
-        break;
-      default:
-        lastJob = currentChild;
-        break;
-    }
+  // Join the pipe cgroup first, so that every job forked below inherits it.
+  if (!pipeToInit.cgroup.empty() && !joinCgroup(pipeToInit.cgroup)) {
+    return false;
   }
 
-  // Ensure all file drescriptors are closed after all childs were executed.
-  for (int i = 0; i < pipesCount; ++i) {
-    if (isOpen(descriptor[i][STDIN_FILENO])) {
-      closeFileDescriptor(descriptor[i][STDIN_FILENO]);
-    }
-    if (isOpen(descriptor[i][STDOUT_FILENO])) {
-      closeFileDescriptor(descriptor[i][STDOUT_FILENO]);
-    }
+  vector <job_desc> stages = buildStages(pipeToInit, allJobs);
+  if (!pipeToInit.worker.empty()) return runRemotePipe(pipeToInit, stages);
+
+  // Output goes to the temporal file, it is printed once the pipe finishes,
+  // unless it is streamed or goes to an endpoint through its relay.
+  pipeline_io io;
+  io.input = pipeToInit.input;
+  if (pipeToInit.feedInput) io.inputData = &pipeToInit.inputData;
+  io.output = pipeToInit.tempOutput;
+  io.outputFd = pipeToInit.outputFd;
+  endpoint_relays relays;
+  if (!startEndpointRelays(pipeToInit, io, relays)) {
+    int error = errno;
+    closeRelayEnds(relays);
+    waitEndpointRelays(relays);
+    errno = error;
+    return false;
+  }
+  error_capture capture;
+  if (!openErrorCapture(capture, pipeToInit, stages, io)) return false;
+  if (!openCheckpoints(pipeToInit, io)) return false;
+  // The stages get a process group of their own, so that they are stopped
+  // as a whole, unless they read the terminal.
+  io.processGroup = io.inputData != NULL || io.inputFd != ERROR_OCURRED ||
+                    io.input != STD_IN || !isatty(STDIN_FILENO);
+  io.pipefail = pipeToInit.pipefail;
+  pipeline_handle handle;
+  // A stop signal waits until the group of the stages is known, or the pipe
+  // master would end leaving the stages started so far running.
+  sigset_t stopSignals, previousMask;
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT);
+  sigaddset(&stopSignals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &stopSignals, &previousMask);
+  bool started = startPipeline(stages, io, handle);
+  int startError = errno;
+  stageGroup = handle.groupId;
+  sigprocmask(SIG_SETMASK, &previousMask, NULL);
+  publishStagePids(pipeToInit, handle);
+  closeRelayEnds(relays);
+  closeErrorWriters(io);
+  drainErrors(capture, handle);
+  job_status status;
+  bool waited = waitPipeline(handle, status);
+  // The stages are reaped, their group id may be given to other processes.
+  stageGroup = ERROR_OCURRED;
+  bool relayed = waitEndpointRelays(relays);
+  int relayError = errno;
+  closeCheckpoints(pipeToInit, io, handle, waited && started);
+  if (!capture.stages.empty()) writeErrorTails(capture, pipeToInit.errorsFd);
+  if (!waited) return false;
+  if (!started) {
+    errno = startError;
+    return false;
+  }
+  // A stage usually fails because its relay did, which tells why.
+  if (!relayed) {
+    errno = relayError;
+    return false;
   }
-  return waitForChild(lastJob);
+  if (!status.success) {
+    errno = status.code;
+    return false;
+  }
+  return true;
 }
 
 /**
   Receives a pipe description which has already finished it's execution and
-  prints the output that it generated in the temporal file.
+  prints the output that it generated in the temporal file, through the I/O
+  engine of the coordinator. A last line without line break gets one. The
+  output of a pipe that writes to an endpoint was delivered by its relay.
   @param pipeToPrint Pipe to print it's output.
+  @param engine Reference to the I/O engine.
  */
-void printPipeResults(pipe_desc pipeToPrint) {
+void printPipeResults(pipe_desc pipeToPrint, io_engine &engine) {
   printf("## Output %s ##\n", pipeToPrint.name.c_str());
-  string temporalName = pipeToPrint.tempOutput;
-  // To read from temporal file, use an input file stream.
-  ifstream ifs;
-  ifs.open(temporalName.c_str());
-  // To write to a file if needed, use a output file stream.
-  ofstream ofs;
-  if (pipeToPrint.output != STD_OUT) ofs.open(pipeToPrint.output.c_str());
-  if (ifs.is_open()) {
-    string line;
-    // If we have to write in a file, do it.
-    if (ofs.is_open()) while (getline(ifs, line)) ofs << line << endl;
-    else while (getline(ifs, line)) printf("%s\n", line.c_str());
-    ifs.close();
-  }
-  if (ofs.is_open()) ofs.close();
+  if (pipeToPrint.outputEndpoint) return;
+  // The engine writes to the descriptor, what stdio holds goes first.
+  fflush(stdout);
+  int input = open(pipeToPrint.tempOutput.c_str(), O_RDONLY | O_CLOEXEC);
+  if (input == ERROR_OCURRED) return;
+  int output = STDOUT_FILENO;
+  if (pipeToPrint.output != STD_OUT) {
+    output = open(pipeToPrint.output.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+  char lastByte = '\n';
+  if (output != ERROR_OCURRED &&
+      relayFile(engine, input, output, lastByte) != ERROR_OCURRED &&
+      lastByte != '\n') {
+    ++engine.stats.syscalls;
+    write(output, "\n", 1);
+  }
+  close(input);
+  if (output != STDOUT_FILENO && output != ERROR_OCURRED) close(output);
+}
+
+/**
+  Handles SIGINT and SIGTERM in a pipe master. Its stages do not get the
+  signals sent to the group of the coordinator, so they are killed first,
+  then the pipe master ends as the signal asks.
+  @param signalNumber Signal received.
+ */
+void stopStages(int signalNumber) {
+  if (stageGroup != ERROR_OCURRED) killpg(stageGroup, SIGKILL);
+  signal(signalNumber, SIG_DFL);
+  raise(signalNumber);
 }
 
 /**
   Checks for the received exit status and prints a message according to it.
+  @param out Stream to print to.
   @param exitedPipeId Parent pipe process id to wait and analyze.
   @param pipeName Name of the pipe to print in messages.
  */
-void analyzeExitStatus(int status, string pipeName) {
-  // Returns true if the child terminated normally.
-  if (WIFEXITED(status)) {
-    // Returns the exit status of the child.
-    int code = WEXITSTATUS(status);
-    if (code != EXIT_SUCCESS) printResult(false, pipeName, code);
-    else printResult(true, pipeName, code);
-  }
-  // Returns true if the child process was terminated by a signal.
-  else if (WIFSIGNALED(status)) {
-    // Returns the number of the signal that caused the child process to
-    // terminate.
-    int signalCode = WTERMSIG(status);
-    printResult(false, pipeName, signalCode);
-  }
+void analyzeExitStatus(FILE *out, int status, string pipeName) {
+  job_status decoded = decodeStatus(status);
+  printResult(out, decoded.success, pipeName, decoded.code);
 }
 
 /**
@@ -375,11 +317,18 @@ void analyzeExitStatus(int status, string pipeName) {
  */
 pid_t forkAndCreatePipe(pipe_desc pipeToCreate, vector <job_desc> &allJobs) {
   pid_t child;
+  // Results printed so far and output spilled by --ordered must not stay in
+  // the buffers copied to the child, it would write them again when exiting.
+  fflush(NULL);
   switch (child = fork()) {
     case ERROR_OCURRED:
       // An error ocurred while trying to fork.
       return ERROR_OCURRED;
     case 0:
+      // Only the coordinator handles the stop signals, a pipe master ends
+      // with its stages.
+      signal(SIGINT, stopStages);
+      signal(SIGTERM, stopStages);
       if (!initializePipe(pipeToCreate, allJobs)) exit(errno);
       else exit(EXIT_SUCCESS);
     break;
@@ -387,9 +336,403 @@ pid_t forkAndCreatePipe(pipe_desc pipeToCreate, vector <job_desc> &allJobs) {
   return child;
 }
 
+/**
+  Sums the memory reserved by the running pipes, updating the highest usage
+  seen in the cgroup of each of them. A pipe reserves its MemoryMax, or what
+  its cgroup currently uses if that is more: a pipe forked a moment ago uses
+  almost nothing yet, and counting only its usage would admit every ready
+  pipe at once.
+  @param pidToPipe Reference to the map of running pipes.
+  @return Memory reserved by all running pipes in bytes.
+ */
+long long runningMemory(map <pid_t, pipe_desc> &pidToPipe) {
+  long long total = 0;
+  for (map <pid_t, pipe_desc>::iterator it = pidToPipe.begin();
+       it != pidToPipe.end(); ++it) {
+    pipe_desc &runningPipe = it->second;
+    long long reserved = runningPipe.memoryMax;
+    long long current = MEMORY_UNKNOWN;
+    if (!runningPipe.cgroup.empty()) {
+      current = readCgroupMemory(runningPipe.cgroup, "memory.current");
+    }
+    if (current > reserved) reserved = current;
+    if (current > runningPipe.peakMemory) runningPipe.peakMemory = current;
+    total += reserved;
+  }
+  return total;
+}
+
+/**
+  Asks every worker again for its slots, keeping the last known counts of
+  those that do not answer.
+  @param workers Reference to the workers.
+ */
+void refreshWorkers(vector <worker_node> &workers) {
+  for (int i = 0; i < workers.size(); ++i) {
+    worker_node refreshed = workers[i];
+    if (queryWorker(refreshed)) workers[i] = refreshed;
+  }
+}
+
+/**
+  Decides if a pipe can start now. Pipes never exceed the maximum number of
+  running pipes, and with workers one of them must have a free slot. Without
+  a memory budget every other pipe is admitted, with one the pipe is admitted
+  while the memory reserved by the running pipes plus its own MemoryMax (if
+  any) fits in the budget. A pipe is always admitted when nothing else runs,
+  so that it cannot wait forever.
+  @param nextPipe Reference to the pipe that wants to start.
+  @param pidToPipe Reference to the map of running pipes.
+  @param options Reference to the command line options.
+  @return true if the pipe can start, false otherwise.
+ */
+bool canAdmit(pipe_desc &nextPipe, map <pid_t, pipe_desc> &pidToPipe,
+              run_options &options) {
+  if (options.maxPipes > 0 && pidToPipe.size() >= options.maxPipes) {
+    return false;
+  }
+  if (!options.workers.empty() && chooseWorker(options.workers) == -1) {
+    // The counts may be stale, pipes of other coordinators may have ended.
+    refreshWorkers(options.workers);
+    if (chooseWorker(options.workers) == -1) return false;
+  }
+  if (options.memoryBudget == 0 || pidToPipe.empty()) return true;
+  long long used = runningMemory(pidToPipe);
+  return used + nextPipe.memoryMax <= options.memoryBudget;
+}
+
+/**
+  Resolves the programs of some jobs, so that their stages are executed
+  without searching PATH in every child. Programs named after matrix
+  variables are left to each instance.
+  @param jobsIndexes Reference to the indexes of the jobs to resolve.
+  @param allJobs Reference to vector that contains all jobs.
+  @param programs Reference to the cache of resolved programs.
+  @param report Whether programs that cannot be executed are printed.
+  @return true if every program was resolved, false otherwise.
+ */
+bool resolvePrograms(const vector <int> &jobsIndexes,
+                     vector <job_desc> &allJobs, exec_cache &programs,
+                     bool report) {
+  bool resolved = true;
+  for (int i = 0; i < jobsIndexes.size(); ++i) {
+    job_desc &job = allJobs[jobsIndexes[i]];
+    if (job.exec.find('{') != string::npos) continue;
+    if (resolveExec(programs, job)) continue;
+    resolved = false;
+    if (report) {
+      printf("Job %s cannot run %s: %s\n", job.name.c_str(),
+             job.exec.c_str(), strerror(errno));
+    }
+  }
+  return resolved;
+}
+
+/**
+  Runs a job capturing its whole output in memory.
+  @param job Reference to the job.
+  @param output Reference to the string filled with the output.
+  @return On success, returns true. On error, returns false and errno is set
+          to the failure code.
+ */
+bool captureJob(const job_desc &job, string &output) {
+  pipeline_io io;
+  io.captureOutput = true;
+  pipeline_handle handle;
+  bool started = startPipeline(vector <job_desc>(1, job), io, handle);
+  int startError = errno;
+  char buffer[BUFSIZ];
+  ssize_t bytes;
+  while (handle.outputFd != ERROR_OCURRED &&
+         ((bytes = read(handle.outputFd, buffer, sizeof(buffer))) > 0 ||
+          (bytes == ERROR_OCURRED && errno == EINTR))) {
+    if (bytes > 0) output.append(buffer, bytes);
+  }
+  if (handle.outputFd != ERROR_OCURRED) close(handle.outputFd);
+  job_status status;
+  bool waited = waitPipeline(handle, status);
+  if (!started) {
+    errno = startError;
+    return false;
+  }
+  if (!waited) return false;
+  if (!status.success) {
+    errno = status.code;
+    return false;
+  }
+  return true;
+}
+
+/**
+  Runs the jobs given as InputFrom, once each, before any pipe starts, and
+  keeps their output as the input data of the pipes that name them.
+  @param pipes Reference to the pipes.
+  @param allJobs Reference to vector that contains all jobs.
+  @return true if every job succeeded, false otherwise.
+ */
+bool generateInputs(vector <pipe_desc> &pipes, vector <job_desc> &allJobs) {
+  map <int, string> generated;
+  for (int i = 0; i < pipes.size(); ++i) {
+    int job = pipes[i].inputFrom;
+    if (job == ERROR_OCURRED) continue;
+    if (generated.count(job) == 0 &&
+        !captureJob(allJobs[job], generated[job])) {
+      printf("Job %s could not generate the input of %s (Err: %d)\n",
+             allJobs[job].name.c_str(), pipes[i].name.c_str(), errno);
+      return false;
+    }
+    pipes[i].inputData = generated[job];
+  }
+  return true;
+}
+
+/**
+  Starts a pipe, first creating its cgroup when a delegated subtree was given.
+  Programs of local pipes are checked again, a replaced one is reopened.
+  @param pipeToLaunch Reference to the pipe to start, its cgroup is stored.
+  @param allJobs Reference to vector that contains all jobs.
+  @param programs Reference to the cache of resolved programs.
+  @param options Reference to the command line options.
+  @param launchIndex Number of pipes launched before this one.
+  @param mux Reference to the output multiplexer, used with --stream and
+             --ordered.
+  @return The process id of the pipe master. On error, -1 is returned and
+          errno is set appropriately.
+ */
+pid_t launchPipe(pipe_desc &pipeToLaunch, vector <job_desc> &allJobs,
+                 exec_cache &programs, run_options &options, int launchIndex,
+                 output_mux &mux) {
+  if (!options.cgroupRoot.empty()) {
+    string name = "runpipe-" + toStr(getpid()) + "-" + toStr(launchIndex);
+    if (!createCgroup(options.cgroupRoot, name, pipeToLaunch.memoryMax,
+                      pipeToLaunch.cgroup)) return ERROR_OCURRED;
+  }
+  // Pipes reading or writing an endpoint run here, next to it.
+  pipeToLaunch.inputEndpoint = isEndpoint(pipeToLaunch.input);
+  pipeToLaunch.outputEndpoint = isEndpoint(pipeToLaunch.output);
+  bool endpoints = pipeToLaunch.inputEndpoint || pipeToLaunch.outputEndpoint;
+  if (!options.workers.empty() && !endpoints) {
+    worker_node &worker = options.workers[chooseWorker(options.workers)];
+    pipeToLaunch.worker = worker.endpoint;
+    ++worker.busy;
+    ++worker.assigned;
+  }
+  // Programs may have been replaced since the previous launch.
+  if (pipeToLaunch.worker.empty()) {
+    resolvePrograms(pipeToLaunch.jobsIndexes, allJobs, programs, false);
+  }
+  // Checkpoints are saved by local pipes only, those of a worker would be
+  // left on its host.
+  if (pipeToLaunch.worker.empty() && !pipeToLaunch.checkpoints.empty()) {
+    vector <job_desc> stages = buildStages(pipeToLaunch, allJobs);
+    if (nameCheckpoints(pipeToLaunch, stages, options.checkpointDir)) {
+      if (mkdir(options.checkpointDir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP |
+                S_IROTH | S_IXOTH) == ERROR_OCURRED && errno != EEXIST) {
+        return ERROR_OCURRED;
+      }
+      if (options.resume) resumeFromCheckpoint(pipeToLaunch);
+    }
+  }
+  if (options.errorTail >= 0) {
+    pipeToLaunch.errorTail = options.errorTail;
+    pipeToLaunch.errorDir = options.errorDir;
+    if (!createErrorsFile(pipeToLaunch.errorsFd)) return ERROR_OCURRED;
+  }
+  // Streamed output goes through a pipe read by the coordinator, or straight
+  // to the output file of the pipe.
+  int streamFds[2];
+  bool streamOutput = options.stream || options.ordered;
+  bool streamed = streamOutput && pipeToLaunch.output == STD_OUT;
+  if (streamOutput && !streamed && !pipeToLaunch.outputEndpoint) {
+    pipeToLaunch.tempOutput = pipeToLaunch.output;
+  }
+  if (streamed) {
+    if (pipe2(streamFds, O_CLOEXEC) == ERROR_OCURRED) return ERROR_OCURRED;
+    pipeToLaunch.outputFd = streamFds[1];
+  }
+  if (endpoints && !createEndpointStats(pipeToLaunch)) return ERROR_OCURRED;
+  // The stages of local pipes are monitored by the process ids their pipe
+  // master leaves.
+  if (options.monitor && pipeToLaunch.worker.empty() &&
+      !shareStagePids(pipeToLaunch)) {
+    releaseEndpointStats(pipeToLaunch);
+    return ERROR_OCURRED;
+  }
+  pipeToLaunch.startTime = monotonicSeconds();
+  pid_t child = forkAndCreatePipe(pipeToLaunch, allJobs);
+  if (child == ERROR_OCURRED) {
+    releaseEndpointStats(pipeToLaunch);
+    releaseStagePids(pipeToLaunch);
+  }
+  if (streamed) {
+    int error = errno;
+    close(streamFds[1]);
+    if (child > 0) {
+      addStream(mux, child, pipeToLaunch.name, streamFds[0],
+                pipeToLaunch.order);
+    }
+    else close(streamFds[0]);
+    errno = error;
+  }
+  return child;
+}
+
+/**
+  Gives back the slot a finished pipe was using on its worker.
+  @param finishedPipe Reference to the pipe that finished.
+  @param workers Reference to the workers.
+ */
+void releaseWorker(pipe_desc &finishedPipe, vector <worker_node> &workers) {
+  for (int i = 0; i < workers.size(); ++i) {
+    if (workers[i].endpoint == finishedPipe.worker) {
+      --workers[i].busy;
+      --workers[i].assigned;
+    }
+  }
+}
+
+/**
+  Asks every worker for its free slots, leaving out those that cannot be
+  reached.
+  @param workers Reference to the workers.
+  @return true if at least one worker is reachable, false otherwise.
+ */
+bool queryWorkers(vector <worker_node> &workers) {
+  vector <worker_node> reachable;
+  for (int i = 0; i < workers.size(); ++i) {
+    if (queryWorker(workers[i])) reachable.push_back(workers[i]);
+    else printf("## Worker %s is not reachable (Err: %d) ##\n",
+                workers[i].endpoint.c_str(), errno);
+  }
+  workers = reachable;
+  return !workers.empty();
+}
+
+/**
+  Prints the highest memory usage of a finished pipe, as accounted by its
+  cgroup. If the kernel does not provide memory.peak, the highest usage seen
+  while polling is used instead.
+  @param out Stream to print to.
+  @param finishedPipe Reference to the pipe that finished.
+ */
+void printPeakMemory(FILE *out, pipe_desc &finishedPipe) {
+  long long peak = readCgroupMemory(finishedPipe.cgroup, "memory.peak");
+  if (peak == MEMORY_UNKNOWN) peak = finishedPipe.peakMemory;
+  if (peak == MEMORY_UNKNOWN) return;
+  fprintf(out, "## %s peak memory: %lld KiB ##\n",
+          finishedPipe.name.c_str(), peak >> 10);
+}
+
+/**
+  Opens the stream where the result of a finished pipe is printed: the
+  standard output or, with --ordered, a buffer that ends the pipe section.
+  @param options Reference to the command line options.
+  @param text Reference where the buffer will be stored.
+  @param size Reference where the size of the buffer will be stored.
+  @return The stream to print the result to.
+ */
+FILE *openReport(run_options &options, char *&text, size_t &size) {
+  text = NULL;
+  if (!options.ordered) return stdout;
+  FILE *report = open_memstream(&text, &size);
+  // If no buffer can be had, the result is printed right away.
+  return report == NULL ? stdout : report;
+}
+
+/**
+  Closes the stream where the result of a finished pipe was printed. With
+  --ordered, the result ends the pipe section.
+  @param report Stream returned by openReport.
+  @param text Buffer filled by the stream.
+  @param finishedPipe Reference to the pipe that finished.
+  @param mux Reference to the output multiplexer.
+ */
+void closeReport(FILE *report, char *&text, pipe_desc &finishedPipe,
+                 output_mux &mux) {
+  if (report != stdout) fclose(report);
+  if (mux.ordered) {
+    finishSection(mux, finishedPipe.order, text == NULL ? "" : text);
+  }
+  free(text);
+}
+
+/**
+  Handles SIGINT and SIGTERM in a resident runPipe: no more runs are
+  scheduled, and it exits once the running pipes finish.
+ */
+void requestStop(int) {
+  stopRequested = 1;
+}
+
+/**
+  Makes SIGINT and SIGTERM stop the schedules instead of the coordinator.
+ */
+void handleStopSignals() {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = requestStop;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+}
+
+/**
+  Fills the report of a finished pipe, reading the tails of its error streams
+  from its errors file.
+  @param destination Reference to the pipe_report to fill.
+  @param finishedPipe Reference to the pipe that finished, its errors file is
+                      closed.
+  @param status How the pipe finished.
+ */
+void fillReport(pipe_report &destination, pipe_desc &finishedPipe,
+                const job_status &status) {
+  destination.name = finishedPipe.name;
+  destination.worker = finishedPipe.worker;
+  destination.finished = true;
+  destination.success = status.success;
+  destination.code = status.code;
+  destination.wallTime = monotonicSeconds() - finishedPipe.startTime;
+  if (finishedPipe.errorsFd != ERROR_OCURRED) {
+    readErrorTails(finishedPipe.errorsFd, destination.errors);
+    close(finishedPipe.errorsFd);
+  }
+}
+
+/**
+  Adds how an instance of a matrix finished to the report of the matrix. The
+  matrix succeeds if all its instances do, it keeps the code and the error
+  tails of its first failed instance and the longest wall time.
+  @param destination Reference to the pipe_report of the matrix.
+  @param matrixPipe Reference to the matrix pipe.
+  @param instance Report of the finished instance.
+ */
+void addInstance(pipe_report &destination, pipe_desc &matrixPipe,
+                 const pipe_report &instance) {
+  destination.name = matrixPipe.name;
+  destination.worker = "";
+  destination.finished = true;
+  ++destination.instances;
+  if (!instance.success && destination.failedInstances++ == 0) {
+    destination.code = instance.code;
+    destination.errors = instance.errors;
+  }
+  destination.success = destination.failedInstances == 0;
+  if (instance.wallTime > destination.wallTime) {
+    destination.wallTime = instance.wallTime;
+  }
+}
+
 int
 main(int argc, char **argv) {
-  if (!checkArgs(argc)) return 0;
+  // Contains the options given in the command line.
+  run_options options;
+  if (!parseArgs(argc, argv, options)) return 0;
+  if (!options.workerEndpoint.empty()) {
+    runWorker(options.workerEndpoint, options.maxPipes, options.errorDir);
+    printf("Could not listen on %s: %s\n", options.workerEndpoint.c_str(),
+           strerror(errno));
+    return 0;
+  }
 
   // Contains all jobs data read and parsed from YAML file.
   vector <job_desc> jobs;
@@ -397,53 +740,290 @@ main(int argc, char **argv) {
   vector <pipe_desc> pipes;
   // Contains all jobs indexes that were assigned to a pipe.
   set <int> assignedJobs;
+  // Contains the matrix of each job, added to the pipes that run it.
+  vector <vector <matrix_dim> > jobMatrices;
   // Loads data into jobs, pipes and assignedJobs from the YAML file specified
   // in arguments.
-  if (!loadFile(jobs, pipes, argv[1], assignedJobs)) return 0;
+  if (!loadFile(jobs, pipes, options.fileName, assignedJobs, jobMatrices)) {
+    return 0;
+  }
+  // Take all jobs that were not executed in any pipe and run them in a default
+  // pipe after the others.
+  pipe_desc defaultPipe = buildDefaultPipe(jobs.size(), assignedJobs,
+                                           jobMatrices);
+  defaultPipe.tempOutput = TEMP_DIR + DEFAULT_PIPE + TEMP_EXT;
+  // Repeating pipes keep runPipe resident. Their runs, and the instances of
+  // matrices, have no single place in an ordered output.
+  bool resident = false, expanded = !defaultPipe.matrix.empty();
+  for (int i = 0; i < pipes.size(); ++i) {
+    resident |= pipes[i].every > 0;
+    expanded |= !pipes[i].matrix.empty();
+  }
+  if ((resident || expanded) && options.ordered) {
+    printf("Pipes with Every or Matrix cannot be combined with --ordered\n");
+    return 0;
+  }
 
-  // Create temporal files that will be used by each pipe.
-  createTemporalFiles(pipes);
+  // Programs are found once, before any pipe starts, and then executed by
+  // descriptor. Workers find them on their own hosts.
+  exec_cache programs;
+  if (options.workers.empty()) {
+    vector <int> jobsIndexes;
+    for (int i = 0; i < jobs.size(); ++i) jobsIndexes.push_back(i);
+    if (!resolvePrograms(jobsIndexes, jobs, programs, true)) return 0;
+  }
+  if (!generateInputs(pipes, jobs)) return 0;
 
-  // Map from process id to pipe. Used to get the pipe that finished in the
-  // wait function.
-  map <pid_t, pipe_desc> pidToPipe;
+  // Decide on which CPUs the stages of each pipe will run.
+  cpu_topology topology;
+  loadTopology(topology);
   for (int i = 0; i < pipes.size(); ++i) {
-    // Execute current pipe.
-    pid_t child = forkAndCreatePipe(pipes[i], jobs);
-    // Only if I'm the parent, add the process id to the map.
-    if (child > 0) pidToPipe[child] = pipes[i];
+    int cpu = unavailableCpu(pipes[i], topology);
+    if (cpu != -1) {
+      printf("Pipe %s cannot run on CPU %d, it is not available\n",
+             pipes[i].name.c_str(), cpu);
+      return 0;
+    }
+    planPlacement(pipes[i], options.placement, topology);
   }
 
-  // Take all jobs that were not executed in any pipe and run them in a default
-  // pipe.
-  pipe_desc defaultPipe = buildDefaultPipe(jobs.size(), assignedJobs);
+  // Create temporal files that will be used by each pipe, streamed output
+  // does not need them.
+  bool streamed = options.stream || options.ordered;
+  if (!streamed) createTemporalFiles(pipes);
   // If there is at least one process in the default pipe, go ahead and run it.
   if (!defaultPipe.jobsIndexes.empty()) {
-    defaultPipe.tempOutput = TEMP_DIR + DEFAULT_PIPE + TEMP_EXT;
-    pid_t defaultPipeChild = forkAndCreatePipe(defaultPipe, jobs);
-    // Only if I'm the parent, add the process id to the map.
-    if (defaultPipeChild > 0) pidToPipe[defaultPipeChild] = defaultPipe;
+    planPlacement(defaultPipe, options.placement, topology);
+    pipes.push_back(defaultPipe);
+  }
+  // Remember the YAML order, ordered output follows it whatever the launch
+  // order is.
+  vector <string> pipeNames;
+  for (int i = 0; i < pipes.size(); ++i) {
+    pipes[i].order = i;
+    pipeNames.push_back(pipes[i].name);
+  }
+
+  // With bounded concurrency, start the pipes expected to take longer first.
+  map <string, pipe_history> history;
+  if (!options.historyFile.empty()) loadHistory(options.historyFile, history);
+  double predictedMakespan = 0;
+  if (options.maxPipes > 0) {
+    predictWallTimes(pipes, jobs, history);
+    sortLongestFirst(pipes);
+  }
+  // Latency-sensitive classes jump ahead of bulk ones.
+  rankPipes(pipes, jobs, options.classOrder);
+  sortByClass(pipes);
+  if (options.maxPipes > 0) {
+    predictedMakespan = predictMakespan(pipes, options.maxPipes);
   }
 
-  // Wait for each pipe and when it finishes print the corresponding output.
-  int exitedPipes = 0;
-  while (exitedPipes++ < pidToPipe.size()) {
+  // Pipes are accounted in their own cgroups when a delegated subtree is given.
+  if (!options.cgroupRoot.empty() &&
+      !enableMemoryController(options.cgroupRoot)) {
+    printf("Memory controller is not available in %s\n",
+           options.cgroupRoot.c_str());
+  }
+
+  // Pipes are placed by the load the workers advertise.
+  if (!options.workers.empty() && !queryWorkers(options.workers)) {
+    printf("No worker is reachable\n");
+    deleteTemporalFiles(pipes);
+    return 0;
+  }
+
+  // Pipes waiting to be admitted, in launch order.
+  deque <pipe_desc> readyPipes(pipes.begin(), pipes.end());
+  // Map from process id to pipe. Used to get the pipe that finished in the
+  // wait function.
+  map <pid_t, pipe_desc> pidToPipe;
+  // Expansion of the matrix pipes, by pipe order.
+  map <int, matrix_state> matrices;
+  // Stages of the local pipes, sampled while waiting when --monitor is given.
+  run_monitor monitor;
+  // Output of the pipes, read as it arrives when --stream or --ordered is
+  // given.
+  output_mux mux;
+  mux.timestamps = options.timestamps;
+  // Output is collected and relayed by io_uring when it is available.
+  io_engine engine;
+  if (!openEngine(engine, options.ioEngine) && !options.ioEngine.empty()) {
+    printf("## I/O engine %s is not available (Err: %d), using %s ##\n",
+           options.ioEngine.c_str(), errno, engine.kind.c_str());
+  }
+  mux.engine = &engine;
+  if (options.ordered) orderSections(mux, pipeNames, options.orderedBuffer);
+  // How each pipe finished, in YAML order, for the JSON report.
+  vector <pipe_report> reports(pipes.size());
+  int launchedPipes = 0;
+  double runStart = monotonicSeconds();
+  // Repeating pipes are queued again on each tick of their timers, until
+  // SIGINT or SIGTERM.
+  vector <pipe_schedule> schedules;
+  if (resident) {
+    handleStopSignals();
+    if (!startSchedules(pipes, runStart, schedules)) {
+      printf("Could not schedule the repeating pipes: %s\n", strerror(errno));
+      stopSchedules(schedules);
+      schedules.clear();
+    }
+  }
+  bool scheduling = !schedules.empty();
+  while (!readyPipes.empty() || !pidToPipe.empty() || scheduling) {
+    if (scheduling && stopRequested) {
+      stopSchedules(schedules);
+      scheduling = false;
+      continue;
+    }
+    if (scheduling) fireSchedules(schedules, readyPipes);
+    // Start as many pipes as the slots, workers and memory budget allow.
+    // Matrices running their maximum of instances let the pipes behind them
+    // pass.
+    // Empty matrices are dropped from the queue while looking for the next
+    // pipe, so its end is only taken afterwards.
+    deque <pipe_desc>::iterator next = findNextPipe(readyPipes, matrices);
+    while (next != readyPipes.end() && canAdmit(*next, pidToPipe, options)) {
+      pipe_desc nextPipe = takeNextPipe(readyPipes, next, matrices);
+      pid_t child = launchPipe(nextPipe, jobs, programs, options,
+                               launchedPipes++, mux);
+      // Only if I'm the parent, add the process id to the map.
+      if (child > 0) {
+        pidToPipe[child] = nextPipe;
+        if (options.monitor && nextPipe.worker.empty()) {
+          watchPipe(monitor, child, nextPipe, jobs);
+        }
+      }
+      else {
+        job_status failure;
+        failure.code = errno;
+        pipe_report failed;
+        fillReport(failed, nextPipe, failure);
+        if (nextPipe.matrixInstance < 0) reports[nextPipe.order] = failed;
+        else addInstance(reports[nextPipe.order], matrices[nextPipe.order].pipe,
+                         failed);
+        char *reportText;
+        size_t reportSize;
+        FILE *report = openReport(options, reportText, reportSize);
+        printResult(report, false, nextPipe.name, failure.code);
+        if (nextPipe.every > 0) {
+          recordScheduledRun(report, schedules, nextPipe, false, 0);
+        }
+        if (nextPipe.matrixInstance >= 0) {
+          recordInstance(report, matrices[nextPipe.order], nextPipe.name,
+                         false, 0);
+          if (!streamed) remove(nextPipe.tempOutput.c_str());
+        }
+        closeReport(report, reportText, nextPipe, mux);
+        if (!nextPipe.worker.empty()) releaseWorker(nextPipe, options.workers);
+        if (!nextPipe.cgroup.empty()) removeCgroup(nextPipe.cgroup);
+      }
+      next = findNextPipe(readyPipes, matrices);
+    }
+
     int status;
+    // Resources used by the pipe master and the jobs it reaped.
+    struct rusage usage;
+    pid_t exitedPipeId;
     // This wait will catch the first pipe-master that terminates its
-    // execution.
-    pid_t exitedPipeId = wait(&status);
-    // If the wait didn't fail, proceed to show the results of the finished
-    // process.
-    if (exitedPipeId != ERROR_OCURRED) {
-      pipe_desc pipeToPrint = pidToPipe[exitedPipeId];
-      printPipeResults(pipeToPrint);
-      analyzeExitStatus(status, pipeToPrint.name);
+    // execution. While some pipes wait to be admitted or stages are
+    // monitored, do not block so that admission is checked again and stages
+    // are sampled.
+    // Streamed output is read meanwhile, and scheduled ticks are waited for
+    // even when nothing runs.
+    // Matrices at their maximum of instances wait for one of them as well.
+    bool admissible = next != readyPipes.end();
+    if (!admissible && !options.monitor && !streamed && !scheduling) {
+      exitedPipeId = wait4(-1, &status, 0, &usage);
+    }
+    else if ((exitedPipeId = wait4(-1, &status, WNOHANG, &usage)) == 0 ||
+             (exitedPipeId == ERROR_OCURRED && scheduling)) {
+      if (options.monitor) sampleMonitor(monitor);
+      if (streamed) pollStreams(mux, ADMISSION_POLL_US / 1000);
+      else if (scheduling) waitSchedules(schedules, ADMISSION_POLL_US / 1000);
+      else usleep(ADMISSION_POLL_US);
+      continue;
+    }
+    // Another stop signal only interrupts the wait, the running pipes are
+    // still waited for.
+    if (exitedPipeId == ERROR_OCURRED && errno == EINTR) continue;
+    // No children are left, nothing else can finish.
+    if (exitedPipeId == ERROR_OCURRED) break;
+    // Proceed to show the results of the finished process.
+    pipe_desc pipeToPrint = pidToPipe[exitedPipeId];
+    pidToPipe.erase(exitedPipeId);
+    if (!pipeToPrint.worker.empty()) {
+      releaseWorker(pipeToPrint, options.workers);
+    }
+    // Instances of a matrix are remembered and reported as the matrix.
+    bool instance = pipeToPrint.matrixInstance >= 0;
+    pipe_desc &recorded = instance ? matrices[pipeToPrint.order].pipe
+                                   : pipeToPrint;
+    // Only successful runs are remembered, failures usually end early.
+    if (!options.historyFile.empty() && WIFEXITED(status) &&
+        WEXITSTATUS(status) == EXIT_SUCCESS) {
+      double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                   usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+      recordRun(history[historyKey(recorded, jobs)],
+                monotonicSeconds() - pipeToPrint.startTime, cpu);
+    }
+    pipe_report finished;
+    fillReport(finished, pipeToPrint, decodeStatus(status));
+    if (instance) addInstance(reports[pipeToPrint.order], recorded, finished);
+    else reports[pipeToPrint.order] = finished;
+    if (streamed) closeStream(mux, exitedPipeId);
+    else {
+      printPipeResults(pipeToPrint, engine);
+      if (instance) remove(pipeToPrint.tempOutput.c_str());
+    }
+    // With --ordered the result waits with the output of the pipe until the
+    // pipes before it are printed.
+    char *reportText;
+    size_t reportSize;
+    FILE *report = openReport(options, reportText, reportSize);
+    if (pipeToPrint.resumedStage >= 0) {
+      fprintf(report, "## %s resumed from %s ##\n", pipeToPrint.name.c_str(),
+              pipeToPrint.input.c_str());
     }
+    printEndpointStats(report, pipeToPrint);
+    releaseEndpointStats(pipeToPrint);
+    analyzeExitStatus(report, status, pipeToPrint.name);
+    if (pipeToPrint.every > 0) {
+      recordScheduledRun(report, schedules, pipeToPrint, finished.success,
+                         finished.wallTime);
+    }
+    if (instance) {
+      recordInstance(report, matrices[pipeToPrint.order], pipeToPrint.name,
+                     finished.success, finished.wallTime);
+    }
+    printErrorTails(report, pipeToPrint.name, finished.errors);
+    if (options.monitor) reportBottleneck(report, monitor, exitedPipeId);
+    releaseStagePids(pipeToPrint);
+    if (!pipeToPrint.cgroup.empty()) {
+      printPeakMemory(report, pipeToPrint);
+      removeCgroup(pipeToPrint.cgroup);
+    }
+    closeReport(report, reportText, pipeToPrint, mux);
+  }
+
+  if (options.maxPipes > 0) {
+    printf("## Makespan: predicted %.2fs, actual %.2fs ##\n",
+           predictedMakespan, monotonicSeconds() - runStart);
+  }
+  if (!options.historyFile.empty()) saveHistory(options.historyFile, history);
+  if (!options.reportFile.empty() &&
+      !writeReport(options.reportFile, reports,
+                   monotonicSeconds() - runStart)) {
+    printf("Could not write the report to %s: %s\n",
+           options.reportFile.c_str(), strerror(errno));
   }
 
-  // Add default pipe before calling delete temporal files, so that it can
-  // find and delete the temporal file that default pipe used;
-  pipes.push_back(defaultPipe);
-  deleteTemporalFiles(pipes);
+  // Make sure the default pipe is in the list before calling delete temporal
+  // files, so that it can find and delete the temporal file it used.
+  if (defaultPipe.jobsIndexes.empty()) pipes.push_back(defaultPipe);
+  if (!streamed) deleteTemporalFiles(pipes);
+  if (options.ioStats) printIOStats(engine);
+  closeEngine(engine);
+  clearExecCache(programs);
   return 0;
 }
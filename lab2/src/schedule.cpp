@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include "schedule.h"
+
+using namespace std;
+
+#define ERROR_OCURRED -1
+
+// Number of recent runs the rolling statistics of a scheduled pipe cover.
+const int ROLLING_RUNS = 20;
+
+/**
+  Parses a duration such as "90", "500ms", "30s", "5m" or "1h". A number
+  alone is in seconds. Negative and non-finite values, as "nan" or "inf",
+  are not durations.
+  @param text String with the duration.
+  @param seconds Reference where the duration in seconds will be stored.
+  @return true if the duration is valid, false otherwise.
+ */
+bool parseDuration(const string &text, double &seconds) {
+  char *end;
+  seconds = strtod(text.c_str(), &end);
+  if (end == text.c_str() || !isfinite(seconds) || seconds < 0) return false;
+  string unit = end;
+  if (unit == "ms") seconds /= 1000;
+  else if (unit == "m") seconds *= 60;
+  else if (unit == "h") seconds *= 3600;
+  else if (unit != "" && unit != "s") return false;
+  return true;
+}
+
+/**
+  Picks the time at which the next tick of a schedule fires: its nominal time
+  plus a random delay of at most the pipe jitter.
+  @param schedule Reference to the schedule.
+  @return Time of the tick, in monotonic seconds.
+ */
+double jitteredTick(pipe_schedule &schedule) {
+  double delay = schedule.pipe.jitter * (rand() / (RAND_MAX + 1.0));
+  return schedule.nextTick + delay;
+}
+
+/**
+  Arms the timer of a schedule for an absolute time of the monotonic clock.
+  @param schedule Reference to the schedule.
+  @param when Time of the tick, in monotonic seconds.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool armTimer(pipe_schedule &schedule, double when) {
+  struct itimerspec timer;
+  memset(&timer, 0, sizeof(timer));
+  timer.it_value.tv_sec = (time_t) when;
+  timer.it_value.tv_nsec = (long) ((when - (time_t) when) * 1e9);
+  // A zero value would disarm the timer instead of firing right away.
+  if (timer.it_value.tv_sec == 0 && timer.it_value.tv_nsec == 0) {
+    timer.it_value.tv_nsec = 1;
+  }
+  return timerfd_settime(schedule.timerFd, TFD_TIMER_ABSTIME, &timer,
+                         NULL) != ERROR_OCURRED;
+}
+
+/**
+  Creates the schedules of the pipes that have 'Every'. Their first run is
+  the one already queued, the timer of each one is armed for the next tick.
+  @param pipes Reference to the pipes, in launch order.
+  @param startTime Time at which the first runs are launched.
+  @param schedules Reference to the vector to fill.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool startSchedules(vector <pipe_desc> &pipes, double startTime,
+                    vector <pipe_schedule> &schedules) {
+  srand(getpid() ^ (unsigned) time(NULL));
+  for (int i = 0; i < pipes.size(); ++i) {
+    if (pipes[i].every <= 0) continue;
+    pipe_schedule schedule;
+    schedule.pipe = pipes[i];
+    schedule.active = true;
+    schedule.tickTime = startTime;
+    schedule.nextTick = startTime + pipes[i].every;
+    schedule.timerFd = timerfd_create(CLOCK_MONOTONIC,
+                                      TFD_NONBLOCK | TFD_CLOEXEC);
+    if (schedule.timerFd == ERROR_OCURRED) return false;
+    schedules.push_back(schedule);
+    if (!armTimer(schedules.back(), jitteredTick(schedules.back()))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+  Waits until a tick is due or the timeout expires.
+  @param schedules Reference to the schedules.
+  @param timeoutMs Maximum time to wait in milliseconds.
+ */
+void waitSchedules(vector <pipe_schedule> &schedules, int timeoutMs) {
+  vector <struct pollfd> fds;
+  for (int i = 0; i < schedules.size(); ++i) {
+    if (schedules[i].timerFd == ERROR_OCURRED) continue;
+    struct pollfd watched;
+    watched.fd = schedules[i].timerFd;
+    watched.events = POLLIN;
+    fds.push_back(watched);
+  }
+  if (fds.empty()) usleep(timeoutMs * 1000);
+  else poll(&fds[0], fds.size(), timeoutMs);
+}
+
+/**
+  Queues a run of every pipe whose tick is due, skipping those whose previous
+  run is still active, and arms their timers for the following tick.
+  @param schedules Reference to the schedules.
+  @param readyPipes Reference to the queue of pipes waiting to be admitted.
+ */
+void fireSchedules(vector <pipe_schedule> &schedules,
+                   deque <pipe_desc> &readyPipes) {
+  for (int i = 0; i < schedules.size(); ++i) {
+    pipe_schedule &schedule = schedules[i];
+    uint64_t expirations;
+    if (schedule.timerFd == ERROR_OCURRED ||
+        read(schedule.timerFd, &expirations, sizeof(expirations)) !=
+        sizeof(expirations)) continue;
+    if (schedule.active) {
+      ++schedule.skipped;
+      printf("## %s skipped a tick, its previous run is still active ##\n",
+             schedule.pipe.name.c_str());
+    }
+    else {
+      schedule.active = true;
+      schedule.tickTime = schedule.nextTick;
+      readyPipes.push_back(schedule.pipe);
+    }
+    // Ticks missed while the coordinator was busy are not made up.
+    double now = monotonicSeconds();
+    schedule.nextTick += schedule.pipe.every;
+    while (schedule.nextTick <= now) schedule.nextTick += schedule.pipe.every;
+    armTimer(schedule, jitteredTick(schedule));
+  }
+  fflush(stdout);
+}
+
+/**
+  Records a finished run of a scheduled pipe and prints its statistics.
+  @param out Stream to print to.
+  @param schedules Reference to the schedules.
+  @param finishedPipe Reference to the pipe that finished.
+  @param success Whether the run was successful.
+  @param wallTime Wall time of the run in seconds.
+ */
+void recordScheduledRun(FILE *out, vector <pipe_schedule> &schedules,
+                        const pipe_desc &finishedPipe, bool success,
+                        double wallTime) {
+  for (int i = 0; i < schedules.size(); ++i) {
+    pipe_schedule &schedule = schedules[i];
+    if (schedule.pipe.order != finishedPipe.order) continue;
+    schedule.active = false;
+    ++schedule.runs;
+    if (!success) ++schedule.failures;
+    schedule.recentWalls.push_back(wallTime);
+    if (schedule.recentWalls.size() > ROLLING_RUNS) {
+      schedule.recentWalls.pop_front();
+    }
+    double total = 0, longest = 0;
+    for (int j = 0; j < schedule.recentWalls.size(); ++j) {
+      total += schedule.recentWalls[j];
+      longest = max(longest, schedule.recentWalls[j]);
+    }
+    fprintf(out, "## %s run %d: wall %.2fs, %.2fs late (last %d: mean "
+            "%.2fs, max %.2fs), %d skipped, %d failed ##\n",
+            schedule.pipe.name.c_str(), schedule.runs, wallTime,
+            max(0.0, finishedPipe.startTime - schedule.tickTime),
+            (int) schedule.recentWalls.size(),
+            total / schedule.recentWalls.size(), longest, schedule.skipped,
+            schedule.failures);
+  }
+}
+
+/**
+  Stops every schedule, closing its timer. Runs already queued still happen.
+  @param schedules Reference to the schedules.
+ */
+void stopSchedules(vector <pipe_schedule> &schedules) {
+  for (int i = 0; i < schedules.size(); ++i) {
+    if (schedules[i].timerFd != ERROR_OCURRED) close(schedules[i].timerFd);
+    schedules[i].timerFd = ERROR_OCURRED;
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "jobdesc.h"
+
+/**
+  This structure stores the schedule of a repeating pipe: the pipe to launch
+  on each tick, the timer that wakes the coordinator, the nominal time of the
+  next tick and the statistics of its runs. 'active' is set while a run is
+  queued or running, ticks that find it set are skipped.
+  */
+struct pipe_schedule {
+  pipe_desc pipe;
+  int timerFd;
+  double nextTick, tickTime;
+  bool active;
+  int runs, failures, skipped;
+  // Wall times of the most recent runs, oldest first.
+  std::deque <double> recentWalls;
+  pipe_schedule() : timerFd(-1), nextTick(0), tickTime(0), active(false),
+                    runs(0), failures(0), skipped(0) {}
+};
+
+/**
+  Parses a duration such as "90", "500ms", "30s", "5m" or "1h". A number
+  alone is in seconds.
+  @param text String with the duration.
+  @param seconds Reference where the duration in seconds will be stored.
+  @return true if the duration is valid, false otherwise.
+ */
+bool parseDuration(const std::string &text, double &seconds);
+
+/**
+  Creates the schedules of the pipes that have 'Every'. Their first run is
+  the one already queued, the timer of each one is armed for the next tick.
+  @param pipes Reference to the pipes, in launch order.
+  @param startTime Time at which the first runs are launched.
+  @param schedules Reference to the vector to fill.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool startSchedules(std::vector <pipe_desc> &pipes, double startTime,
+                    std::vector <pipe_schedule> &schedules);
+
+/**
+  Waits until a tick is due or the timeout expires.
+  @param schedules Reference to the schedules.
+  @param timeoutMs Maximum time to wait in milliseconds.
+ */
+void waitSchedules(std::vector <pipe_schedule> &schedules, int timeoutMs);
+
+/**
+  Queues a run of every pipe whose tick is due, skipping those whose previous
+  run is still active, and arms their timers for the following tick.
+  @param schedules Reference to the schedules.
+  @param readyPipes Reference to the queue of pipes waiting to be admitted.
+ */
+void fireSchedules(std::vector <pipe_schedule> &schedules,
+                   std::deque <pipe_desc> &readyPipes);
+
+/**
+  Records a finished run of a scheduled pipe and prints its statistics.
+  @param out Stream to print to.
+  @param schedules Reference to the schedules.
+  @param finishedPipe Reference to the pipe that finished.
+  @param success Whether the run was successful.
+  @param wallTime Wall time of the run in seconds.
+ */
+void recordScheduledRun(FILE *out, std::vector <pipe_schedule> &schedules,
+                        const pipe_desc &finishedPipe, bool success,
+                        double wallTime);
+
+/**
+  Stops every schedule, closing its timer. Runs already queued still happen.
+  @param schedules Reference to the schedules.
+ */
+void stopSchedules(std::vector <pipe_schedule> &schedules);
+
+#endif
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "stream.h"
+#include "jobdesc.h"
+
+using namespace std;
+
+#define ERROR_OCURRED -1
+
+// A line longer than this is printed in pieces, so that a pipe that never
+// writes a line break cannot use unbounded memory.
+const size_t MAX_LINE_BYTES = 64 * 1024;
+// Output that pipes behind the head of the order may keep in memory, beyond
+// it goes to spill files.
+const long long DEFAULT_ORDERED_BUFFER = 64LL << 20;
+const string SPILL_FILE_TEMPLATE = "/tmp/runpipe-spill-XXXXXX";
+
+output_mux::output_mux() : timestamps(false), ordered(false),
+                           startTime(monotonicSeconds()), head(0),
+                           headStarted(false), buffered(0),
+                           bufferBudget(DEFAULT_ORDERED_BUFFER),
+                           engine(NULL) {}
+
+/**
+  Starts streaming the output of a pipe.
+  @param mux Reference to the output multiplexer.
+  @param master Process id of the pipe master.
+  @param name Name of the pipe, used as prefix of its lines.
+  @param fd Descriptor to read the output from, owned by the multiplexer.
+  @param order Position of the pipe in the YAML file.
+ */
+void addStream(output_mux &mux, pid_t master, const string &name, int fd,
+               int order) {
+  pipe_stream stream;
+  stream.name = name;
+  stream.fd = fd;
+  stream.order = order;
+  mux.streams[master] = stream;
+  watchStream(*mux.engine, fd);
+}
+
+/**
+  Copies what a spill file holds to the standard output and closes it.
+  @param spill Spill file of a section.
+ */
+void printSpill(FILE *spill) {
+  char buffer[BUFSIZ];
+  size_t bytes;
+  rewind(spill);
+  while ((bytes = fread(buffer, 1, sizeof(buffer), spill)) > 0) {
+    fwrite(buffer, 1, bytes, stdout);
+  }
+  fclose(spill);
+}
+
+/**
+  Prints the sections at the head of the order: the header and the output
+  buffered so far of the first unfinished one, which is printed live from
+  then on, and every finished one before it.
+  @param mux Reference to the output multiplexer, in ordered mode.
+ */
+void advanceSections(output_mux &mux) {
+  while (mux.head < mux.sections.size()) {
+    ordered_section &section = mux.sections[mux.head];
+    if (!mux.headStarted) {
+      printf("## Output %s ##\n", section.name.c_str());
+      fwrite(section.buffered.data(), 1, section.buffered.size(), stdout);
+      mux.buffered -= section.buffered.size();
+      string().swap(section.buffered);
+      if (section.spill != NULL) printSpill(section.spill);
+      section.spill = NULL;
+      mux.headStarted = true;
+    }
+    if (!section.finished) break;
+    fputs(section.report.c_str(), stdout);
+    ++mux.head;
+    mux.headStarted = false;
+  }
+  fflush(stdout);
+}
+
+/**
+  Opens a spill file. The file has no name and is closed on exec, so that the
+  pipe masters forked afterwards and their stages do not inherit it.
+  @return The spill file, or NULL on error and errno is set appropriately.
+ */
+FILE *openSpill() {
+  vector <char> name(SPILL_FILE_TEMPLATE.begin(), SPILL_FILE_TEMPLATE.end());
+  name.push_back('\0');
+  int fd = mkostemp(&name[0], O_CLOEXEC);
+  if (fd == ERROR_OCURRED) return NULL;
+  unlink(&name[0]);
+  FILE *spill = fdopen(fd, "w+");
+  if (spill == NULL) close(fd);
+  return spill;
+}
+
+/**
+  Adds output of a pipe to its section: printed right away at the head of
+  the order, kept in memory while the budget allows, or written to the spill
+  file of the section. Once a section spills, the rest of its output follows
+  it there so that it stays in order.
+  @param mux Reference to the output multiplexer, in ordered mode.
+  @param order Position of the pipe in the YAML file.
+  @param data Output of the pipe.
+ */
+void appendSection(output_mux &mux, int order, const string &data) {
+  ordered_section &section = mux.sections[order];
+  if (order == mux.head && mux.headStarted) {
+    fwrite(data.data(), 1, data.size(), stdout);
+    return;
+  }
+  if (section.spill == NULL &&
+      mux.buffered + (long long) data.size() <= mux.bufferBudget) {
+    section.buffered += data;
+    mux.buffered += data.size();
+    return;
+  }
+  // Without a spill file the output stays in memory, over the budget.
+  if (section.spill == NULL && (section.spill = openSpill()) == NULL) {
+    section.buffered += data;
+    mux.buffered += data.size();
+    return;
+  }
+  fwrite(data.data(), 1, data.size(), section.spill);
+}
+
+/**
+  Switches the multiplexer to ordered mode with one section per pipe.
+  @param mux Reference to the output multiplexer.
+  @param names Names of the pipes, in YAML order.
+  @param bufferBudget Bytes of output that may wait in memory.
+ */
+void orderSections(output_mux &mux, const vector <string> &names,
+                   long long bufferBudget) {
+  mux.ordered = true;
+  mux.bufferBudget = bufferBudget;
+  mux.sections.resize(names.size());
+  for (int i = 0; i < names.size(); ++i) mux.sections[i].name = names[i];
+  advanceSections(mux);
+}
+
+/**
+  Ends the section of a finished pipe with its result, printing every section
+  that is complete up to the first one still running.
+  @param mux Reference to the output multiplexer, in ordered mode.
+  @param order Position of the pipe in the YAML file.
+  @param report Result of the pipe.
+ */
+void finishSection(output_mux &mux, int order, const string &report) {
+  mux.sections[order].report = report;
+  mux.sections[order].finished = true;
+  advanceSections(mux);
+}
+
+/**
+  Prints a line of a pipe with its prefix. The whole line is printed with a
+  single call, so lines of different pipes never mix.
+  @param mux Reference to the output multiplexer.
+  @param stream Reference to the stream of the pipe.
+  @param line Line to print, without its line break.
+ */
+void printLine(output_mux &mux, pipe_stream &stream, const string &line) {
+  if (mux.timestamps) {
+    printf("[%.3fs %s] %s\n", monotonicSeconds() - mux.startTime,
+           stream.name.c_str(), line.c_str());
+  }
+  else printf("[%s] %s\n", stream.name.c_str(), line.c_str());
+}
+
+/**
+  Prints the complete lines waiting in a stream, keeping the last incomplete
+  one unless it is too long. In ordered mode everything read goes to the
+  section of the pipe.
+  @param mux Reference to the output multiplexer.
+  @param stream Reference to the stream of the pipe.
+ */
+void printLines(output_mux &mux, pipe_stream &stream) {
+  if (mux.ordered) {
+    // Only one section is printed at a time, output is passed unchanged.
+    appendSection(mux, stream.order, stream.pending);
+    stream.pending.clear();
+    return;
+  }
+  size_t start = 0, lineEnd;
+  while ((lineEnd = stream.pending.find('\n', start)) != string::npos) {
+    printLine(mux, stream, stream.pending.substr(start, lineEnd - start));
+    start = lineEnd + 1;
+  }
+  stream.pending.erase(0, start);
+  while (stream.pending.size() >= MAX_LINE_BYTES) {
+    printLine(mux, stream, stream.pending.substr(0, MAX_LINE_BYTES));
+    stream.pending.erase(0, MAX_LINE_BYTES);
+  }
+}
+
+/**
+  Waits until some pipe writes output or the timeout expires, and prints every
+  complete line read.
+  @param mux Reference to the output multiplexer.
+  @param timeoutMs Maximum time to wait in milliseconds.
+ */
+void pollStreams(output_mux &mux, int timeoutMs) {
+  vector <int> fds;
+  vector <pid_t> masters;
+  map <pid_t, pipe_stream>::iterator it;
+  for (it = mux.streams.begin(); it != mux.streams.end(); ++it) {
+    // Streams at end of file are negated and left out until the pipe master
+    // is reaped.
+    if (it->second.fd < 0) continue;
+    fds.push_back(it->second.fd);
+    masters.push_back(it->first);
+  }
+  vector <ssize_t> results;
+  vector <string> data;
+  waitStreams(*mux.engine, fds, timeoutMs, results, data);
+  for (int i = 0; i < fds.size(); ++i) {
+    if (results[i] < 0) continue;
+    pipe_stream &stream = mux.streams[masters[i]];
+    stream.pending += data[i];
+    if (results[i] == 0) {
+      // Nothing else will come, the pipe master is about to be reaped.
+      unwatchStream(*mux.engine, stream.fd);
+      stream.fd = -stream.fd - 1;
+    }
+    printLines(mux, stream);
+  }
+  fflush(stdout);
+}
+
+/**
+  Reads what is left of the output of a finished pipe, prints it (a last line
+  without line break included) and stops streaming it.
+  @param mux Reference to the output multiplexer.
+  @param master Process id of the pipe master that finished.
+ */
+void closeStream(output_mux &mux, pid_t master) {
+  map <pid_t, pipe_stream>::iterator it = mux.streams.find(master);
+  if (it == mux.streams.end()) return;
+  pipe_stream &stream = it->second;
+  if (stream.fd >= 0) {
+    unwatchStream(*mux.engine, stream.fd);
+    while (readOnce(*mux.engine, stream.fd, stream.pending) > 0) {
+      printLines(mux, stream);
+    }
+    close(stream.fd);
+  }
+  else close(-stream.fd - 1);
+  printLines(mux, stream);
+  if (!stream.pending.empty()) printLine(mux, stream, stream.pending);
+  fflush(stdout);
+  mux.streams.erase(it);
+}
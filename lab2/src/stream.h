@@ -0,0 +1,102 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "ioengine.h"
+
+extern const long long DEFAULT_ORDERED_BUFFER;
+
+/**
+  This structure stores the output of a pipe being streamed: the descriptor
+  the coordinator reads it from, the last line until it is complete and the
+  position of the pipe in the YAML file.
+  */
+struct pipe_stream {
+  std::string name, pending;
+  int fd, order;
+};
+
+/**
+  This structure stores the section of the ordered output that belongs to a
+  pipe: its output while it is not at the head of the order (in memory, then
+  in a spill file once the memory budget is used) and its result once it
+  finishes.
+  */
+struct ordered_section {
+  std::string name, buffered, report;
+  FILE *spill;
+  bool finished;
+  ordered_section() : spill(NULL), finished(false) {}
+};
+
+/**
+  This structure stores the outputs of all streamed pipes, by pipe master
+  process id. Streamed lines are prefixed by the pipe name and, if
+  'timestamps' is set, the time since the start. In ordered mode the output
+  is not prefixed but printed by sections, in YAML order. Streams are read
+  through 'engine', which must be set before the first one is added.
+  */
+struct output_mux {
+  std::map <pid_t, pipe_stream> streams;
+  bool timestamps, ordered;
+  double startTime;
+  std::vector <ordered_section> sections;
+  // Section being printed live, whether its header was printed, bytes
+  // buffered in memory by the other sections and the most they may use.
+  int head;
+  bool headStarted;
+  long long buffered, bufferBudget;
+  io_engine *engine;
+  output_mux();
+};
+
+/**
+  Switches the multiplexer to ordered mode with one section per pipe.
+  @param mux Reference to the output multiplexer.
+  @param names Names of the pipes, in YAML order.
+  @param bufferBudget Bytes of output that may wait in memory.
+ */
+void orderSections(output_mux &mux, const std::vector <std::string> &names,
+                   long long bufferBudget);
+
+/**
+  Starts streaming the output of a pipe.
+  @param mux Reference to the output multiplexer.
+  @param master Process id of the pipe master.
+  @param name Name of the pipe, used as prefix of its lines.
+  @param fd Descriptor to read the output from, owned by the multiplexer.
+  @param order Position of the pipe in the YAML file.
+ */
+void addStream(output_mux &mux, pid_t master, const std::string &name,
+               int fd, int order);
+
+/**
+  Waits until some pipe writes output or the timeout expires, and prints every
+  complete line read.
+  @param mux Reference to the output multiplexer.
+  @param timeoutMs Maximum time to wait in milliseconds.
+ */
+void pollStreams(output_mux &mux, int timeoutMs);
+
+/**
+  Reads what is left of the output of a finished pipe, prints it (a last line
+  without line break included) and stops streaming it.
+  @param mux Reference to the output multiplexer.
+  @param master Process id of the pipe master that finished.
+ */
+void closeStream(output_mux &mux, pid_t master);
+
+/**
+  Ends the section of a finished pipe with its result, printing every section
+  that is complete up to the first one still running.
+  @param mux Reference to the output multiplexer, in ordered mode.
+  @param order Position of the pipe in the YAML file.
+  @param report Result of the pipe.
+ */
+void finishSection(output_mux &mux, int order, const std::string &report);
+
+#endif
@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "worker.h"
+#include "protocol.h"
+#include "errors.h"
+
+using namespace std;
+
+const string SLOTS_REQUEST = "SLOTS";
+const string RUN_REQUEST   = "RUN";
+const string OUTPUT_REPLY  = "OUT";
+const string EXIT_REPLY    = "EXIT";
+const string ERRORS_REPLY  = "ERR";
+
+// Remote pipes reading from the standard input get nothing, the input of the
+// coordinator is not forwarded.
+const string NULL_DEVICE = "/dev/null";
+
+// Time between checks for finished pipes while the worker waits for
+// connections.
+const int WORKER_POLL_MS = 200;
+
+/**
+  Builds a message with two fields.
+  @param first First field, usually the kind of message.
+  @param second Second field.
+  @return The message fields.
+ */
+vector <string> makeMessage(const string &first, const string &second) {
+  vector <string> fields;
+  fields.push_back(first);
+  fields.push_back(second);
+  return fields;
+}
+
+/**
+  Parses a comma separated list of worker endpoints.
+  @param list List of endpoints, i.e. "unix:/tmp/w1.sock,127.0.0.1:7001".
+  @param workers Reference to the vector to fill.
+  @return true if the list has at least one endpoint, false otherwise.
+ */
+bool parseWorkerList(const string &list, vector <worker_node> &workers) {
+  workers.clear();
+  stringstream splitter(list);
+  string endpoint;
+  while (getline(splitter, endpoint, ',')) {
+    if (endpoint.empty()) return false;
+    worker_node worker;
+    worker.endpoint = endpoint;
+    workers.push_back(worker);
+  }
+  return !workers.empty();
+}
+
+/**
+  Asks a worker for its slots and how many of them are in use. Pipes sent to
+  it that it has not accepted yet are still counted as busy.
+  @param worker Reference to the worker, 'slots' and 'busy' are filled.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool queryWorker(worker_node &worker) {
+  int fd;
+  if (!connectEndpoint(worker.endpoint, fd)) return false;
+  vector <string> reply;
+  message_reader reader(fd);
+  bool answered = sendMessage(fd, vector <string>(1, SLOTS_REQUEST)) &&
+                  receiveMessage(reader, reply);
+  int error = errno;
+  close(fd);
+  if (!answered || reply.size() != 3 || reply[0] != SLOTS_REQUEST) {
+    errno = answered ? EPROTO : error;
+    return false;
+  }
+  worker.slots = atoi(reply[1].c_str());
+  worker.busy = max(atoi(reply[2].c_str()), worker.assigned);
+  return true;
+}
+
+/**
+  Chooses the worker where the next pipe should run: the least loaded one
+  that still has a free slot.
+  @param workers Reference to the workers.
+  @return Index of the chosen worker, or -1 if all of them are full.
+ */
+int chooseWorker(vector <worker_node> &workers) {
+  int chosen = -1;
+  for (int i = 0; i < workers.size(); ++i) {
+    worker_node &worker = workers[i];
+    if (worker.busy >= worker.slots) continue;
+    // Compare busy / slots without dividing.
+    if (chosen == -1 || (long long) worker.busy * workers[chosen].slots <
+                        (long long) workers[chosen].busy * worker.slots) {
+      chosen = i;
+    }
+  }
+  return chosen;
+}
+
+/**
+  Encodes a pipe into a run request: "RUN", pipe name, input, whether its
+  input data is fed and that data, error tail size, whether it fails with
+  any stage, number of jobs and, for each job, its name, program, priority,
+  number of arguments and arguments. The error directory is not sent, the
+  worker only writes to its own.
+  @param pipeToRun Reference to the pipe.
+  @param stages Jobs of the pipe with their merged priorities.
+  @param fields Reference to the vector to fill.
+ */
+void encodePipe(const pipe_desc &pipeToRun, const vector <job_desc> &stages,
+                vector <string> &fields) {
+  fields.clear();
+  fields.push_back(RUN_REQUEST);
+  fields.push_back(pipeToRun.name);
+  fields.push_back(pipeToRun.input);
+  fields.push_back(toStr(pipeToRun.feedInput));
+  fields.push_back(pipeToRun.inputData);
+  fields.push_back(toStr(pipeToRun.errorTail));
+  fields.push_back(toStr(pipeToRun.pipefail));
+  fields.push_back(toStr(stages.size()));
+  for (int i = 0; i < stages.size(); ++i) {
+    const job_desc &stage = stages[i];
+    const priority_desc &priority = stage.priority;
+    stringstream encodedPriority;
+    encodedPriority << priority.hasNice << ' ' << priority.nice << ' '
+                    << priority.policy << ' ' << priority.ioClass << ' '
+                    << priority.ioLevel;
+    fields.push_back(stage.name);
+    fields.push_back(stage.exec);
+    fields.push_back(encodedPriority.str());
+    fields.push_back(toStr(stage.args.size()));
+    fields.insert(fields.end(), stage.args.begin(), stage.args.end());
+  }
+}
+
+/**
+  Decodes a run request built by encodePipe.
+  @param fields Fields of the request.
+  @param pipeToRun Reference where the name, input and error capture of the
+                   pipe will be stored.
+  @param stages Reference to the vector of jobs to fill.
+  @return true if the request is well formed, false otherwise.
+ */
+bool decodePipe(const vector <string> &fields, pipe_desc &pipeToRun,
+                vector <job_desc> &stages) {
+  if (fields.size() < 8) return false;
+  pipeToRun.name = fields[1];
+  pipeToRun.input = fields[2];
+  pipeToRun.feedInput = atoi(fields[3].c_str()) != 0;
+  pipeToRun.inputData = fields[4];
+  pipeToRun.errorTail = atoll(fields[5].c_str());
+  pipeToRun.pipefail = atoi(fields[6].c_str()) != 0;
+  int jobsCount = atoi(fields[7].c_str());
+  size_t next = 8;
+  for (int i = 0; i < jobsCount; ++i) {
+    if (next + 4 > fields.size()) return false;
+    job_desc stage;
+    stage.name = fields[next++];
+    stage.exec = fields[next++];
+    stringstream encodedPriority(fields[next++]);
+    priority_desc &priority = stage.priority;
+    if (!(encodedPriority >> priority.hasNice >> priority.nice >>
+          priority.policy >> priority.ioClass >> priority.ioLevel)) {
+      return false;
+    }
+    size_t argsCount = atoi(fields[next++].c_str());
+    if (next + argsCount > fields.size()) return false;
+    stage.args.assign(fields.begin() + next, fields.begin() + next + argsCount);
+    next += argsCount;
+    stages.push_back(stage);
+  }
+  return jobsCount > 0 && next == fields.size();
+}
+
+/**
+  Runs a pipe on a worker, writing the output it streams back to the pipe
+  output descriptor or temporal file, and the tails of the error streams of
+  its stages to its errors file. It is meant to be called from the pipe
+  master.
+  @param pipeToRun Reference to the pipe, 'worker' holds the endpoint.
+  @param stages Jobs of the pipe with their merged priorities.
+  @return true if the pipe finished successfully, false otherwise and errno is
+          set to the failure code.
+ */
+bool runRemotePipe(const pipe_desc &pipeToRun,
+                   const vector <job_desc> &stages) {
+  // A streamed pipe already has its output descriptor.
+  int output = pipeToRun.outputFd;
+  if (output == -1) {
+    output = open(pipeToRun.tempOutput.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+  if (output == -1) return false;
+  int fd;
+  if (!connectEndpoint(pipeToRun.worker, fd)) {
+    int error = errno;
+    close(output);
+    errno = error;
+    return false;
+  }
+  vector <string> request;
+  encodePipe(pipeToRun, stages, request);
+  // Without an exit reply the worker is assumed to have gone away.
+  int code = ECONNRESET;
+  if (sendMessage(fd, request)) {
+    message_reader reader(fd);
+    vector <string> reply;
+    while (receiveMessage(reader, reply) && !reply.empty()) {
+      if (reply[0] == ERRORS_REPLY && pipeToRun.errorsFd != -1) {
+        writeAll(pipeToRun.errorsFd, encodeMessage(
+                     vector <string> (reply.begin() + 1, reply.end())));
+      }
+      if (reply.size() != 2) continue;
+      if (reply[0] == OUTPUT_REPLY) writeAll(output, reply[1]);
+      else if (reply[0] == EXIT_REPLY) {
+        code = atoi(reply[1].c_str());
+        break;
+      }
+    }
+  }
+  close(fd);
+  close(output);
+  if (code != EXIT_SUCCESS) {
+    errno = code;
+    return false;
+  }
+  return true;
+}
+
+/**
+  Runs a pipe received by the worker, streaming its output to the client and
+  ending with the tails of the error streams, if they were captured, and its
+  exit code: 0 on success, the failure code otherwise.
+  @param client Connected socket of the coordinator.
+  @param request Fields of the run request.
+  @param errorDir Directory of the worker that receives the whole error
+                  streams, empty for none.
+ */
+void servePipe(int client, const vector <string> &request,
+               const string &errorDir) {
+  pipeline_io io;
+  pipe_desc pipeToRun;
+  vector <job_desc> stages;
+  if (!decodePipe(request, pipeToRun, stages)) {
+    sendMessage(client, makeMessage(EXIT_REPLY, toStr(EPROTO)));
+    return;
+  }
+  // Errors are only saved where the worker was told to, never where the
+  // coordinator asks.
+  if (pipeToRun.errorTail >= 0) pipeToRun.errorDir = errorDir;
+  io.input = pipeToRun.input;
+  if (pipeToRun.feedInput) io.inputData = &pipeToRun.inputData;
+  else if (io.input == STD_IN) io.input = NULL_DEVICE;
+  io.captureOutput = true;
+  io.processGroup = true;
+  io.pipefail = pipeToRun.pipefail;
+  error_capture capture;
+  pipeline_handle handle;
+  bool started = openErrorCapture(capture, pipeToRun, stages, io) &&
+                 startPipeline(stages, io, handle);
+  int startError = errno;
+  closeErrorWriters(io);
+  bool connected = true;
+  int output = handle.outputFd;
+  // Output and error streams are read together, a stage blocked on a full
+  // error pipe would stall the pipe otherwise. A stage that fails the pipe
+  // is looked for meanwhile, it stops the others.
+  while (output != -1 || capturingErrors(capture)) {
+    vector <struct pollfd> fds;
+    if (output != -1) {
+      struct pollfd watched;
+      watched.fd = output;
+      watched.events = POLLIN;
+      fds.push_back(watched);
+    }
+    watchErrors(capture, fds);
+    int ready = poll(&fds[0], fds.size(), FAILURE_POLL_MS);
+    stopIfFailed(handle);
+    if (ready == -1) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    readErrors(capture, fds);
+    if (output == -1 || fds[0].revents == 0) continue;
+    char buffer[BUFSIZ];
+    ssize_t bytes = read(output, buffer, sizeof(buffer));
+    if (bytes == -1 && errno == EINTR) continue;
+    if (bytes > 0 && !sendMessage(client, makeMessage(OUTPUT_REPLY,
+                                                      string(buffer, bytes)))) {
+      // The coordinator is gone, nothing would read the rest of the output.
+      connected = false;
+      stopPipeline(handle);
+    }
+    if (bytes <= 0 || !connected) {
+      close(output);
+      output = -1;
+    }
+  }
+  job_status status;
+  bool waited = waitPipeline(handle, status);
+  int code = !started ? startError : !waited ? ECHILD :
+             status.success ? EXIT_SUCCESS : status.code;
+  if (connected && !capture.stages.empty()) {
+    vector <string> reply(1, ERRORS_REPLY);
+    encodeErrors(capture, reply);
+    sendMessage(client, reply);
+  }
+  if (connected) sendMessage(client, makeMessage(EXIT_REPLY, toStr(code)));
+}
+
+/**
+  Runs runPipe as a worker agent: listens on an endpoint and runs every pipe
+  it receives, streaming its output and status back. It only returns on
+  error.
+  @param endpoint Endpoint to listen on.
+  @param slots Number of pipes the worker advertises it can run at once.
+  @param errorDir Directory that receives the whole error streams of the
+                  pipes that capture them, empty for none.
+  @return false, with errno set appropriately.
+ */
+bool runWorker(const string &endpoint, int slots, const string &errorDir) {
+  int listener;
+  if (!listenEndpoint(endpoint, listener)) return false;
+  printf("## Worker listening on %s with %d slots ##\n", endpoint.c_str(),
+         slots);
+  fflush(stdout);
+  // Pipes being served, each one by its own child.
+  int running = 0;
+  while (true) {
+    while (waitpid(-1, NULL, WNOHANG) > 0) --running;
+    struct pollfd listening;
+    listening.fd = listener;
+    listening.events = POLLIN;
+    int ready = poll(&listening, 1, WORKER_POLL_MS);
+    if (ready == -1 && errno != EINTR) return false;
+    if (ready <= 0) continue;
+    int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (client == -1) continue;
+    message_reader reader(client);
+    vector <string> request;
+    if (receiveMessage(reader, request) && !request.empty()) {
+      if (request[0] == SLOTS_REQUEST) {
+        vector <string> reply = makeMessage(SLOTS_REQUEST, toStr(slots));
+        reply.push_back(toStr(running));
+        sendMessage(client, reply);
+      }
+      else if (request[0] == RUN_REQUEST) {
+        // Slots are advertised, not enforced: placing pipes is up to the
+        // coordinator.
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+          close(listener);
+          servePipe(client, request, errorDir);
+          exit(EXIT_SUCCESS);
+        }
+        if (child != -1) ++running;
+      }
+    }
+    close(client);
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <string>
+#include <vector>
+#include "jobdesc.h"
+
+/**
+  This structure stores what the coordinator knows about a worker: where to
+  reach it, the slots it advertised, how many of them are taken (by its own
+  count when it was queried plus the pipes sent to it since then) and how
+  many pipes of this coordinator it is running.
+  */
+struct worker_node {
+  std::string endpoint;
+  int slots, busy, assigned;
+  worker_node() : slots(0), busy(0), assigned(0) {}
+};
+
+/**
+  Parses a comma separated list of worker endpoints.
+  @param list List of endpoints, i.e. "unix:/tmp/w1.sock,127.0.0.1:7001".
+  @param workers Reference to the vector to fill.
+  @return true if the list has at least one endpoint, false otherwise.
+ */
+bool parseWorkerList(const std::string &list,
+                     std::vector <worker_node> &workers);
+
+/**
+  Asks a worker for its slots and how many of them are in use. Pipes sent to
+  it that it has not accepted yet are still counted as busy.
+  @param worker Reference to the worker, 'slots' and 'busy' are filled.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool queryWorker(worker_node &worker);
+
+/**
+  Chooses the worker where the next pipe should run: the least loaded one
+  that still has a free slot.
+  @param workers Reference to the workers.
+  @return Index of the chosen worker, or -1 if all of them are full.
+ */
+int chooseWorker(std::vector <worker_node> &workers);
+
+/**
+  Runs a pipe on a worker, writing the output it streams back to the pipe
+  output descriptor or temporal file. It is meant to be called from the pipe
+  master.
+  @param pipeToRun Reference to the pipe, 'worker' holds the endpoint.
+  @param stages Jobs of the pipe with their merged priorities.
+  @return true if the pipe finished successfully, false otherwise and errno is
+          set to the failure code.
+ */
+bool runRemotePipe(const pipe_desc &pipeToRun,
+                   const std::vector <job_desc> &stages);
+
+/**
+  Runs runPipe as a worker agent: listens on an endpoint and runs every pipe
+  it receives, streaming its output and status back. It only returns on
+  error.
+  @param endpoint Endpoint to listen on.
+  @param slots Number of pipes the worker advertises it can run at once.
+  @param errorDir Directory that receives the whole error streams of the
+                  pipes that capture them, empty for none.
+  @return false, with errno set appropriately.
+ */
+bool runWorker(const std::string &endpoint, int slots,
+               const std::string &errorDir);
+
+#endif
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "jobexec.h"
+
+using namespace std;
+
+/**
+  Builds a job from a program and one argument.
+  @param exec Program to run.
+  @param arg Argument given to the program.
+  @return The job.
+ */
+job_desc makeJob(const string &exec, const string &arg) {
+  job_desc job;
+  job.name = exec;
+  job.exec = exec;
+  job.args.push_back(arg);
+  return job;
+}
+
+/**
+  Runs "ls /usr | wc -l" reading its output from the pipeline, then a job
+  that does not exist to show how failures are reported.
+ */
+int main() {
+  vector <job_desc> jobs;
+  jobs.push_back(makeJob("ls", "/usr"));
+  jobs.push_back(makeJob("wc", "-l"));
+
+  pipeline_io io;
+  io.captureOutput = true;
+  pipeline_handle handle;
+  if (!startPipeline(jobs, io, handle)) {
+    perror("startPipeline");
+    return 1;
+  }
+  string output;
+  char buffer[256];
+  ssize_t bytes;
+  while ((bytes = read(handle.outputFd, buffer, sizeof(buffer))) > 0) {
+    output.append(buffer, bytes);
+  }
+  close(handle.outputFd);
+  job_status status;
+  waitPipeline(handle, status);
+  printf("ls /usr | wc -l: %s", output.c_str());
+  printf("success: %d\n", status.success);
+
+  job_status missing;
+  if (!runJob(makeJob("./does-not-exist", "x"), missing)) {
+    perror("runJob");
+    return 1;
+  }
+  printf("./does-not-exist: success %d, code %d (%s)\n", missing.success,
+         missing.code, missing.description.c_str());
+  return 0;
+}
@@ -0,0 +1,802 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "jobexec.h"
+
+using namespace std;
+
+#define ERROR_OCURRED -1
+
+const string STD_IN  = "stdin";
+const string STD_OUT = "stdout";
+const string STD_ERR = "stderr";
+
+// Memory policy mode from <numaif.h>, defined here so that libnuma is not
+// needed.
+static const int MPOL_BIND_MODE = 2;
+
+// I/O priority constants from <linux/ioprio.h>, which glibc does not wrap.
+static const int IOPRIO_CLASS_SHIFT = 13;
+static const int IOPRIO_WHO_PROCESS = 1;
+
+// Permissions of the output files created for jobs and pipelines.
+static const mode_t OUTPUT_MODE = 0644;
+
+// Largest pipe buffer asked for input data, the default limit of
+// /proc/sys/fs/pipe-max-size for unprivileged processes.
+static const int MAX_FEED_PIPE = 1 << 20;
+
+// Search path used by execvp when PATH is not set.
+static const string DEFAULT_SEARCH_PATH = "/bin:/usr/bin";
+
+// Most bytes a copy child moves with one tee or splice call.
+static const size_t TEE_CHUNK = 1 << 16;
+
+/**
+  Builds the array of arguments for exec: [exec, args..., NULL]. The pointers
+  are valid while the job is not modified.
+  @param job Reference to the job.
+  @param jobArgs Reference to the vector to fill.
+ */
+void buildJobArgs(const job_desc &job, vector <char *> &jobArgs) {
+  jobArgs.clear();
+  jobArgs.push_back((char *) job.exec.c_str());
+  for (int i = 0; i < job.args.size(); ++i) {
+    jobArgs.push_back((char *) job.args[i].c_str());
+  }
+  // "The list of arguments must be terminated by a NULL pointer, and, since
+  // these are variadic functions, this pointer must be cast (char *) NULL."
+  jobArgs.push_back((char *) NULL);
+}
+
+/**
+  Opens a file and duplicates it into the given stream descriptor.
+  @param file Name of the file.
+  @param flags Flags to open the file with.
+  @param stream Descriptor to replace, i.e. STDIN_FILENO.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+static bool redirectStream(const string &file, int flags, int stream) {
+  int fd = open(file.c_str(), flags | O_CLOEXEC, OUTPUT_MODE);
+  if (fd == ERROR_OCURRED) return false;
+  // dup2(oldfd, newfd) makes newfd be the copy of oldfd, closing newfd first
+  // if necessary. The copy does not keep the close-on-exec flag.
+  bool redirected = dup2(fd, stream) != ERROR_OCURRED;
+  int error = errno;
+  close(fd);
+  errno = error;
+  return redirected;
+}
+
+/**
+  Redirects the standard streams of the calling process to the files given by
+  a job. Streams set to STD_IN, STD_OUT or STD_ERR are left untouched. It is
+  meant to be called in the child before execJob.
+  @param job Reference to the job.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool redirectStreams(const job_desc &job) {
+  if (job.input != STD_IN &&
+      !redirectStream(job.input, O_RDONLY, STDIN_FILENO)) return false;
+  if (job.output != STD_OUT &&
+      !redirectStream(job.output, O_WRONLY | O_CREAT | O_TRUNC,
+                      STDOUT_FILENO)) return false;
+  if (job.error != STD_ERR &&
+      !redirectStream(job.error, O_WRONLY | O_CREAT | O_TRUNC,
+                      STDERR_FILENO)) return false;
+  return true;
+}
+
+/**
+  Applies a placement to the calling process: sets its CPU affinity and, if a
+  node mask is given, binds its memory to those NUMA nodes. A CPU that does
+  not fit in a cpu_set_t fails with EINVAL instead of being left out.
+  @param placement Placement to apply.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool applyPlacement(const stage_placement &placement) {
+  if (placement.cpus.empty()) return true;
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  for (int i = 0; i < placement.cpus.size(); ++i) {
+    if (placement.cpus[i] < 0 || placement.cpus[i] >= CPU_SETSIZE) {
+      errno = EINVAL;
+      return false;
+    }
+    CPU_SET(placement.cpus[i], &mask);
+  }
+  if (sched_setaffinity(0, sizeof(mask), &mask) == ERROR_OCURRED) return false;
+  if (placement.nodeMask != 0) {
+    unsigned long nodeMask = placement.nodeMask;
+    if (syscall(SYS_set_mempolicy, MPOL_BIND_MODE, &nodeMask,
+                sizeof(nodeMask) * 8) == ERROR_OCURRED) return false;
+  }
+  return true;
+}
+
+/**
+  Applies a priority to the calling process: nice value, scheduling policy
+  and I/O priority.
+  @param priority Priority to apply.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool applyPriority(const priority_desc &priority) {
+  if (priority.hasNice) {
+    if (setpriority(PRIO_PROCESS, 0, priority.nice) == ERROR_OCURRED) {
+      return false;
+    }
+    if (priority.policy != SCHED_OTHER) {
+      struct sched_param parameters;
+      // SCHED_BATCH and SCHED_IDLE only accept a static priority of 0.
+      parameters.sched_priority = 0;
+      if (sched_setscheduler(0, priority.policy, &parameters) ==
+          ERROR_OCURRED) return false;
+    }
+  }
+  if (priority.ioClass != 0) {
+    int ioPriority = (priority.ioClass << IOPRIO_CLASS_SHIFT) |
+                     priority.ioLevel;
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioPriority) ==
+        ERROR_OCURRED) return false;
+  }
+  return true;
+}
+
+/**
+  Finds a program the way execvp does: a name with a slash is taken as is,
+  any other is looked for in each directory of the search path.
+  @param exec Name of the program.
+  @param searchPath Directories separated by colons, an empty one is the
+                    current directory.
+  @param path Reference filled with the path of the program.
+  @return On success, returns true. On error, returns false and errno is set
+          to ENOENT, or EACCES if only files that cannot be executed were
+          found.
+ */
+static bool findProgram(const string &exec, const string &searchPath,
+                        string &path) {
+  struct stat info;
+  if (exec.empty()) {
+    errno = ENOENT;
+    return false;
+  }
+  if (exec.find('/') != string::npos) {
+    if (access(exec.c_str(), X_OK) == ERROR_OCURRED) return false;
+    if (stat(exec.c_str(), &info) == ERROR_OCURRED) return false;
+    if (!S_ISREG(info.st_mode)) {
+      errno = EACCES;
+      return false;
+    }
+    path = exec;
+    return true;
+  }
+  bool denied = false;
+  size_t start = 0;
+  while (start <= searchPath.size()) {
+    size_t end = searchPath.find(':', start);
+    if (end == string::npos) end = searchPath.size();
+    string directory = searchPath.substr(start, end - start);
+    string candidate = (directory.empty() ? "." : directory) + "/" + exec;
+    start = end + 1;
+    if (stat(candidate.c_str(), &info) == ERROR_OCURRED) continue;
+    if (S_ISREG(info.st_mode) &&
+        access(candidate.c_str(), X_OK) != ERROR_OCURRED) {
+      path = candidate;
+      return true;
+    }
+    denied = true;
+  }
+  errno = denied ? EACCES : ENOENT;
+  return false;
+}
+
+/**
+  Tells if a resolved program is still the file that was opened.
+  @param entry Reference to the resolved program.
+  @return true if its path names the same file, unmodified.
+ */
+static bool sameProgram(const resolved_exec &entry) {
+  struct stat info;
+  return stat(entry.path.c_str(), &info) != ERROR_OCURRED &&
+         info.st_dev == entry.device && info.st_ino == entry.inode &&
+         info.st_mtim.tv_sec == entry.modified.tv_sec &&
+         info.st_mtim.tv_nsec == entry.modified.tv_nsec;
+}
+
+/**
+  Finds the program of a job the way execvp would (in PATH unless it has a
+  slash) and opens it, filling 'execPath' and 'execFd' of the job. Programs
+  are resolved once and kept in the cache while PATH does not change and the
+  file found is not replaced. Descriptors stay owned by the cache.
+  @param cache Reference to the cache.
+  @param job Reference to the job.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately: ENOENT when the program is not found, EACCES when it
+          is found but cannot be executed.
+ */
+bool resolveExec(exec_cache &cache, job_desc &job) {
+  const char *variable = getenv("PATH");
+  string searchPath = variable == NULL ? DEFAULT_SEARCH_PATH : variable;
+  if (searchPath != cache.searchPath) {
+    clearExecCache(cache);
+    cache.searchPath = searchPath;
+  }
+  job.execPath.clear();
+  job.execFd = ERROR_OCURRED;
+  map <string, resolved_exec>::iterator it = cache.entries.find(job.exec);
+  if (it != cache.entries.end() && sameProgram(it->second)) {
+    ++cache.hits;
+  }
+  else {
+    if (it != cache.entries.end()) {
+      close(it->second.fd);
+      cache.entries.erase(it);
+    }
+    ++cache.lookups;
+    resolved_exec entry;
+    if (!findProgram(job.exec, searchPath, entry.path)) return false;
+    // A path descriptor is enough to execute the file, even one that cannot
+    // be read.
+    entry.fd = open(entry.path.c_str(), O_PATH | O_CLOEXEC);
+    if (entry.fd == ERROR_OCURRED) return false;
+    struct stat info;
+    if (fstat(entry.fd, &info) == ERROR_OCURRED) {
+      int error = errno;
+      close(entry.fd);
+      errno = error;
+      return false;
+    }
+    entry.device = info.st_dev;
+    entry.inode = info.st_ino;
+    entry.modified = info.st_mtim;
+    it = cache.entries.insert(make_pair(job.exec, entry)).first;
+  }
+  job.execPath = it->second.path;
+  job.execFd = it->second.fd;
+  return true;
+}
+
+/**
+  Closes every descriptor of the cache and forgets its programs.
+  @param cache Reference to the cache.
+ */
+void clearExecCache(exec_cache &cache) {
+  map <string, resolved_exec>::iterator it;
+  for (it = cache.entries.begin(); it != cache.entries.end(); ++it) {
+    close(it->second.fd);
+  }
+  cache.entries.clear();
+}
+
+/**
+  Applies the placement and priority of a job to the calling process and
+  replaces it with the job program, through its resolved descriptor when it
+  has one. It only returns on error.
+  @param job Reference to the job.
+  @return false, with errno set appropriately.
+ */
+bool execJob(const job_desc &job) {
+  if (!applyPlacement(job.placement)) return false;
+  if (!applyPriority(job.priority)) return false;
+  vector <char *> jobArgs;
+  buildJobArgs(job, jobArgs);
+  if (job.execFd != ERROR_OCURRED) {
+    // A single execveat, with no PATH walk. Scripts fail with ENOENT: their
+    // interpreter opens them by name and the descriptor is close-on-exec.
+    fexecve(job.execFd, &jobArgs[0], environ);
+    if (errno != ENOENT || job.execPath.empty()) return false;
+  }
+  if (!job.execPath.empty()) {
+    execve(job.execPath.c_str(), &jobArgs[0], environ);
+    return false;
+  }
+  // execvp replaces the current process image with a new one. It returns
+  // only if an error has ocurred, setting the errno with the respective
+  // error.
+  execvp(jobArgs[0], &jobArgs[0]);
+  return false;
+}
+
+/**
+  Closes every valid descriptor of a vector, keeping errno.
+  @param descriptors Reference to the descriptors, -1 entries are skipped.
+ */
+static void closeDescriptors(vector <int> &descriptors) {
+  int error = errno;
+  for (int i = 0; i < descriptors.size(); ++i) {
+    if (descriptors[i] != ERROR_OCURRED) close(descriptors[i]);
+  }
+  errno = error;
+}
+
+/**
+  Unblocks every signal in a child of a pipeline, since the caller may block
+  some while the pipeline starts.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+static bool unblockSignals() {
+  sigset_t none;
+  sigemptyset(&none);
+  return sigprocmask(SIG_SETMASK, &none, NULL) != ERROR_OCURRED;
+}
+
+/**
+  Moves bytes from a pipe to a descriptor, with splice when the descriptor
+  allows it and with read and write otherwise.
+  @param input Pipe to read from.
+  @param copy Descriptor to write to.
+  @param bytes Most bytes to move.
+  @return The bytes moved, 0 at end of file. On error, returns -1 and errno
+          is set appropriately.
+ */
+static ssize_t moveToCopy(int input, int copy, size_t bytes) {
+  ssize_t moved = splice(input, NULL, copy, NULL, bytes, SPLICE_F_MOVE);
+  if (moved != ERROR_OCURRED || errno != EINVAL) return moved;
+  char buffer[TEE_CHUNK];
+  moved = read(input, buffer, bytes < TEE_CHUNK ? bytes : TEE_CHUNK);
+  for (ssize_t written = 0, sent; written < moved; written += sent) {
+    sent = write(copy, buffer + written, moved - written);
+    if (sent == ERROR_OCURRED) return ERROR_OCURRED;
+  }
+  return moved;
+}
+
+/**
+  Body of the child that copies the output of a job: tees what arrives on its
+  standard input into its standard output, the pipe of the next job, and
+  moves it to the copy descriptor, without bringing it to user space. When
+  the next job stops reading the rest only goes to the copy.
+  @param copy Descriptor that receives the copy.
+  @return On success, returns true once the input reached end of file. On
+          error, returns false and errno is set appropriately.
+ */
+static bool teeOutput(int copy) {
+  bool forwarding = true;
+  while (true) {
+    size_t pending = TEE_CHUNK;
+    if (forwarding) {
+      ssize_t teed = tee(STDIN_FILENO, STDOUT_FILENO, TEE_CHUNK, 0);
+      if (teed == 0) return true;
+      if (teed == ERROR_OCURRED) {
+        if (errno == EINTR) continue;
+        if (errno != EPIPE) return false;
+        // The next job is gone, what it did not read still goes to the copy.
+        forwarding = false;
+        close(STDOUT_FILENO);
+      }
+      else pending = teed;
+    }
+    // The bytes teed are consumed from the input only once they are copied.
+    while (pending > 0) {
+      ssize_t moved = moveToCopy(STDIN_FILENO, copy, pending);
+      if (moved == 0) return true;
+      if (moved == ERROR_OCURRED) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      pending -= moved;
+      if (!forwarding) break;
+    }
+  }
+}
+
+/**
+  Body of the child that feeds input data: maps it into its standard output,
+  the pipe of the first job, with vmsplice so that it is never copied. The
+  pages stay referenced by the pipe after the child exits. A first job that
+  stops reading is not an error.
+  @param data Bytes to feed.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+static bool feedInput(const string &data) {
+  size_t fed = 0;
+  while (fed < data.size()) {
+    struct iovec chunk;
+    chunk.iov_base = (void *) (data.data() + fed);
+    chunk.iov_len = data.size() - fed;
+    ssize_t moved = vmsplice(STDOUT_FILENO, &chunk, 1, 0);
+    if (moved == ERROR_OCURRED) {
+      if (errno == EINTR) continue;
+      return errno == EPIPE;
+    }
+    fed += moved;
+  }
+  return true;
+}
+
+/**
+  Starts a pipeline: forks one child per job, connecting the output of each
+  job to the input of the next one with pipes. The first job reads from the
+  pipeline input and the last one writes to the pipeline output. Each job
+  still redirects its own error stream if it gives a file, unless the
+  pipeline gives a descriptor for it. A job whose output is copied writes to
+  a child that tees it into the next pipe and the copy descriptor. Input
+  data is fed by its own child, so that the caller does not block while the
+  first job reads it. A child that cannot execute its job exits with errno
+  as status. The children start with no signal blocked.
+  @param jobs Reference to the jobs, in pipeline order.
+  @param io Reference to the input and output of the pipeline.
+  @param handle Reference to the pipeline_handle to fill.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately; jobs already started are left in the handle.
+ */
+bool startPipeline(const vector <job_desc> &jobs, const pipeline_io &io,
+                   pipeline_handle &handle) {
+  handle.pids.clear();
+  handle.feederPid = ERROR_OCURRED;
+  handle.groupId = ERROR_OCURRED;
+  handle.outputFd = ERROR_OCURRED;
+  handle.pipefail = io.pipefail;
+  handle.stopped = false;
+  handle.failedJob = ERROR_OCURRED;
+  int jobsCount = jobs.size();
+  if (jobsCount == 0) return true;
+
+  // Every descriptor is opened close-on-exec, so that each job only keeps
+  // the copies made into its standard streams.
+  int inputFd = ERROR_OCURRED, outputFd = ERROR_OCURRED;
+  // A descriptor given by the caller is used but not closed.
+  bool ownsInput = true, ownsOutput = true;
+  // Write end of the pipe the input data is fed into.
+  int feedFd = ERROR_OCURRED;
+  if (io.inputData != NULL) {
+    int feed[2];
+    if (pipe2(feed, O_CLOEXEC) == ERROR_OCURRED) return false;
+    inputFd = feed[0];
+    feedFd = feed[1];
+    // A pipe that holds the whole data lets the feeder exit right away.
+    int size = io.inputData->size() < MAX_FEED_PIPE ? io.inputData->size()
+                                                    : MAX_FEED_PIPE;
+    if (size > 0) fcntl(feedFd, F_SETPIPE_SZ, size);
+  }
+  else if (io.inputFd != ERROR_OCURRED) {
+    inputFd = io.inputFd;
+    ownsInput = false;
+  }
+  else if (io.input != STD_IN) {
+    inputFd = open(io.input.c_str(), O_RDONLY | O_CLOEXEC);
+    if (inputFd == ERROR_OCURRED) return false;
+  }
+  if (io.captureOutput) {
+    int capture[2];
+    if (pipe2(capture, O_CLOEXEC) == ERROR_OCURRED) {
+      vector <int> opened(1, ownsInput ? inputFd : ERROR_OCURRED);
+      opened.push_back(feedFd);
+      closeDescriptors(opened);
+      return false;
+    }
+    handle.outputFd = capture[0];
+    outputFd = capture[1];
+  }
+  else if (io.outputFd != ERROR_OCURRED) {
+    outputFd = io.outputFd;
+    ownsOutput = false;
+  }
+  else if (io.output != STD_OUT) {
+    outputFd = open(io.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+                    O_CLOEXEC, OUTPUT_MODE);
+    if (outputFd == ERROR_OCURRED) {
+      vector <int> opened(1, ownsInput ? inputFd : ERROR_OCURRED);
+      opened.push_back(feedFd);
+      closeDescriptors(opened);
+      return false;
+    }
+  }
+
+  // descriptors[2 * i] and descriptors[2 * i + 1] are the read and write
+  // slots of the pipe that connects job i with job i + 1. When the output of
+  // job i is copied, teeDescriptors[2 * i] and teeDescriptors[2 * i + 1] are
+  // those of the pipe from the job to the child that copies it.
+  vector <int> descriptors(2 * (jobsCount - 1), ERROR_OCURRED);
+  vector <int> teeDescriptors(2 * (jobsCount - 1), ERROR_OCURRED);
+  bool started = true;
+  for (int i = 0; i + 1 < jobsCount && started; ++i) {
+    started = pipe2(&descriptors[2 * i], O_CLOEXEC) != ERROR_OCURRED;
+    if (started && i < io.teeFds.size() && io.teeFds[i] != ERROR_OCURRED) {
+      started = pipe2(&teeDescriptors[2 * i], O_CLOEXEC) != ERROR_OCURRED;
+    }
+  }
+  if (!io.teeFds.empty()) handle.teePids.assign(jobsCount, ERROR_OCURRED);
+
+  // What is still buffered must not be copied into the children.
+  fflush(stdout);
+  for (int i = 0; i < jobsCount && started; ++i) {
+    int jobInput = i == 0 ? inputFd : descriptors[2 * (i - 1)];
+    int jobOutput = i == jobsCount - 1 ? outputFd : descriptors[2 * i + 1];
+    bool copied = i + 1 < jobsCount &&
+                  teeDescriptors[2 * i] != ERROR_OCURRED;
+    if (copied) jobOutput = teeDescriptors[2 * i + 1];
+    pid_t child = fork();
+    if (child == ERROR_OCURRED) started = false;
+    else if (child == 0) {
+      if (!unblockSignals()) exit(errno);
+      // The first job leads the group, the others join it.
+      if (io.processGroup &&
+          setpgid(0, handle.groupId == ERROR_OCURRED ? 0 : handle.groupId) ==
+          ERROR_OCURRED) exit(errno);
+      if (jobInput != ERROR_OCURRED &&
+          dup2(jobInput, STDIN_FILENO) == ERROR_OCURRED) exit(errno);
+      if (jobOutput != ERROR_OCURRED &&
+          dup2(jobOutput, STDOUT_FILENO) == ERROR_OCURRED) exit(errno);
+      // Input and output of the job belong to the pipeline, only its error
+      // stream is redirected here.
+      job_desc stage = jobs[i];
+      stage.input = STD_IN;
+      stage.output = STD_OUT;
+      if (i < io.errorFds.size() && io.errorFds[i] != ERROR_OCURRED) {
+        if (dup2(io.errorFds[i], STDERR_FILENO) == ERROR_OCURRED) exit(errno);
+        stage.error = STD_ERR;
+      }
+      if (!redirectStreams(stage)) exit(errno);
+      execJob(stage);
+      exit(errno);
+    }
+    else {
+      handle.pids.push_back(child);
+      // The parent joins it as well, so that the group exists before the
+      // next child is forked, whichever of them runs first.
+      if (io.processGroup) {
+        if (handle.groupId == ERROR_OCURRED) handle.groupId = child;
+        setpgid(child, handle.groupId);
+      }
+    }
+    if (!copied || child == ERROR_OCURRED) continue;
+    pid_t copier = fork();
+    if (copier == ERROR_OCURRED) started = false;
+    else if (copier == 0) {
+      if (!unblockSignals()) exit(errno);
+      // The copy keeps going when the next job stops reading.
+      signal(SIGPIPE, SIG_IGN);
+      if (dup2(teeDescriptors[2 * i], STDIN_FILENO) == ERROR_OCURRED ||
+          dup2(descriptors[2 * i + 1], STDOUT_FILENO) == ERROR_OCURRED ||
+          dup2(io.teeFds[i], STDERR_FILENO + 1) == ERROR_OCURRED) {
+        exit(errno);
+      }
+      // This child does not exec, the other ends of every pipe must go or
+      // the jobs reading them would never reach end of file.
+      if (close_range(STDERR_FILENO + 2, ~0U, 0) == ERROR_OCURRED) {
+        exit(errno);
+      }
+      exit(teeOutput(STDERR_FILENO + 1) ? EXIT_SUCCESS : errno);
+    }
+    else handle.teePids[i] = copier;
+  }
+  if (feedFd != ERROR_OCURRED && started) {
+    pid_t feeder = fork();
+    if (feeder == ERROR_OCURRED) started = false;
+    else if (feeder == 0) {
+      if (!unblockSignals()) exit(errno);
+      if (io.processGroup && setpgid(0, handle.groupId) == ERROR_OCURRED) {
+        exit(errno);
+      }
+      signal(SIGPIPE, SIG_IGN);
+      if (dup2(feedFd, STDOUT_FILENO) == ERROR_OCURRED ||
+          close_range(STDERR_FILENO + 1, ~0U, 0) == ERROR_OCURRED) {
+        exit(errno);
+      }
+      exit(feedInput(*io.inputData) ? EXIT_SUCCESS : errno);
+    }
+    else {
+      handle.feederPid = feeder;
+      if (io.processGroup) setpgid(feeder, handle.groupId);
+    }
+  }
+
+  descriptors.insert(descriptors.end(), teeDescriptors.begin(),
+                     teeDescriptors.end());
+  if (ownsInput) descriptors.push_back(inputFd);
+  descriptors.push_back(feedFd);
+  if (ownsOutput) descriptors.push_back(outputFd);
+  closeDescriptors(descriptors);
+  if (!started) {
+    int error = errno;
+    stopPipeline(handle);
+    errno = error;
+  }
+  return started;
+}
+
+/**
+  Kills with SIGKILL the jobs of a pipeline and its feeder that were not
+  reaped yet. Jobs in a process group get a single signal to the group.
+  @param handle Reference to the handle returned by startPipeline.
+  @param reaped Whether each job, and then the feeder, was reaped.
+ */
+static void stopUnreaped(const pipeline_handle &handle,
+                         const vector <bool> &reaped) {
+  if (handle.groupId != ERROR_OCURRED) {
+    killpg(handle.groupId, SIGKILL);
+    return;
+  }
+  for (int i = 0; i < handle.pids.size(); ++i) {
+    if (!reaped[i]) kill(handle.pids[i], SIGKILL);
+  }
+  if (handle.feederPid != ERROR_OCURRED && !reaped.back()) {
+    kill(handle.feederPid, SIGKILL);
+  }
+}
+
+/**
+  Kills every job of a pipeline and its feeder with SIGKILL, with a single
+  signal to their process group when they have one. It must be called
+  before the pipeline is waited; waitPipeline reaps them afterwards.
+  @param handle Reference to the handle returned by startPipeline.
+ */
+void stopPipeline(pipeline_handle &handle) {
+  stopUnreaped(handle, vector <bool>(handle.pids.size() + 1, false));
+  handle.stopped = true;
+}
+
+/**
+  Stops a pipeline, as waitPipeline would, if one of its jobs already failed
+  it. It neither blocks nor reaps any job, for callers that read the streams
+  of a pipeline before waiting it.
+  @param handle Reference to the handle returned by startPipeline.
+  @return true if the pipeline is stopped, now or before.
+ */
+bool stopIfFailed(pipeline_handle &handle) {
+  if (handle.stopped) return true;
+  int jobsCount = handle.pids.size();
+  // Without pipefail only the last job fails the pipeline.
+  for (int i = handle.pipefail ? 0 : jobsCount - 1; i < jobsCount; ++i) {
+    siginfo_t info;
+    info.si_pid = 0;
+    // WNOWAIT leaves the job to be reaped by waitPipeline.
+    if (waitid(P_PID, handle.pids[i], &info, WEXITED | WNOHANG | WNOWAIT) ==
+        ERROR_OCURRED || info.si_pid == 0) continue;
+    bool failed = info.si_code == CLD_EXITED ? info.si_status != EXIT_SUCCESS
+                                             : info.si_status != SIGPIPE;
+    if (!failed) continue;
+    handle.failedJob = i;
+    stopPipeline(handle);
+    return true;
+  }
+  return false;
+}
+
+/**
+  Chooses the next job of a pipeline without a process group to wait for:
+  the last one first, then the others in order and the feeder at the end.
+  @param handle Reference to the handle returned by startPipeline.
+  @param reaped Whether each job, and then the feeder, was reaped.
+  @return Process id to wait for.
+ */
+static pid_t nextToWait(const pipeline_handle &handle,
+                        const vector <bool> &reaped) {
+  int jobsCount = handle.pids.size();
+  if (!reaped[jobsCount - 1]) return handle.pids[jobsCount - 1];
+  for (int i = 0; i + 1 < jobsCount; ++i) {
+    if (!reaped[i]) return handle.pids[i];
+  }
+  return handle.feederPid;
+}
+
+/**
+  Waits until every job of a pipeline, every copy of an output and the feeder
+  of its input finish. When the last job fails, or any job with 'pipefail',
+  the jobs still running are stopped, since nothing would read their output.
+  A job killed by SIGPIPE did not fail, the next one just stopped reading.
+  Jobs in a process group are reaped as they finish, the others in order,
+  the last one first. The status of the pipeline is the status of its last
+  job, or with 'pipefail' the one of the first job that failed.
+  @param handle Reference to the handle returned by startPipeline.
+  @param status Reference to the job_status to fill.
+  @return true if the last job could be waited, false otherwise.
+ */
+bool waitPipeline(pipeline_handle &handle, job_status &status) {
+  if (handle.pids.empty()) {
+    status = job_status();
+    status.success = true;
+    return true;
+  }
+  int jobsCount = handle.pids.size();
+  handle.statuses.assign(jobsCount, job_status());
+  handle.teeStatuses.assign(handle.teePids.size(), job_status());
+  // Whether each job, and then the feeder, was reaped. Every one of them is,
+  // so that none is left as a zombie and their CPU time is accounted to the
+  // caller.
+  vector <bool> reaped(jobsCount + 1, false);
+  reaped[jobsCount] = handle.feederPid == ERROR_OCURRED;
+  int pending = jobsCount + (reaped[jobsCount] ? 0 : 1);
+  int rawStatus;
+  while (pending > 0) {
+    pid_t child = handle.groupId != ERROR_OCURRED ?
+                  waitpid(-handle.groupId, &rawStatus, 0) :
+                  waitpid(nextToWait(handle, reaped), &rawStatus, 0);
+    if (child == ERROR_OCURRED) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    int slot = jobsCount;
+    for (int i = 0; i < jobsCount; ++i) {
+      if (handle.pids[i] == child) slot = i;
+    }
+    if (slot == jobsCount && child != handle.feederPid) continue;
+    reaped[slot] = true;
+    --pending;
+    if (slot == jobsCount) continue;
+    job_status &finished = handle.statuses[slot] = decodeStatus(rawStatus);
+    bool failed = !finished.success &&
+                  !(finished.signaled && finished.code == SIGPIPE);
+    // Jobs killed by the teardown did not fail on their own.
+    if (!failed || handle.stopped) continue;
+    if (handle.failedJob == ERROR_OCURRED) handle.failedJob = slot;
+    if ((handle.pipefail || slot == jobsCount - 1) && pending > 0) {
+      stopUnreaped(handle, reaped);
+      handle.stopped = true;
+    }
+  }
+  for (int i = 0; i < handle.teePids.size(); ++i) {
+    if (handle.teePids[i] == ERROR_OCURRED) continue;
+    if (waitpid(handle.teePids[i], &rawStatus, 0) == handle.teePids[i]) {
+      handle.teeStatuses[i] = decodeStatus(rawStatus);
+    }
+  }
+  if (!reaped[jobsCount - 1]) return false;
+  status = handle.statuses.back();
+  if (handle.pipefail && handle.failedJob != ERROR_OCURRED) {
+    status = handle.statuses[handle.failedJob];
+  }
+  return true;
+}
+
+/**
+  Runs a single job with its own stream redirection and waits for it.
+  @param job Reference to the job.
+  @param status Reference to the job_status to fill.
+  @return true if the job could be started and waited, false otherwise and
+          errno is set appropriately.
+ */
+bool runJob(const job_desc &job, job_status &status) {
+  pipeline_io io;
+  io.input = job.input;
+  io.output = job.output;
+  pipeline_handle handle;
+  if (!startPipeline(vector <job_desc>(1, job), io, handle)) return false;
+  return waitPipeline(handle, status);
+}
+
+/**
+  Decodes a status returned by wait, waitpid or wait4.
+  @param status Raw status.
+  @return Decoded status, with a description of the error if any.
+ */
+job_status decodeStatus(int status) {
+  job_status decoded;
+  // WIFEXITED returns true if the child terminated normally.
+  if (WIFEXITED(status)) {
+    // WEXITSTATUS returns the exit status of the child.
+    decoded.code = WEXITSTATUS(status);
+    decoded.success = decoded.code == EXIT_SUCCESS;
+    if (!decoded.success) decoded.description = strerror(decoded.code);
+  }
+  // WIFSIGNALED returns true if the child process was terminated by a signal.
+  else if (WIFSIGNALED(status)) {
+    // WTERMSIG returns the number of the signal that caused the child process
+    // to terminate.
+    decoded.signaled = true;
+    decoded.code = WTERMSIG(status);
+    decoded.description = strsignal(decoded.code);
+  }
+  return decoded;
+}
@@ -0,0 +1,281 @@
+#ifndef JOB_EXEC_H
+#define JOB_EXEC_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <map>
+
+extern const std::string STD_IN;
+extern const std::string STD_OUT;
+extern const std::string STD_ERR;
+
+/**
+  This structure stores the CPUs and NUMA nodes where a job will run. Empty
+  CPUs means that the job can run anywhere, a 0 node mask that its memory is
+  not bound.
+  */
+struct stage_placement {
+  std::vector <int> cpus;
+  unsigned long nodeMask;
+  stage_placement() : nodeMask(0) {}
+};
+
+/**
+  This structure stores the priority given to a job: its class, nice value
+  and scheduling policy (given together) and its I/O class and level.
+  'hasNice' is false and 'ioClass' is 0 when those were not given.
+  */
+struct priority_desc {
+  std::string priorityClass;
+  bool hasNice;
+  int nice, policy, ioClass, ioLevel;
+  priority_desc() : hasNice(false), nice(0), policy(0), ioClass(0),
+                    ioLevel(0) {}
+};
+
+/**
+  This structure stores the information of a job: the program to run with its
+  arguments, where its standard streams go (STD_IN, STD_OUT and STD_ERR keep
+  the streams of the caller, anything else is a file name) and how it is
+  launched. Once resolved, 'execPath' is where the program was found and
+  'execFd' a descriptor opened on it, which execJob runs without searching
+  PATH again (-1 when it was not resolved).
+  */
+struct job_desc {
+  std::string name, exec, input, output, error, execPath;
+  std::vector <std::string> args;
+  priority_desc priority;
+  stage_placement placement;
+  int execFd;
+  job_desc() : input(STD_IN), output(STD_OUT), error(STD_ERR), execFd(-1) {}
+};
+
+/**
+  This structure stores a program found by resolveExec: its path, a
+  close-on-exec descriptor opened on it and the identity of the file when it
+  was opened, to tell if it was replaced since.
+  */
+struct resolved_exec {
+  std::string path;
+  int fd;
+  dev_t device;
+  ino_t inode;
+  struct timespec modified;
+  resolved_exec() : fd(-1), device(0), inode(0) {}
+};
+
+/**
+  This structure stores the programs already resolved, by the name given in
+  the jobs, and the PATH they were searched in. 'lookups' counts the PATH
+  searches made and 'hits' the jobs resolved from the cache.
+  */
+struct exec_cache {
+  std::string searchPath;
+  std::map <std::string, resolved_exec> entries;
+  unsigned long long lookups, hits;
+  exec_cache() : lookups(0), hits(0) {}
+};
+
+/**
+  This structure describes where a pipeline reads from and writes to, with
+  the same conventions as the streams of a job. If 'inputFd' is not -1 the
+  first job reads from that descriptor instead of 'input'. If
+  'captureOutput' is set the output of the last job is not written to
+  'output' but can be read from the pipeline handle. Otherwise, if
+  'outputFd' is not -1 the output is written to that descriptor. Both stay
+  owned by the caller. 'errorFds', when not
+  empty, gives for each job a descriptor for its error stream (-1 to keep the
+  one of the job), also owned by the caller. 'teeFds' gives in the same way
+  a descriptor that receives a copy of the output of each job but the last.
+  If 'inputData' is not NULL the first job reads those bytes instead of
+  'input'; the caller keeps them unchanged until the pipeline is waited.
+  'processGroup' puts the jobs in a process group of their own, which is
+  stopped as a whole; jobs that read a terminal must stay in the group of
+  the caller. 'pipefail' stops the pipeline as soon as any job fails, and
+  makes that job's status the status of the pipeline.
+  */
+struct pipeline_io {
+  std::string input, output;
+  bool captureOutput;
+  int inputFd, outputFd;
+  std::vector <int> errorFds, teeFds;
+  const std::string *inputData;
+  bool processGroup, pipefail;
+  pipeline_io() : input(STD_IN), output(STD_OUT), captureOutput(false),
+                  inputFd(-1), outputFd(-1), inputData(NULL),
+                  processGroup(false), pipefail(false) {}
+};
+
+/**
+  This structure stores how a job finished. 'code' is the exit status when
+  the job exited and the signal number when it was killed by a signal.
+  */
+struct job_status {
+  bool success, signaled;
+  int code;
+  std::string description;
+  job_status() : success(false), signaled(false), code(0) {}
+};
+
+/**
+  This structure is returned when a pipeline starts: the process id of each
+  job, in pipeline order, and the descriptor to read the captured output from
+  (-1 if it is not captured). The caller owns and must close 'outputFd'.
+  'teePids' has, for each job whose output is copied, the process id of the
+  child that copies it (-1 for the others), and 'feederPid' that of the
+  child that feeds the input data (-1 when there is none). 'groupId' is the
+  process group of the jobs and the feeder (-1 when they have none),
+  'stopped' tells if they were killed and 'failedJob' is the first job seen
+  failing (-1 while none did). Once the pipeline is waited,
+  'statuses' and 'teeStatuses' tell how each job and each copy finished.
+  */
+struct pipeline_handle {
+  std::vector <pid_t> pids, teePids;
+  pid_t feederPid, groupId;
+  int outputFd;
+  bool pipefail, stopped;
+  int failedJob;
+  std::vector <job_status> statuses, teeStatuses;
+  pipeline_handle() : feederPid(-1), groupId(-1), outputFd(-1),
+                      pipefail(false), stopped(false), failedJob(-1) {}
+};
+
+/**
+  Builds the array of arguments for exec: [exec, args..., NULL]. The pointers
+  are valid while the job is not modified.
+  @param job Reference to the job.
+  @param jobArgs Reference to the vector to fill.
+ */
+void buildJobArgs(const job_desc &job, std::vector <char *> &jobArgs);
+
+/**
+  Redirects the standard streams of the calling process to the files given by
+  a job. Streams set to STD_IN, STD_OUT or STD_ERR are left untouched. It is
+  meant to be called in the child before execJob.
+  @param job Reference to the job.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool redirectStreams(const job_desc &job);
+
+/**
+  Applies a placement to the calling process: sets its CPU affinity and, if a
+  node mask is given, binds its memory to those NUMA nodes. A CPU that does
+  not fit in a cpu_set_t fails with EINVAL instead of being left out.
+  @param placement Placement to apply.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool applyPlacement(const stage_placement &placement);
+
+/**
+  Applies a priority to the calling process: nice value, scheduling policy
+  and I/O priority.
+  @param priority Priority to apply.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately.
+ */
+bool applyPriority(const priority_desc &priority);
+
+/**
+  Finds the program of a job the way execvp would (in PATH unless it has a
+  slash) and opens it, filling 'execPath' and 'execFd' of the job. Programs
+  are resolved once and kept in the cache while PATH does not change and the
+  file found is not replaced. Descriptors stay owned by the cache.
+  @param cache Reference to the cache.
+  @param job Reference to the job.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately: ENOENT when the program is not found, EACCES when it
+          is found but cannot be executed.
+ */
+bool resolveExec(exec_cache &cache, job_desc &job);
+
+/**
+  Closes every descriptor of the cache and forgets its programs.
+  @param cache Reference to the cache.
+ */
+void clearExecCache(exec_cache &cache);
+
+/**
+  Applies the placement and priority of a job to the calling process and
+  replaces it with the job program, through its resolved descriptor when it
+  has one. It only returns on error.
+  @param job Reference to the job.
+  @return false, with errno set appropriately.
+ */
+bool execJob(const job_desc &job);
+
+/**
+  Starts a pipeline: forks one child per job, connecting the output of each
+  job to the input of the next one with pipes. The first job reads from the
+  pipeline input and the last one writes to the pipeline output. Each job
+  still redirects its own error stream if it gives a file, unless the
+  pipeline gives a descriptor for it. A job whose output is copied writes to
+  a child that tees it into the next pipe and the copy descriptor; the copy
+  goes on to the end even if the next job stops reading. Input data is fed
+  by a child that maps it into the pipe of the first job with vmsplice. A
+  child that cannot execute its job exits with errno as status. The jobs and
+  the feeder join the process group of the first job when the pipeline asks
+  for one; the copies do not, they must finish even if the jobs are stopped.
+  The children start with no signal blocked, so the caller may block some
+  while the pipeline starts.
+  @param jobs Reference to the jobs, in pipeline order.
+  @param io Reference to the input and output of the pipeline.
+  @param handle Reference to the pipeline_handle to fill.
+  @return On success, returns true. On error, returns false and errno is set
+          appropriately; jobs already started are stopped and left in the
+          handle to be waited.
+ */
+bool startPipeline(const std::vector <job_desc> &jobs, const pipeline_io &io,
+                   pipeline_handle &handle);
+
+/**
+  Kills every job of a pipeline and its feeder with SIGKILL, with a single
+  signal to their process group when they have one. It must be called
+  before the pipeline is waited; waitPipeline reaps them afterwards.
+  @param handle Reference to the handle returned by startPipeline.
+ */
+void stopPipeline(pipeline_handle &handle);
+
+/**
+  Stops a pipeline, as waitPipeline would, if one of its jobs already failed
+  it. It neither blocks nor reaps any job, for callers that read the streams
+  of a pipeline before waiting it.
+  @param handle Reference to the handle returned by startPipeline.
+  @return true if the pipeline is stopped, now or before.
+ */
+bool stopIfFailed(pipeline_handle &handle);
+
+/**
+  Waits until every job of a pipeline, every copy of an output and the feeder
+  of its input finish. When the last job fails, or any job with 'pipefail',
+  the jobs still running are stopped, since nothing would read their output.
+  A job killed by SIGPIPE did not fail, the next one just stopped reading.
+  Jobs in a process group are reaped as they finish, the others in order,
+  the last one first. The status of the pipeline is the status of its last
+  job, or with 'pipefail' the one of the first job that failed.
+  @param handle Reference to the handle returned by startPipeline.
+  @param status Reference to the job_status to fill.
+  @return true if the last job could be waited, false otherwise.
+ */
+bool waitPipeline(pipeline_handle &handle, job_status &status);
+
+/**
+  Runs a single job with its own stream redirection and waits for it.
+  @param job Reference to the job.
+  @param status Reference to the job_status to fill.
+  @return true if the job could be started and waited, false otherwise and
+          errno is set appropriately.
+ */
+bool runJob(const job_desc &job, job_status &status);
+
+/**
+  Decodes a status returned by wait, waitpid or wait4.
+  @param status Raw status.
+  @return Decoded status, with a description of the error if any.
+ */
+job_status decodeStatus(int status);
+
+#endif